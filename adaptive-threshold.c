@@ -0,0 +1,110 @@
+/** @file adaptive-threshold.c
+ *
+ * @brief Tracks the noise floor and click peak level and derives hysteresis
+ * thresholds from them.
+ */
+
+#include <math.h>
+
+#include "adaptive-threshold.h"
+
+#define MIN_LEVEL_DB -120.0f
+
+static float level_dB (float linear)
+{
+	float dB = 20.0f * log10f(linear);
+	return dB > MIN_LEVEL_DB ? dB : MIN_LEVEL_DB;
+}
+
+/* Frugal streaming quantile: step up by p or down by (1 - p) times the step
+ * size, which settles where a fraction p of the samples lie below.
+ */
+static void quantile_update (quantile_estimator_t *q, float x, float step)
+{
+	if (x > q->value)
+		q->value += step * q->p;
+	else if (x < q->value)
+		q->value -= step * (1.0f - q->p);
+}
+
+static void updateThresholds (adaptive_threshold_t *at)
+{
+	float floor_dB = at->noiseFloor_dB.value;
+	float span = at->clickPeak_dB.value - floor_dB;
+
+	if (span < at->minSpan_dB)
+		span = at->minSpan_dB;
+
+	float rising = floor_dB + at->risingFraction * span;
+	float fallingMargin = at->fallingFraction * span;
+
+	if (fallingMargin < at->minFallingMargin_dB)
+		fallingMargin = at->minFallingMargin_dB;
+
+	float falling = floor_dB + fallingMargin;
+
+	if (rising > 0.0f)
+		rising = 0.0f;
+
+	if (falling > rising)
+		falling = rising;
+
+	at->risingThreshold_dB = rising;
+	at->fallingThreshold_dB = falling;
+}
+
+void adaptive_threshold_init (adaptive_threshold_t *at, float risingThreshold_dB, float fallingThreshold_dB)
+{
+	at->noiseRate_dB = 20.0f;
+	at->clickStep_dB = 2.0f;
+	at->searchRate_dB = 3.0f;
+	at->searchAfter_s = 2.0f;
+	at->risingFraction = 0.5f;
+	at->fallingFraction = 0.15f;
+	at->minFallingMargin_dB = 6.0f;
+	at->minSpan_dB = 12.0f;
+
+	at->noiseFloor_dB.p = 0.2f;
+	at->clickPeak_dB.p = 0.5f;
+	at->secondsSinceClick = 0.0f;
+
+	// invert updateThresholds() so the starting thresholds are reproduced
+	float span = (risingThreshold_dB - fallingThreshold_dB) / (at->risingFraction - at->fallingFraction);
+	if (span < at->minSpan_dB)
+		span = at->minSpan_dB;
+
+	at->noiseFloor_dB.value = risingThreshold_dB - at->risingFraction * span;
+	at->clickPeak_dB.value = at->noiseFloor_dB.value + span;
+
+	updateThresholds(at);
+}
+
+void adaptive_threshold_set_levels (adaptive_threshold_t *at, float noiseFloor_dB, float clickPeak_dB)
+{
+	at->noiseFloor_dB.value = noiseFloor_dB;
+	at->clickPeak_dB.value = clickPeak_dB;
+	at->secondsSinceClick = 0.0f;
+	updateThresholds(at);
+}
+
+void adaptive_threshold_block (adaptive_threshold_t *at, float blockPeak, float blockSeconds)
+{
+	quantile_update(&at->noiseFloor_dB, level_dB(blockPeak), at->noiseRate_dB * blockSeconds);
+
+	// clicks lost (gain dropped?), lower the click level until they show up again
+	at->secondsSinceClick += blockSeconds;
+	if (at->secondsSinceClick > at->searchAfter_s)
+		at->clickPeak_dB.value -= at->searchRate_dB * blockSeconds;
+
+	if (at->clickPeak_dB.value < at->noiseFloor_dB.value + at->minSpan_dB)
+		at->clickPeak_dB.value = at->noiseFloor_dB.value + at->minSpan_dB;
+
+	updateThresholds(at);
+}
+
+void adaptive_threshold_click (adaptive_threshold_t *at, float clickPeak)
+{
+	at->secondsSinceClick = 0.0f;
+	quantile_update(&at->clickPeak_dB, level_dB(clickPeak), at->clickStep_dB);
+	updateThresholds(at);
+}
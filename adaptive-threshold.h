@@ -0,0 +1,54 @@
+/** @file adaptive-threshold.h
+ *
+ * @brief Tracks the noise floor and click peak level and derives hysteresis
+ * thresholds from them.
+ *
+ * Both levels are streaming quantile estimates in dB: the noise floor is a
+ * low quantile of per-cycle peak levels, the click level is the median of
+ * per-click peaks.  Each update is a compare and an add, so it is cheap
+ * enough to run once per process() cycle.
+ */
+
+#ifndef ADAPTIVE_THRESHOLD_H
+#define ADAPTIVE_THRESHOLD_H
+
+#include <stdbool.h>
+
+typedef struct {
+	float p; // target quantile, 0 to 1
+	float value;
+} quantile_estimator_t;
+
+typedef struct {
+	quantile_estimator_t noiseFloor_dB; // quantile of per-cycle peaks
+	quantile_estimator_t clickPeak_dB; // median of per-click peaks
+	float secondsSinceClick;
+
+	// tunables
+	float noiseRate_dB; // noise floor step size, dB per second
+	float clickStep_dB; // click level step size, dB per click
+	float searchRate_dB; // how fast the click level sinks when clicks are lost, dB per second
+	float searchAfter_s; // seconds without clicks before searching
+	float risingFraction; // rising threshold position between floor and click level
+	float fallingFraction; // falling threshold position between floor and click level
+	float minFallingMargin_dB; // falling threshold at least this far above the floor
+	float minSpan_dB; // click level at least this far above the floor
+
+	// outputs
+	float risingThreshold_dB;
+	float fallingThreshold_dB;
+} adaptive_threshold_t;
+
+// start from the given thresholds so enabling adaptation doesn't jump
+void adaptive_threshold_init (adaptive_threshold_t *at, float risingThreshold_dB, float fallingThreshold_dB);
+
+// jump straight to known levels, e.g. from a calibration pass
+void adaptive_threshold_set_levels (adaptive_threshold_t *at, float noiseFloor_dB, float clickPeak_dB);
+
+// once per cycle with the peak absolute input of the cycle
+void adaptive_threshold_block (adaptive_threshold_t *at, float blockPeak, float blockSeconds);
+
+// once per detected click with the peak absolute input of the click
+void adaptive_threshold_click (adaptive_threshold_t *at, float clickPeak);
+
+#endif
@@ -0,0 +1,88 @@
+/** @file alsa-seq.c
+ *
+ * @brief MIDI clock output through the ALSA sequencer.
+ */
+
+#include <stdio.h>
+
+#include "alsa-seq.h"
+
+int alsa_seq_open (alsa_seq_t *as, const char *clientName, const char *destination)
+{
+	snd_seq_addr_t address;
+
+	if (snd_seq_open(&as->seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) {
+		fprintf(stderr, "cannot open the ALSA sequencer\n");
+		return -1;
+	}
+
+	snd_seq_set_client_name(as->seq, clientName);
+
+	as->port = snd_seq_create_simple_port(as->seq, "MIDI Clock",
+			SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+			SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+	as->queue = snd_seq_alloc_named_queue(as->seq, clientName);
+
+	if (as->port < 0 || as->queue < 0 || snd_midi_event_new(16, &as->encoder) < 0) {
+		fprintf(stderr, "cannot set up the ALSA sequencer port\n");
+		snd_seq_close(as->seq);
+		return -1;
+	}
+
+	if (destination != NULL && (snd_seq_parse_address(as->seq, &address, destination) < 0
+			|| snd_seq_connect_to(as->seq, as->port, address.client, address.port) < 0)) {
+		fprintf(stderr, "cannot connect the ALSA sequencer port to %s\n", destination);
+		alsa_seq_close(as);
+		return -1;
+	}
+
+	snd_seq_start_queue(as->seq, as->queue, NULL);
+	snd_seq_drain_output(as->seq);
+	as->queueOffset_us = 0;
+
+	return 0;
+}
+
+void alsa_seq_close (alsa_seq_t *as)
+{
+	snd_midi_event_free(as->encoder);
+	snd_seq_close(as->seq);
+}
+
+void alsa_seq_align (alsa_seq_t *as, uint64_t now_us)
+{
+	snd_seq_queue_status_t *status;
+
+	snd_seq_queue_status_alloca(&status);
+	if (snd_seq_get_queue_status(as->seq, as->queue, status) < 0)
+		return;
+
+	const snd_seq_real_time_t *queueTime = snd_seq_queue_status_get_real_time(status);
+	as->queueOffset_us = (int64_t) now_us - ((int64_t) queueTime->tv_sec * 1000000 + queueTime->tv_nsec / 1000);
+}
+
+int alsa_seq_send (alsa_seq_t *as, uint64_t time_us, const unsigned char *message, int size)
+{
+	snd_seq_event_t event;
+	snd_seq_real_time_t due;
+
+	snd_seq_ev_clear(&event);
+	snd_midi_event_reset_encode(as->encoder);
+
+	if (snd_midi_event_encode(as->encoder, message, size, &event) != size || event.type == SND_SEQ_EVENT_NONE)
+		return -1;
+
+	// due times already passed are sent right away
+	int64_t queue_us = (int64_t) time_us - as->queueOffset_us;
+	if (queue_us < 0)
+		queue_us = 0;
+
+	due.tv_sec = queue_us / 1000000;
+	due.tv_nsec = queue_us % 1000000 * 1000;
+
+	snd_seq_ev_set_source(&event, as->port);
+	snd_seq_ev_set_subs(&event);
+	snd_seq_ev_schedule_real(&event, as->queue, 0, &due);
+
+	return snd_seq_event_output_direct(as->seq, &event) < 0 ? -1 : 0;
+}
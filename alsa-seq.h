@@ -0,0 +1,48 @@
+/** @file alsa-seq.h
+ *
+ * @brief MIDI clock output through the ALSA sequencer, for hardware
+ * interfaces without a2jmidid bridging.
+ *
+ * Events are queued ahead of time on a sequencer queue, timestamped in
+ * real time, and the kernel sends them when they are due.  Their timing
+ * then doesn't depend on the JACK period: ticks go out at the fraction of
+ * a frame they were predicted for rather than a period after the cycle
+ * they were written in.  Times are given on the caller's microsecond clock,
+ * which alsa_seq_align() lines the queue up with.
+ *
+ * Only built when ALSA is found (HAVE_ALSA).  Test without hardware through
+ * the snd-virmidi or snd-seq-dummy modules.
+ */
+
+#ifndef ALSA_SEQ_H
+#define ALSA_SEQ_H
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#define ALSA_SEQ_ALIGN_S 1 // between realignments of the queue with the caller's clock
+
+typedef struct {
+	snd_seq_t *seq;
+	int port;
+	int queue;
+	snd_midi_event_t *encoder; // raw MIDI bytes to sequencer events
+
+	int64_t queueOffset_us; // caller's clock minus queue time
+} alsa_seq_t;
+
+/*
+ * Open a sequencer client with a "MIDI Clock" output port and start its
+ * queue.  The port is connected to destination ("client:port", or a client
+ * name) unless that is NULL.  Returns 0, or -1 with a message on stderr.
+ */
+int alsa_seq_open (alsa_seq_t *as, const char *clientName, const char *destination);
+void alsa_seq_close (alsa_seq_t *as);
+
+// the caller's clock reads now_us at this moment
+void alsa_seq_align (alsa_seq_t *as, uint64_t now_us);
+
+// queue a MIDI message to go out at time_us on the caller's clock, at once if that has passed
+int alsa_seq_send (alsa_seq_t *as, uint64_t time_us, const unsigned char *message, int size);
+
+#endif
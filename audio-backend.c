@@ -0,0 +1,519 @@
+/** @file audio-backend.c
+ *
+ * @brief ALSA and file backends for running without a JACK server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "audio-backend.h"
+#include "wav.h"
+
+#define ALSA_BACKEND_PRIORITY 70 // SCHED_FIFO, below the interrupt threads
+
+// the start of the latest cycle on both timelines
+typedef struct {
+	uint32_t frame;
+	uint64_t time_us;
+} cycle_stamp_t;
+
+typedef struct {
+	audio_cycle_t cycle;
+	void *arg;
+	pthread_t thread;
+	atomic_bool running;
+	float *in, *out;
+
+	// written by the backend thread a cycle at a time, so a reader is done
+	// with a stamp long before it is written again
+	cycle_stamp_t stamps[2];
+	atomic_uint latestStamp;
+
+	// file
+	float *samples; // NULL for silence
+	long nframes;
+	long position;
+
+#ifdef HAVE_ALSA
+	snd_pcm_t *capture, *playback;
+	snd_pcm_format_t format;
+	unsigned int playbackChannels; // capture is read from its first channel
+	snd_pcm_uframes_t bufferFrames; // of playback
+#endif
+} backend_state_t;
+
+static uint64_t monotonicMicroseconds (void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void stampCycle (backend_state_t *bs, uint32_t frame, uint64_t time_us)
+{
+	unsigned int next = !atomic_load_explicit(&bs->latestStamp, memory_order_relaxed);
+
+	bs->stamps[next] = (cycle_stamp_t) { frame, time_us };
+	atomic_store_explicit(&bs->latestStamp, next, memory_order_release);
+}
+
+static cycle_stamp_t latestStamp (backend_state_t *bs)
+{
+	return bs->stamps[atomic_load_explicit(&bs->latestStamp, memory_order_acquire)];
+}
+
+static uint32_t stampFrameTime (audio_backend_t *ab)
+{
+	cycle_stamp_t stamp = latestStamp(ab->state);
+
+	return stamp.frame + (monotonicMicroseconds() - stamp.time_us) * ab->sampleRate / 1000000;
+}
+
+static uint64_t stampFramesToTime (audio_backend_t *ab, uint32_t frame)
+{
+	cycle_stamp_t stamp = latestStamp(ab->state);
+
+	// frames before the stamp count back, across the wrap of the timeline
+	return stamp.time_us + (int64_t) (int32_t) (frame - stamp.frame) * 1000000 / ab->sampleRate;
+}
+
+static uint64_t stampGetTime (audio_backend_t *ab)
+{
+	return monotonicMicroseconds();
+}
+
+static backend_state_t *newState (audio_backend_t *ab)
+{
+	backend_state_t *bs = calloc(1, sizeof(*bs));
+
+	if (bs == NULL)
+		return NULL;
+
+	bs->in = calloc(ab->periodFrames, sizeof(float));
+	bs->out = calloc(ab->periodFrames, sizeof(float));
+
+	if (bs->in == NULL || bs->out == NULL) {
+		free(bs->in);
+		free(bs->out);
+		free(bs);
+		return NULL;
+	}
+
+	atomic_init(&bs->running, false);
+	atomic_init(&bs->latestStamp, 0);
+	bs->stamps[0].time_us = monotonicMicroseconds();
+	return bs;
+}
+
+/*
+ * File backend: a period of the file each time a period has passed since
+ * the start, so pacing errors don't add up.
+ */
+static void *fileThread (void *arg)
+{
+	audio_backend_t *ab = arg;
+	backend_state_t *bs = ab->state;
+	uint64_t start_us = monotonicMicroseconds(), frames = 0;
+
+	while (atomic_load(&bs->running)) {
+		uint64_t due_us = start_us + (frames + ab->periodFrames) * 1000000 / ab->sampleRate;
+		struct timespec due = { due_us / 1000000, due_us % 1000000 * 1000 };
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+			;
+
+		long n = 0;
+		if (bs->samples != NULL && bs->position < bs->nframes) {
+			n = bs->nframes - bs->position < ab->periodFrames ? bs->nframes - bs->position : ab->periodFrames;
+			memcpy(bs->in, bs->samples + bs->position, n * sizeof(float));
+			bs->position += n;
+		}
+		memset(bs->in + n, 0, (ab->periodFrames - n) * sizeof(float));
+
+		stampCycle(bs, frames, due_us);
+		bs->cycle(bs->in, bs->out, ab->periodFrames, frames, bs->arg);
+		frames += ab->periodFrames;
+	}
+
+	return NULL;
+}
+
+static int fileStart (audio_backend_t *ab, audio_cycle_t cycle, void *arg)
+{
+	backend_state_t *bs = ab->state;
+
+	bs->cycle = cycle;
+	bs->arg = arg;
+	atomic_store(&bs->running, true);
+
+	if (pthread_create(&bs->thread, NULL, fileThread, ab)) {
+		fprintf(stderr, "cannot start the file backend thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void stopThread (audio_backend_t *ab)
+{
+	backend_state_t *bs = ab->state;
+
+	if (atomic_exchange(&bs->running, false))
+		pthread_join(bs->thread, NULL);
+}
+
+int audio_backend_file_open (audio_backend_t *ab, const char *path)
+{
+	float *samples = NULL, sampleRate = AUDIO_BACKEND_RATE;
+	long nframes = 0;
+
+	if (path != NULL && wav_read_mono(path, &samples, &nframes, &sampleRate))
+		return -1;
+
+	ab->name = path != NULL ? "file" : "null";
+	ab->sampleRate = sampleRate;
+	ab->periodFrames = AUDIO_BACKEND_PERIOD;
+	ab->start = fileStart;
+	ab->stop = stopThread;
+	ab->frame_time = stampFrameTime;
+	ab->frames_to_time = stampFramesToTime;
+	ab->get_time = stampGetTime;
+	ab->state = newState(ab);
+
+	if (ab->state == NULL) {
+		fprintf(stderr, "cannot allocate the file backend\n");
+		free(samples);
+		return -1;
+	}
+
+	backend_state_t *bs = ab->state;
+	bs->samples = samples;
+	bs->nframes = nframes;
+	return 0;
+}
+
+#ifdef HAVE_ALSA
+/*
+ * ALSA backend.  The sample formats tried are those the converters commonly
+ * offer, float first since it needs no scaling.
+ */
+static const snd_pcm_format_t alsaFormats[] = { SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S16_LE };
+
+// set up a PCM for mmap access; rate and period are asked for and returned as granted
+static int setupPcm (snd_pcm_t *pcm, snd_pcm_format_t *format, unsigned int *channels,
+		unsigned int *rate, snd_pcm_uframes_t *period, snd_pcm_uframes_t *buffer)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t boundary;
+	unsigned int periods = 2;
+	size_t f;
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_sw_params_alloca(&sw);
+
+	if (snd_pcm_hw_params_any(pcm, hw) < 0
+			|| snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0)
+		return -1;
+
+	for (f = 0; f < sizeof(alsaFormats) / sizeof(alsaFormats[0]); f++)
+		if (snd_pcm_hw_params_set_format(pcm, hw, alsaFormats[f]) == 0)
+			break;
+	if (f == sizeof(alsaFormats) / sizeof(alsaFormats[0]))
+		return -1;
+	*format = alsaFormats[f];
+
+	if (snd_pcm_hw_params_get_channels_min(hw, channels) < 0
+			|| snd_pcm_hw_params_set_channels(pcm, hw, *channels) < 0
+			|| snd_pcm_hw_params_set_rate_near(pcm, hw, rate, NULL) < 0
+			|| snd_pcm_hw_params_set_period_size_near(pcm, hw, period, NULL) < 0
+			|| snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, NULL) < 0
+			|| snd_pcm_hw_params(pcm, hw) < 0
+			|| snd_pcm_hw_params_get_buffer_size(hw, buffer) < 0)
+		return -1;
+
+	// woken a period at a time, and started by hand once the playback buffer is filled
+	if (snd_pcm_sw_params_current(pcm, sw) < 0
+			|| snd_pcm_sw_params_get_boundary(sw, &boundary) < 0
+			|| snd_pcm_sw_params_set_avail_min(pcm, sw, *period) < 0
+			|| snd_pcm_sw_params_set_start_threshold(pcm, sw, boundary) < 0
+			|| snd_pcm_sw_params(pcm, sw) < 0)
+		return -1;
+
+	return 0;
+}
+
+static inline void *sampleAddress (const snd_pcm_channel_area_t *area, snd_pcm_uframes_t frame)
+{
+	return (char *) area->addr + (area->first + frame * area->step) / 8;
+}
+
+static inline float readSample (snd_pcm_format_t format, const void *sample)
+{
+	switch (format) {
+		case SND_PCM_FORMAT_FLOAT_LE:
+		return *(const float *) sample;
+
+		case SND_PCM_FORMAT_S32_LE:
+		return *(const int32_t *) sample * (1.0f / 2147483648.0f);
+
+		default:
+		return *(const int16_t *) sample * (1.0f / 32768.0f);
+	}
+}
+
+static inline void writeSample (snd_pcm_format_t format, void *sample, float x)
+{
+	x = x > 1.0f ? 1.0f : x < -1.0f ? -1.0f : x;
+
+	switch (format) {
+		case SND_PCM_FORMAT_FLOAT_LE:
+		*(float *) sample = x;
+		break;
+
+		case SND_PCM_FORMAT_S32_LE:
+		*(int32_t *) sample = x * 2147483647.0f;
+		break;
+
+		default:
+		*(int16_t *) sample = x * 32767.0f;
+		break;
+	}
+}
+
+// the first capture channel of n frames, from the device buffer; returns 0, or a negative error
+static int readCapture (backend_state_t *bs, snd_pcm_uframes_t n)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames, done = 0;
+
+	// the area may wrap around the end of the buffer, which takes two goes
+	while (done < n) {
+		frames = n - done;
+		int error = snd_pcm_mmap_begin(bs->capture, &areas, &offset, &frames);
+		if (error < 0)
+			return error;
+
+		for (snd_pcm_uframes_t i = 0; i < frames; i++)
+			bs->in[done + i] = readSample(bs->format, sampleAddress(&areas[0], offset + i));
+
+		snd_pcm_sframes_t committed = snd_pcm_mmap_commit(bs->capture, offset, frames);
+		if (committed < 0 || (snd_pcm_uframes_t) committed != frames)
+			return committed < 0 ? committed : -EPIPE;
+		done += frames;
+	}
+
+	return 0;
+}
+
+// n frames of out (or silence if NULL) on every playback channel, into the device buffer
+static int writePlayback (backend_state_t *bs, const float *out, snd_pcm_uframes_t n)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames, done = 0;
+
+	while (done < n) {
+		frames = n - done;
+		int error = snd_pcm_mmap_begin(bs->playback, &areas, &offset, &frames);
+		if (error < 0)
+			return error;
+
+		for (unsigned int c = 0; c < bs->playbackChannels; c++)
+			for (snd_pcm_uframes_t i = 0; i < frames; i++)
+				writeSample(bs->format, sampleAddress(&areas[c], offset + i), out != NULL ? out[done + i] : 0.0f);
+
+		snd_pcm_sframes_t committed = snd_pcm_mmap_commit(bs->playback, offset, frames);
+		if (committed < 0 || (snd_pcm_uframes_t) committed != frames)
+			return committed < 0 ? committed : -EPIPE;
+		done += frames;
+	}
+
+	return 0;
+}
+
+// (re)start both directions, linked, with the playback buffer full of silence
+static int startPcms (backend_state_t *bs)
+{
+	snd_pcm_drop(bs->capture);
+
+	if (snd_pcm_prepare(bs->capture) < 0 || writePlayback(bs, NULL, bs->bufferFrames) < 0)
+		return -1;
+
+	return snd_pcm_start(bs->capture) < 0 ? -1 : 0;
+}
+
+static void *alsaThread (void *arg)
+{
+	audio_backend_t *ab = arg;
+	backend_state_t *bs = ab->state;
+	uint32_t frames = 0;
+
+	while (atomic_load(&bs->running)) {
+		snd_pcm_sframes_t avail;
+
+		if (snd_pcm_wait(bs->capture, 1000) < 0 || (avail = snd_pcm_avail_update(bs->capture)) < 0) {
+			// an xrun costs the audio since the last cycle, the timeline goes on from where it is
+			if (startPcms(bs) < 0) {
+				fprintf(stderr, "ALSA backend: cannot restart the device\n");
+				break;
+			}
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t) avail < ab->periodFrames)
+			continue;
+
+		// the cycle's first frame was captured a period ago, plus whatever more has come in since
+		uint64_t now_us = monotonicMicroseconds();
+		stampCycle(bs, frames, now_us - (uint64_t) (avail - ab->periodFrames) * 1000000 / ab->sampleRate);
+
+		if (readCapture(bs, ab->periodFrames) < 0) {
+			startPcms(bs);
+			continue;
+		}
+
+		bs->cycle(bs->in, bs->out, ab->periodFrames, frames, bs->arg);
+		frames += ab->periodFrames;
+
+		if (writePlayback(bs, bs->out, ab->periodFrames) < 0)
+			startPcms(bs);
+	}
+
+	return NULL;
+}
+
+static int alsaStart (audio_backend_t *ab, audio_cycle_t cycle, void *arg)
+{
+	backend_state_t *bs = ab->state;
+	pthread_attr_t attributes;
+	struct sched_param priority = { .sched_priority = ALSA_BACKEND_PRIORITY };
+
+	bs->cycle = cycle;
+	bs->arg = arg;
+	atomic_store(&bs->running, true);
+
+	if (startPcms(bs) < 0) {
+		fprintf(stderr, "cannot start the ALSA device\n");
+		return -1;
+	}
+
+	pthread_attr_init(&attributes);
+	pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attributes, SCHED_FIFO);
+	pthread_attr_setschedparam(&attributes, &priority);
+
+	int error = pthread_create(&bs->thread, &attributes, alsaThread, ab);
+	pthread_attr_destroy(&attributes);
+
+	// without the rights to realtime scheduling, run anyway
+	if (error == EPERM) {
+		fprintf(stderr, "no realtime scheduling for the ALSA backend, xruns are likely\n");
+		error = pthread_create(&bs->thread, NULL, alsaThread, ab);
+	}
+
+	if (error) {
+		fprintf(stderr, "cannot start the ALSA backend thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void alsaStop (audio_backend_t *ab)
+{
+	backend_state_t *bs = ab->state;
+
+	stopThread(ab);
+	snd_pcm_drop(bs->capture);
+}
+
+int audio_backend_alsa_open (audio_backend_t *ab, const char *device)
+{
+	snd_pcm_t *capture = NULL, *playback = NULL;
+	snd_pcm_format_t captureFormat, playbackFormat;
+	unsigned int captureChannels, playbackChannels;
+	unsigned int captureRate = AUDIO_BACKEND_RATE, playbackRate = AUDIO_BACKEND_RATE;
+	snd_pcm_uframes_t capturePeriod = AUDIO_BACKEND_PERIOD, playbackPeriod = AUDIO_BACKEND_PERIOD;
+	snd_pcm_uframes_t captureBuffer, playbackBuffer;
+
+	if (snd_pcm_open(&capture, device, SND_PCM_STREAM_CAPTURE, 0) < 0
+			|| snd_pcm_open(&playback, device, SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+		fprintf(stderr, "cannot open ALSA device %s\n", device);
+		goto fail;
+	}
+
+	// both directions run off the same cycle, so they must agree
+	if (setupPcm(capture, &captureFormat, &captureChannels, &captureRate, &capturePeriod, &captureBuffer)
+			|| setupPcm(playback, &playbackFormat, &playbackChannels, &playbackRate, &playbackPeriod, &playbackBuffer)
+			|| captureFormat != playbackFormat || captureRate != playbackRate || capturePeriod != playbackPeriod) {
+		fprintf(stderr, "cannot set up ALSA device %s for mmap capture and playback alike\n", device);
+		goto fail;
+	}
+
+	if (snd_pcm_link(capture, playback) < 0) {
+		fprintf(stderr, "cannot link capture and playback of ALSA device %s\n", device);
+		goto fail;
+	}
+
+	ab->name = "ALSA";
+	ab->sampleRate = captureRate;
+	ab->periodFrames = capturePeriod;
+	ab->start = alsaStart;
+	ab->stop = alsaStop;
+	ab->frame_time = stampFrameTime;
+	ab->frames_to_time = stampFramesToTime;
+	ab->get_time = stampGetTime;
+	ab->state = newState(ab);
+
+	if (ab->state == NULL) {
+		fprintf(stderr, "cannot allocate the ALSA backend\n");
+		goto fail;
+	}
+
+	backend_state_t *bs = ab->state;
+	bs->capture = capture;
+	bs->playback = playback;
+	bs->format = captureFormat;
+	bs->playbackChannels = playbackChannels;
+	bs->bufferFrames = playbackBuffer;
+	return 0;
+
+fail:
+	if (capture != NULL)
+		snd_pcm_close(capture);
+	if (playback != NULL)
+		snd_pcm_close(playback);
+	return -1;
+}
+#endif
+
+void audio_backend_close (audio_backend_t *ab)
+{
+	backend_state_t *bs = ab->state;
+
+	ab->stop(ab);
+
+#ifdef HAVE_ALSA
+	if (bs->capture != NULL) {
+		snd_pcm_close(bs->capture);
+		snd_pcm_close(bs->playback);
+	}
+#endif
+
+	free(bs->samples);
+	free(bs->in);
+	free(bs->out);
+	free(bs);
+}
@@ -0,0 +1,66 @@
+/** @file audio-backend.h
+ *
+ * @brief Where the audio comes from and goes to, so the detector doesn't
+ * need a JACK server.
+ *
+ * A backend runs the cycle callback from a thread of its own, each time with
+ * a period of input to analyze and of output to fill, numbered on its own
+ * frame timeline.  It also maps that timeline to microseconds, for MIDI
+ * output scheduled outside the cycle, and tells the frame being played now,
+ * for timestamping operator commands.
+ *
+ * JACK is set up by the main program, which has its MIDI ports and latency
+ * callbacks to go with it.  This file has the backends for running without
+ * a server:
+ *
+ *  - ALSA: capture and playback on a PCM device.  The cycle runs in a
+ *    SCHED_FIFO thread on the device buffers themselves, reached through
+ *    snd_pcm_mmap_begin(), with the playback buffer two periods long.  Only
+ *    built when ALSA is found (HAVE_ALSA).
+ *  - file: a WAV file played in as if it were live, paced in real time; the
+ *    output goes nowhere.  Input is silent after the end of the file, and
+ *    throughout with no file (the null backend).
+ *
+ * Times of the backends here are on CLOCK_MONOTONIC.
+ */
+
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+#include <stdint.h>
+
+#define AUDIO_BACKEND_PERIOD 256 // frames per cycle asked for
+#define AUDIO_BACKEND_RATE 48000 // sample rate asked for, and the null backend's
+
+typedef void (*audio_cycle_t) (const float *in, float *out, uint32_t nframes, uint32_t startFrame, void *arg);
+
+typedef struct audio_backend audio_backend_t;
+
+struct audio_backend {
+	const char *name;
+	uint32_t sampleRate;
+	uint32_t periodFrames;
+	uint32_t captureLatency, playbackLatency; // frames, from the converters to the cycle and back
+
+	// start calling cycle; returns 0, or -1 with a message on stderr
+	int (*start) (audio_backend_t *ab, audio_cycle_t cycle, void *arg);
+	void (*stop) (audio_backend_t *ab);
+
+	uint32_t (*frame_time) (audio_backend_t *ab); // the frame being played now, estimated
+	uint64_t (*frames_to_time) (audio_backend_t *ab, uint32_t frame); // microseconds
+	uint64_t (*get_time) (audio_backend_t *ab); // microseconds now
+
+	void *state;
+};
+
+// path NULL for silence; returns 0, or -1 with a message on stderr
+int audio_backend_file_open (audio_backend_t *ab, const char *path);
+
+#ifdef HAVE_ALSA
+// device such as "hw:0"; returns 0, or -1 with a message on stderr
+int audio_backend_alsa_open (audio_backend_t *ab, const char *device);
+#endif
+
+void audio_backend_close (audio_backend_t *ab);
+
+#endif
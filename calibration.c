@@ -0,0 +1,240 @@
+/** @file calibration.c
+ *
+ * @brief Startup calibration: record a few seconds of input, then pick the
+ * detection thresholds and low minimum time from the click statistics.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "calibration.h"
+#include "adaptive-threshold.h"
+
+#define MIN_LEVEL_DB -120.0f
+#define HISTOGRAM_BIN_DB 0.5f
+#define HISTOGRAM_BINS ((int) (-MIN_LEVEL_DB / HISTOGRAM_BIN_DB) + 1)
+#define MIN_CLICKS 3
+#define CLICK_END_WINDOWS 5 // quiet windows (ms) that end a click
+
+int calibration_init (calibration_t *cal, jack_nframes_t sampleRate, float seconds)
+{
+	memset(cal, 0, sizeof(*cal));
+
+	cal->sampleRate = sampleRate;
+	cal->length = sampleRate * seconds;
+	cal->buffer = malloc(cal->length * sizeof(float));
+	atomic_init(&cal->state, CALIBRATION_IDLE);
+
+	return cal->buffer == NULL ? -1 : 0;
+}
+
+void calibration_free (calibration_t *cal)
+{
+	free(cal->buffer);
+	cal->buffer = NULL;
+}
+
+void calibration_start (calibration_t *cal)
+{
+	int state = atomic_load(&cal->state);
+
+	if (state == CALIBRATION_RECORDING || state == CALIBRATION_RECORDED || state == CALIBRATION_ANALYZING
+			|| state == CALIBRATION_DONE)
+		return;
+
+	cal->filled = 0;
+	atomic_store(&cal->state, CALIBRATION_RECORDING);
+}
+
+void calibration_record (calibration_t *cal, const float *in, jack_nframes_t nframes)
+{
+	if (atomic_load(&cal->state) != CALIBRATION_RECORDING)
+		return;
+
+	jack_nframes_t n = cal->length - cal->filled;
+	if (n > nframes)
+		n = nframes;
+
+	memcpy(cal->buffer + cal->filled, in, n * sizeof(float));
+	cal->filled += n;
+
+	if (cal->filled == cal->length)
+		atomic_store(&cal->state, CALIBRATION_RECORDED);
+}
+
+static float level_dB (float linear)
+{
+	float dB = 20.0f * log10f(linear);
+	return dB > MIN_LEVEL_DB ? dB : MIN_LEVEL_DB;
+}
+
+static int histogramBin (float dB)
+{
+	int bin = (dB - MIN_LEVEL_DB) / HISTOGRAM_BIN_DB;
+	return bin < 0 ? 0 : bin >= HISTOGRAM_BINS ? HISTOGRAM_BINS - 1 : bin;
+}
+
+// level below which the given fraction of the histogram lies
+static float histogramQuantile (const int *histogram, int total, float fraction)
+{
+	int bin, count = 0;
+
+	for (bin = 0; bin < HISTOGRAM_BINS; bin++) {
+		count += histogram[bin];
+		if (count > fraction * total)
+			break;
+	}
+
+	return MIN_LEVEL_DB + (bin + 0.5f) * HISTOGRAM_BIN_DB;
+}
+
+static int compareFloats (const void *a, const void *b)
+{
+	float x = *(const float *) a, y = *(const float *) b;
+	return (x > y) - (x < y);
+}
+
+static float median (float *values, int n)
+{
+	qsort(values, n, sizeof(float), compareFloats);
+	return n % 2 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+}
+
+/* Work on 1 ms window peaks.  A first histogram over all windows gives a
+ * provisional split between noise and clicks; clicks are then segmented,
+ * and the noise floor is taken again from the windows outside of them.
+ */
+static bool analyze (calibration_t *cal)
+{
+	int windowFrames = cal->sampleRate / 1000;
+	int nWindows = cal->length / windowFrames;
+	int w, total = 0;
+	bool ok = false;
+
+	float *peaks = malloc(nWindows * sizeof(float));
+	bool *inClick = calloc(nWindows, sizeof(bool));
+	int *histogram = calloc(HISTOGRAM_BINS, sizeof(int));
+	float *clickPeaks = malloc(nWindows * sizeof(float));
+	float *clickLengths = malloc(nWindows * sizeof(float));
+	float *intervals = malloc(nWindows * sizeof(float));
+
+	if (!peaks || !inClick || !histogram || !clickPeaks || !clickLengths || !intervals)
+		goto done;
+
+	float maxLevel = MIN_LEVEL_DB;
+	for (w = 0; w < nWindows; w++) {
+		float peak = 0.0f;
+		for (int i = 0; i < windowFrames; i++) {
+			float x = fabsf(cal->buffer[w * windowFrames + i]);
+			if (x > peak)
+				peak = x;
+		}
+		peaks[w] = level_dB(peak);
+		histogram[histogramBin(peaks[w])]++;
+		if (peaks[w] > maxLevel)
+			maxLevel = peaks[w];
+	}
+
+	float typical = histogramQuantile(histogram, nWindows, 0.5f);
+	if (maxLevel - typical < 12.0f)
+		goto done;
+
+	float clickStart = typical + 0.5f * (maxLevel - typical);
+	float clickEnd = typical + 0.25f * (maxLevel - typical);
+	if (clickEnd < typical + 6.0f)
+		clickEnd = typical + 6.0f;
+
+	int nClicks = 0, lastStart = -1;
+	for (w = 0; w < nWindows; w++) {
+		if (peaks[w] <= clickStart)
+			continue;
+
+		// the click lasts until CLICK_END_WINDOWS quiet windows in a row
+		int end = w, quiet = 0;
+		float clickPeak = peaks[w];
+		while (end < nWindows && quiet < CLICK_END_WINDOWS) {
+			quiet = peaks[end] < clickEnd ? quiet + 1 : 0;
+			if (peaks[end] > clickPeak)
+				clickPeak = peaks[end];
+			inClick[end++] = true;
+		}
+
+		clickPeaks[nClicks] = clickPeak;
+		clickLengths[nClicks] = end - w - quiet;
+		if (lastStart >= 0)
+			intervals[nClicks - 1] = w - lastStart;
+		lastStart = w;
+		nClicks++;
+
+		// carry on from the first window after the click, which the loop increment lands on
+		w = end - 1;
+	}
+
+	if (nClicks < MIN_CLICKS)
+		goto done;
+
+	memset(histogram, 0, HISTOGRAM_BINS * sizeof(int));
+	for (w = 0; w < nWindows; w++) {
+		if (!inClick[w]) {
+			histogram[histogramBin(peaks[w])]++;
+			total++;
+		}
+	}
+
+	// same placement rule as adaptive mode, so switching over later is seamless
+	adaptive_threshold_t rule;
+	adaptive_threshold_init(&rule, -30.0f, -50.0f);
+	adaptive_threshold_set_levels(&rule, histogramQuantile(histogram, total, rule.noiseFloor_dB.p),
+			median(clickPeaks, nClicks));
+
+	float lowMinTime_ms = 1.5f * median(clickLengths, nClicks);
+	float maxLowMinTime_ms = 0.5f * median(intervals, nClicks - 1);
+	if (lowMinTime_ms > maxLowMinTime_ms)
+		lowMinTime_ms = maxLowMinTime_ms;
+	if (lowMinTime_ms < 5.0f)
+		lowMinTime_ms = 5.0f;
+
+	cal->nClicks = nClicks;
+	cal->noiseFloor_dB = rule.noiseFloor_dB.value;
+	cal->clickPeak_dB = rule.clickPeak_dB.value;
+	cal->risingThreshold_dB = rule.risingThreshold_dB;
+	cal->fallingThreshold_dB = rule.fallingThreshold_dB;
+	cal->lowMinTime_ms = lowMinTime_ms;
+	ok = true;
+
+done:
+	free(peaks);
+	free(inClick);
+	free(histogram);
+	free(clickPeaks);
+	free(clickLengths);
+	free(intervals);
+	return ok;
+}
+
+static void *calibrationThread (void *arg)
+{
+	calibration_t *cal = arg;
+
+	atomic_store(&cal->state, analyze(cal) ? CALIBRATION_DONE : CALIBRATION_FAILED);
+	return NULL;
+}
+
+void calibration_poll (calibration_t *cal, bool inPlace)
+{
+	pthread_t thread;
+
+	if (atomic_load(&cal->state) != CALIBRATION_RECORDED)
+		return;
+
+	atomic_store(&cal->state, CALIBRATION_ANALYZING);
+
+	if (inPlace)
+		calibrationThread(cal);
+	else if (pthread_create(&thread, NULL, calibrationThread, cal))
+		atomic_store(&cal->state, CALIBRATION_FAILED);
+	else
+		pthread_detach(thread);
+}
@@ -0,0 +1,61 @@
+/** @file calibration.h
+ *
+ * @brief Startup calibration: record a few seconds of input, then pick the
+ * detection thresholds and low minimum time from the click statistics.
+ *
+ * The analysis thread copies input into a buffer allocated up front by
+ * calibration_init().  Once it is full, it hands the recording to a worker
+ * thread (calibration_poll()), which builds an amplitude histogram and fills
+ * in the results, and applies them when they are in, marking the pass
+ * CALIBRATION_APPLIED.  While JACK freewheels, the analysis thread works
+ * through the recording itself, so the results come at the same point of
+ * the input every run.
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <jack/jack.h>
+
+enum {
+	CALIBRATION_IDLE,
+	CALIBRATION_RECORDING, // analysis thread filling the buffer
+	CALIBRATION_RECORDED, // buffer full, waiting for a worker
+	CALIBRATION_ANALYZING, // worker running
+	CALIBRATION_DONE, // results ready to apply
+	CALIBRATION_APPLIED,
+	CALIBRATION_FAILED // no usable clicks in the recording
+};
+
+typedef struct {
+	float *buffer;
+	jack_nframes_t length;
+	jack_nframes_t filled;
+	jack_nframes_t sampleRate;
+	atomic_int state;
+
+	// results
+	int nClicks;
+	float noiseFloor_dB;
+	float clickPeak_dB;
+	float risingThreshold_dB;
+	float fallingThreshold_dB;
+	float lowMinTime_ms;
+} calibration_t;
+
+int calibration_init (calibration_t *cal, jack_nframes_t sampleRate, float seconds);
+void calibration_free (calibration_t *cal);
+
+// analysis thread (or before it starts): begin recording; ignored while a
+// pass is in progress or its results are still to be applied
+void calibration_start (calibration_t *cal);
+
+// analysis thread: append input while recording
+void calibration_record (calibration_t *cal, const float *in, jack_nframes_t nframes);
+
+// analysis thread: once the recording is complete, analyze it on a worker thread, or right away if inPlace
+void calibration_poll (calibration_t *cal, bool inPlace);
+
+#endif
@@ -0,0 +1,76 @@
+/** @file click-synth.c
+ *
+ * @brief Metronome clicks played from precomputed wavetables.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "click-synth.h"
+#include "frames.h"
+
+#define DECAY_MS 4.0f // time constant of the click's decay
+
+int click_synth_init (click_synth_t *cs, float sampleRate)
+{
+	static const float pitch[2] = { CLICK_SYNTH_HZ, CLICK_SYNTH_ACCENT_HZ };
+
+	cs->length = sampleRate * CLICK_SYNTH_MS / 1000.0f;
+	cs->sounding = -1;
+	cs->level = 0.5f;
+
+	for (int w = 0; w < 2; w++) {
+		cs->wave[w] = malloc((cs->length + 1) * sizeof(float));
+		if (cs->wave[w] == NULL) {
+			click_synth_free(cs);
+			return -1;
+		}
+
+		// decaying sine starting at zero, and a zero past the end to interpolate towards
+		for (jack_nframes_t k = 0; k < cs->length; k++) {
+			float t = k / sampleRate;
+			cs->wave[w][k] = sinf(2.0f * (float) M_PI * pitch[w] * t) * expf(-1000.0f * t / DECAY_MS);
+		}
+		cs->wave[w][cs->length] = 0.0f;
+	}
+
+	return 0;
+}
+
+void click_synth_free (click_synth_t *cs)
+{
+	for (int w = 0; w < 2; w++) {
+		free(cs->wave[w]);
+		cs->wave[w] = NULL;
+	}
+}
+
+void click_synth_trigger (click_synth_t *cs, double frame, bool accent)
+{
+	cs->start = frame;
+	cs->sounding = accent ? 1 : 0;
+}
+
+float click_synth_sample (click_synth_t *cs, jack_nframes_t frame)
+{
+	if (cs->sounding < 0)
+		return 0.0f;
+
+	double t = frame_delta(frame, cs->start);
+
+	// not started yet
+	if (t < 0.0)
+		return 0.0f;
+
+	jack_nframes_t k = t;
+
+	if (k >= cs->length) {
+		cs->sounding = -1;
+		return 0.0f;
+	}
+
+	const float *wave = cs->wave[cs->sounding];
+	float fraction = t - k;
+
+	return cs->level * (wave[k] + fraction * (wave[k + 1] - wave[k]));
+}
@@ -0,0 +1,40 @@
+/** @file click-synth.h
+ *
+ * @brief Metronome clicks played from precomputed wavetables.
+ *
+ * Clicks start at fractional frames: the wavetable is read between samples,
+ * so a click lands exactly where its beat was predicted instead of on the
+ * nearest sample.  One click sounds at a time, which is plenty at any tempo
+ * the tracker follows.  Realtime safe once initialized.
+ */
+
+#ifndef CLICK_SYNTH_H
+#define CLICK_SYNTH_H
+
+#include <stdbool.h>
+#include <jack/jack.h>
+
+#define CLICK_SYNTH_MS 25.0f // length of a click
+#define CLICK_SYNTH_HZ 1000.0f // pitch of a plain beat
+#define CLICK_SYNTH_ACCENT_HZ 1500.0f // pitch of a downbeat
+
+typedef struct {
+	float *wave[2]; // plain beat, downbeat
+	jack_nframes_t length;
+
+	double start; // frame the sounding click started at
+	int sounding; // wave of the sounding click, -1 for none
+
+	float level; // peak amplitude
+} click_synth_t;
+
+int click_synth_init (click_synth_t *cs, float sampleRate);
+void click_synth_free (click_synth_t *cs);
+
+// start a click at a (fractional) frame, cutting off the one sounding
+void click_synth_trigger (click_synth_t *cs, double frame, bool accent);
+
+// output at a frame, 0 between clicks; frames must come in order
+float click_synth_sample (click_synth_t *cs, jack_nframes_t frame);
+
+#endif
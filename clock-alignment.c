@@ -0,0 +1,145 @@
+/** @file clock-alignment.c
+ *
+ * @brief Measures how well a returned MIDI clock lines up with the clicks.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "clock-alignment.h"
+#include "frames.h"
+
+#define TICK_PERIOD_GAIN 0.1 // smoothing of the received tick interval
+
+void clock_alignment_init (clock_alignment_t *ca, float sampleRate, FILE *log)
+{
+	ca->sampleRate = sampleRate;
+	ca->log = log;
+	clock_alignment_reset(ca);
+
+	if (log != NULL) {
+		fprintf(log, "# beat_s offset_ms phase_ms jitter_ms drift_ms_per_min\n");
+		fflush(log);
+	}
+}
+
+void clock_alignment_reset (clock_alignment_t *ca)
+{
+	ca->nTicks = 0;
+	ca->newestTick = 0;
+	ca->tickPeriod = 0.0;
+	ca->nOnsets = 0;
+	ca->nOffsets = 0;
+	ca->nextOffset = 0;
+	ca->nMatched = 0;
+	ca->phase_ms = 0.0f;
+	ca->jitter_ms = 0.0f;
+	ca->drift_ms_per_min = 0.0f;
+}
+
+bool clock_alignment_receiving (const clock_alignment_t *ca, double now)
+{
+	return ca->nTicks > 0 && frame_delta(now, ca->tick[ca->newestTick]) < ALIGNMENT_TIMEOUT_S * ca->sampleRate;
+}
+
+// mean, standard deviation and slope of the offsets in the window
+static void updateStatistics (clock_alignment_t *ca)
+{
+	int n = ca->nOffsets;
+	double reference = ca->beatFrame[(ca->nextOffset + ALIGNMENT_WINDOW - 1) % ALIGNMENT_WINDOW];
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, syy = 0.0;
+
+	for (int k = 0; k < n; k++) {
+		double x = frame_delta(ca->beatFrame[k], reference);
+		double y = ca->offset[k];
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		syy += y * y;
+	}
+
+	double mean = sy / n;
+	double variance = syy / n - mean * mean;
+	double spread = sxx - sx * sx / n;
+	double toMs = 1000.0 / ca->sampleRate;
+
+	ca->phase_ms = mean * toMs;
+	ca->jitter_ms = variance > 0.0 ? sqrt(variance) * toMs : 0.0;
+	ca->drift_ms_per_min = spread > 0.0 ? (sxy - sx * sy / n) / spread * 60000.0 : 0.0;
+}
+
+static void matchBeat (clock_alignment_t *ca, double beat)
+{
+	double nearest = 0.0;
+	double distance = INFINITY;
+
+	for (int k = 0; k < ca->nTicks; k++) {
+		if (fabs(frame_delta(ca->tick[k], beat)) < distance) {
+			distance = fabs(frame_delta(ca->tick[k], beat));
+			nearest = ca->tick[k];
+		}
+	}
+
+	// the clock had a gap here
+	if (distance > ca->tickPeriod)
+		return;
+
+	ca->beatFrame[ca->nextOffset] = beat;
+	ca->offset[ca->nextOffset] = frame_delta(nearest, beat);
+	ca->nextOffset = (ca->nextOffset + 1) % ALIGNMENT_WINDOW;
+	if (ca->nOffsets < ALIGNMENT_WINDOW)
+		ca->nOffsets++;
+	ca->nMatched++;
+
+	updateStatistics(ca);
+
+	if (ca->log != NULL) {
+		fprintf(ca->log, "%.6f %+.3f %+.3f %.3f %+.3f\n", beat / ca->sampleRate,
+				1000.0 * frame_delta(nearest, beat) / ca->sampleRate, ca->phase_ms, ca->jitter_ms, ca->drift_ms_per_min);
+		fflush(ca->log);
+	}
+}
+
+// match the beats no later tick can be nearer to
+static void matchReadyBeats (clock_alignment_t *ca)
+{
+	double newest = ca->tick[ca->newestTick];
+
+	while (ca->nOnsets > 0 && ca->tickPeriod > 0.0 && frame_delta(newest, ca->onset[0]) >= 0.5 * ca->tickPeriod) {
+		matchBeat(ca, ca->onset[0]);
+		memmove(ca->onset, ca->onset + 1, --ca->nOnsets * sizeof(double));
+	}
+}
+
+void clock_alignment_tick (clock_alignment_t *ca, double frame)
+{
+	// a clock starting over after silence is measured afresh
+	if (ca->nTicks > 0 && !clock_alignment_receiving(ca, frame))
+		clock_alignment_reset(ca);
+
+	if (ca->nTicks > 0) {
+		double interval = frame_delta(frame, ca->tick[ca->newestTick]);
+		ca->tickPeriod += ca->tickPeriod > 0.0 ? TICK_PERIOD_GAIN * (interval - ca->tickPeriod) : interval;
+	}
+
+	ca->newestTick = (ca->newestTick + 1) % ALIGNMENT_TICKS;
+	ca->tick[ca->newestTick] = frame;
+	if (ca->nTicks < ALIGNMENT_TICKS)
+		ca->nTicks++;
+
+	matchReadyBeats(ca);
+}
+
+void clock_alignment_beat (clock_alignment_t *ca, double frame)
+{
+	if (!clock_alignment_receiving(ca, frame))
+		return;
+
+	if (ca->nOnsets == ALIGNMENT_ONSETS)
+		memmove(ca->onset, ca->onset + 1, --ca->nOnsets * sizeof(double));
+	ca->onset[ca->nOnsets++] = frame;
+
+	// the ticks after it may be in already, onsets are analyzed late
+	matchReadyBeats(ca);
+}
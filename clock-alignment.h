@@ -0,0 +1,62 @@
+/** @file clock-alignment.h
+ *
+ * @brief Measures how well a returned MIDI clock lines up with the clicks.
+ *
+ * Clock coming back from downstream gear (or any external clock) is
+ * timestamped on arrival and compared with the detected beats: each beat
+ * is matched to the nearest received tick once the ticks around it are
+ * in, so the phase is measured to within half a tick.  Over the last
+ * ALIGNMENT_WINDOW beats the mean offset gives the phase, its standard
+ * deviation the jitter, and a line fitted through it the drift.
+ *
+ * Runs in the analysis thread; the optional log gets a line per beat.
+ */
+
+#ifndef CLOCK_ALIGNMENT_H
+#define CLOCK_ALIGNMENT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define ALIGNMENT_TICKS 64 // received ticks kept for matching
+#define ALIGNMENT_ONSETS 8 // beats waiting for the ticks after them
+#define ALIGNMENT_WINDOW 64 // beats the statistics cover
+#define ALIGNMENT_TIMEOUT_S 2.0 // silence after which the clock counts as gone
+
+typedef struct {
+	float sampleRate;
+	FILE *log; // NULL for none
+
+	double tick[ALIGNMENT_TICKS]; // ring, frames of received ticks
+	int nTicks;
+	int newestTick;
+	double tickPeriod; // smoothed interval between received ticks, 0 while unknown
+
+	double onset[ALIGNMENT_ONSETS]; // oldest first
+	int nOnsets;
+
+	double beatFrame[ALIGNMENT_WINDOW]; // ring, matched beats
+	double offset[ALIGNMENT_WINDOW]; // tick minus beat, frames
+	int nOffsets;
+	int nextOffset;
+
+	// results, updated after every matched beat
+	long nMatched;
+	float phase_ms; // positive when the returned clock is late
+	float jitter_ms;
+	float drift_ms_per_min;
+} clock_alignment_t;
+
+void clock_alignment_init (clock_alignment_t *ca, float sampleRate, FILE *log);
+void clock_alignment_reset (clock_alignment_t *ca);
+
+// a tick of the returned clock arrived at frame
+void clock_alignment_tick (clock_alignment_t *ca, double frame);
+
+// a beat was detected at frame
+void clock_alignment_beat (clock_alignment_t *ca, double frame);
+
+// whether a clock is being received
+bool clock_alignment_receiving (const clock_alignment_t *ca, double now);
+
+#endif
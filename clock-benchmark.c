@@ -0,0 +1,307 @@
+/** @file clock-benchmark.c
+ *
+ * @brief End to end latency and jitter of the MIDI clock, measured from
+ * outside the program.
+ *
+ * The clock is measured against a click train of known timing, taken one
+ * of two ways:
+ *
+ *  - live, as JACK clients next to a running metronome-audio-to-midi
+ *    (under jackd -d dummy, say): one plays the clicks into its input,
+ *    another timestamps the ticks it sends.  Two clients rather than one
+ *    keep the graph free of a loop, so both ends are on the same cycle.
+ *  - from the MIDI log of a run under the jack shim (--log), whose click
+ *    train starts at frame 0.
+ *
+ * It reports how long the clock took to start and how it came in during the
+ * warm-up for calibration and locking: the longest gap between ticks and the
+ * bursts, ticks less than half a tick apart.  After the warm-up, it reports
+ * the latency from each click onset to the nearest tick (the clock is
+ * predicted, so 0 is on time and negative is early).  The jitter, how far the
+ * intervals between ticks stray from the tempo, is over every tick from the
+ * first, warm-up included, so owed ticks sent in a hurry count.
+ * clock-benchmark.sh runs it across period sizes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#define BENCHMARK_TARGET "metronome-audio-to-midi"
+#define CLICK_HZ 2000.0f
+#define CLICK_DECAY_S 0.004f
+#define MAX_TICKS_PER_S 200 // room for ticks up to 500 BPM
+
+float tempo_bpm = 120.0f;
+float seconds = 60.0f;
+float warmup_s = 5.0f;
+
+// the click train: beat k starts at clickStart + k * beatFrames
+double beatFrames;
+atomic_long clickStart = -1;
+
+double *ticks;
+long maxTicks;
+atomic_long nTicks = 0;
+
+jack_client_t *clickClient, *tickClient;
+jack_port_t *clickPort, *tickPort;
+
+static int playClicks (jack_nframes_t nframes, void *arg)
+{
+	float *out = jack_port_get_buffer(clickPort, nframes);
+	jack_nframes_t start = jack_last_frame_time(clickClient);
+
+	if (atomic_load(&clickStart) < 0)
+		atomic_store(&clickStart, start);
+
+	for (jack_nframes_t i = 0; i < nframes; i++) {
+		double t = fmod((double) (start + i - (jack_nframes_t) atomic_load(&clickStart)), beatFrames) / jack_get_sample_rate(clickClient);
+		out[i] = 0.8f * sinf(2.0f * M_PI * CLICK_HZ * t) * expf(-t / CLICK_DECAY_S);
+	}
+
+	return 0;
+}
+
+static int recordTicks (jack_nframes_t nframes, void *arg)
+{
+	void *in = jack_port_get_buffer(tickPort, nframes);
+	jack_nframes_t start = jack_last_frame_time(tickClient);
+	uint32_t nEvents = jack_midi_get_event_count(in);
+
+	for (uint32_t e = 0; e < nEvents; e++) {
+		jack_midi_event_t event;
+		long n = atomic_load(&nTicks);
+
+		if (jack_midi_event_get(&event, in, e) == 0 && event.size == 1 && event.buffer[0] == 0xF8 && n < maxTicks) {
+			ticks[n] = start + event.time;
+			atomic_store(&nTicks, n + 1);
+		}
+	}
+
+	return 0;
+}
+
+static jack_client_t *openClient (const char *name)
+{
+	jack_status_t status;
+	jack_client_t *client = jack_client_open(name, JackNoStartServer, &status);
+
+	if (client == NULL) {
+		fprintf(stderr, "cannot connect to the JACK server (status 0x%x)\n", status);
+		exit (1);
+	}
+
+	return client;
+}
+
+static void measureLive (float *sampleRate)
+{
+	clickClient = openClient("clock-benchmark-clicks");
+	tickClient = openClient("clock-benchmark-ticks");
+
+	*sampleRate = jack_get_sample_rate(clickClient);
+	beatFrames = 60.0 * *sampleRate / tempo_bpm;
+
+	clickPort = jack_port_register(clickClient, "clicks", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	tickPort = jack_port_register(tickClient, "clock", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+
+	if (clickPort == NULL || tickPort == NULL) {
+		fprintf(stderr, "no more JACK ports available\n");
+		exit (1);
+	}
+
+	jack_set_process_callback(clickClient, playClicks, NULL);
+	jack_set_process_callback(tickClient, recordTicks, NULL);
+
+	if (jack_activate(clickClient) || jack_activate(tickClient)) {
+		fprintf(stderr, "cannot activate the benchmark clients\n");
+		exit (1);
+	}
+
+	if (jack_connect(clickClient, jack_port_name(clickPort), BENCHMARK_TARGET ":Metronome Audio input")
+			|| jack_connect(tickClient, BENCHMARK_TARGET ":MIDI Clock output", jack_port_name(tickPort))) {
+		fprintf(stderr, "cannot connect to " BENCHMARK_TARGET ", is it running?\n");
+		exit (1);
+	}
+
+	usleep(seconds * 1e6);
+
+	jack_client_close(tickClient);
+	jack_client_close(clickClient);
+}
+
+// ticks from a jack shim MIDI log, a line per event: cycle start, offset, bytes in hex
+static void readLog (const char *path, float sampleRate)
+{
+	FILE *file = fopen(path, "r");
+	char line[128];
+	unsigned long start, offset;
+	unsigned int status;
+
+	if (file == NULL) {
+		perror(path);
+		exit (1);
+	}
+
+	beatFrames = 60.0 * sampleRate / tempo_bpm;
+	atomic_store(&clickStart, 0);
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%lu %lu %x", &start, &offset, &status) != 3 || status != 0xF8)
+			continue;
+
+		// a log is as long as it is
+		if (nTicks == maxTicks) {
+			maxTicks *= 2;
+			ticks = realloc(ticks, maxTicks * sizeof(double));
+			if (ticks == NULL) {
+				fprintf(stderr, "cannot allocate the tick buffer\n");
+				exit (1);
+			}
+		}
+
+		ticks[nTicks++] = start + offset;
+	}
+
+	fclose(file);
+}
+
+static int compareMagnitude (const void *a, const void *b)
+{
+	double x = fabs(*(const double *) a), y = fabs(*(const double *) b);
+	return (x > y) - (x < y);
+}
+
+// mean, then median, 99th percentile and maximum of the magnitudes, in ms
+static void printStatistics (const char *what, double *values, long n, float sampleRate)
+{
+	double sum = 0.0, scale = 1000.0 / sampleRate;
+
+	if (n == 0) {
+		printf("%s: none", what);
+		return;
+	}
+
+	for (long k = 0; k < n; k++)
+		sum += values[k];
+
+	qsort(values, n, sizeof(double), compareMagnitude);
+	printf("%s: mean %+.3f ms, |median| %.3f, |p99| %.3f, |max| %.3f", what, scale * sum / n,
+			scale * fabs(values[n / 2]), scale * fabs(values[(long) (0.99 * (n - 1))]), scale * fabs(values[n - 1]));
+}
+
+static void report (float sampleRate)
+{
+	long n = atomic_load(&nTicks);
+	double tickFrames = beatFrames / 24.0;
+	double warmupEnd = atomic_load(&clickStart) + warmup_s * sampleRate;
+	double *latencies = malloc((n + 1) * sizeof(double)), *deviations = malloc((n + 1) * sizeof(double));
+	long nLatencies = 0, nDeviations = 0, missed = 0;
+
+	if (latencies == NULL || deviations == NULL) {
+		fprintf(stderr, "cannot allocate the statistics\n");
+		exit (1);
+	}
+
+	// each onset against the nearest tick; none within half a tick is a miss
+	long t = 0;
+	for (long k = ceil((warmupEnd - atomic_load(&clickStart)) / beatFrames); n > 0; k++) {
+		double onset = atomic_load(&clickStart) + k * beatFrames;
+
+		if (onset > ticks[n - 1])
+			break;
+		while (t + 1 < n && fabs(ticks[t + 1] - onset) <= fabs(ticks[t] - onset))
+			t++;
+
+		if (fabs(ticks[t] - onset) < tickFrames / 2)
+			latencies[nLatencies++] = ticks[t] - onset;
+		else
+			missed++;
+	}
+
+	long bursts = 0, warmupBursts = 0;
+	double longestGap = 0.0;
+
+	for (long k = 1; k < n; k++) {
+		double interval = ticks[k] - ticks[k - 1];
+
+		deviations[nDeviations++] = interval - tickFrames;
+		if (interval < tickFrames / 2) {
+			bursts++;
+			if (ticks[k] < warmupEnd)
+				warmupBursts++;
+		}
+		if (ticks[k] < warmupEnd && interval > longestGap)
+			longestGap = interval;
+	}
+
+	if (n == 0)
+		printf("no ticks; ");
+	else {
+		printf("first tick %.3f s", (ticks[0] - atomic_load(&clickStart)) / sampleRate);
+		if (ticks[0] < warmupEnd)
+			printf(", warm-up gap |max| %.3f ms, %ld bursts; ", 1000.0 * longestGap / sampleRate, warmupBursts);
+		else
+			printf(" (after the warm-up); ");
+	}
+
+	printStatistics("latency", latencies, nLatencies, sampleRate);
+	printf(" (%ld beats, %ld missed); ", nLatencies, missed);
+	printStatistics("jitter", deviations, nDeviations, sampleRate);
+	printf(" (%ld ticks, %ld bursts)\n", n, bursts);
+
+	free(latencies);
+	free(deviations);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *logPath = NULL;
+	float sampleRate = 48000.0f;
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--tempo") == 0 && a + 1 < argc)
+			tempo_bpm = atof(argv[++a]);
+		else if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc)
+			seconds = atof(argv[++a]);
+		else if (strcmp(argv[a], "--warmup") == 0 && a + 1 < argc)
+			warmup_s = atof(argv[++a]);
+		else if (strcmp(argv[a], "--log") == 0 && a + 1 < argc)
+			logPath = argv[++a];
+		else if (strcmp(argv[a], "--rate") == 0 && a + 1 < argc)
+			sampleRate = atof(argv[++a]);
+		else {
+			fprintf(stderr, "usage: %s [--tempo bpm] [--seconds s] [--warmup s] [--log shim-midi.txt [--rate hz]]\n", argv[0]);
+			exit (1);
+		}
+	}
+
+	if (tempo_bpm <= 0.0f || seconds <= 0.0f) {
+		fprintf(stderr, "tempo and duration must be positive\n");
+		exit (1);
+	}
+
+	maxTicks = seconds * MAX_TICKS_PER_S;
+	ticks = malloc(maxTicks * sizeof(double));
+
+	if (ticks == NULL) {
+		fprintf(stderr, "cannot allocate the tick buffer\n");
+		exit (1);
+	}
+
+	if (logPath != NULL)
+		readLog(logPath, sampleRate);
+	else
+		measureLive(&sampleRate);
+
+	report(sampleRate);
+	free(ticks);
+	return 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# End to end latency and jitter of the MIDI clock across period sizes.
+#
+#   clock-benchmark.sh build-dir [shim|dummy]
+#
+# shim: runs under the jack shim of the build (configured with
+#   -DBUILD_JACK_SHIM=ON), at ten times real time.
+# dummy: starts jackd -d dummy for each period size; jackd must be
+#   installed and no other server running.
+#
+# The program's UI needs a terminal, which script(1) provides.
+
+set -e
+
+build=$(cd "$1" && pwd)
+server=${2:-dummy}
+rate=48000
+tempo=120
+seconds=60
+periods="64 128 256 512 1024"
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+for period in $periods; do
+	if [ "$server" = shim ]; then
+		printf 'rate %s\nperiod %s\nspeed 10\nclicks %s\nrun %s\n' $rate $period $tempo $seconds > "$work/script"
+		LD_LIBRARY_PATH="$build/jack-shim" JACK_SHIM_SCRIPT="$work/script" JACK_SHIM_MIDI_LOG="$work/midi" \
+			script -qc "$build/metronome-audio-to-midi" /dev/null > /dev/null
+		result=$("$build/clock-benchmark" --log "$work/midi" --rate $rate --tempo $tempo)
+	else
+		jackd -d dummy -r $rate -p $period > /dev/null 2>&1 &
+		jackd=$!
+		sleep 2
+		script -qc "$build/metronome-audio-to-midi" /dev/null > /dev/null &
+		metronome=$!
+		sleep 1
+		result=$("$build/clock-benchmark" --tempo $tempo --seconds $seconds)
+		kill $metronome $jackd
+		wait
+	fi
+
+	echo "period $period: $result"
+done
@@ -0,0 +1,98 @@
+/** @file clock-follower.c
+ *
+ * @brief Follows an incoming MIDI clock, for playing clicks from it.
+ */
+
+#include <math.h>
+
+#include "clock-follower.h"
+#include "frames.h"
+
+void clock_follower_init (clock_follower_t *cf, float sampleRate)
+{
+	cf->sampleRate = sampleRate;
+	cf->tick = 0;
+	cf->running = true;
+	clock_follower_reset(cf);
+}
+
+void clock_follower_reset (clock_follower_t *cf)
+{
+	cf->nTicks = 0;
+	cf->nextTickTime = 0.0;
+	cf->period = 0.0;
+	cf->lastArrival = 0.0;
+}
+
+void clock_follower_tick (clock_follower_t *cf, double frame)
+{
+	// a clock starting over after silence is followed afresh
+	if (cf->nTicks > 0 && frame_delta(frame, cf->lastArrival) > CLOCK_FOLLOWER_TIMEOUT_S * cf->sampleRate)
+		clock_follower_reset(cf);
+
+	if (cf->nTicks < 2) {
+		// the first interval seeds the period, the loop takes it from there
+		if (cf->nTicks == 1) {
+			cf->period = frame_delta(frame, cf->lastArrival);
+			cf->nextTickTime = frame + cf->period;
+		}
+		cf->lastArrival = frame;
+		cf->nTicks++;
+		cf->tick++;
+		return;
+	}
+
+	double late = frame_delta(frame, cf->nextTickTime);
+	double error = late;
+
+	// a stray or missing tick shouldn't throw the loop far, what jitter there is stays below half a tick
+	if (error > 0.5 * cf->period)
+		error = 0.5 * cf->period;
+	if (error < -0.5 * cf->period)
+		error = -0.5 * cf->period;
+
+	// loop coefficients for the bandwidth at the current tick rate
+	double omega = 2.0 * M_PI * CLOCK_FOLLOWER_BANDWIDTH_HZ * cf->period / cf->sampleRate;
+
+	// from the arrival rather than the last prediction, so the prediction stays on the timeline of the ticks
+	cf->nextTickTime = frame - late + sqrt(2.0) * omega * error + cf->period;
+	cf->period += omega * omega * error;
+	cf->lastArrival = frame;
+	cf->tick++;
+}
+
+void clock_follower_start (clock_follower_t *cf)
+{
+	cf->tick = 0;
+	cf->running = true;
+}
+
+void clock_follower_continue (clock_follower_t *cf)
+{
+	cf->running = true;
+}
+
+void clock_follower_stop (clock_follower_t *cf)
+{
+	cf->running = false;
+}
+
+void clock_follower_song_position (clock_follower_t *cf, int sixteenths)
+{
+	cf->tick = 6L * sixteenths;
+}
+
+bool clock_follower_locked (const clock_follower_t *cf, double now)
+{
+	return cf->nTicks >= 2 && frame_delta(now, cf->lastArrival) < CLOCK_FOLLOWER_TIMEOUT_S * cf->sampleRate;
+}
+
+double clock_follower_tick_time (const clock_follower_t *cf, long tick)
+{
+	return cf->nextTickTime + (tick - cf->tick) * cf->period;
+}
+
+double clock_follower_bpm (const clock_follower_t *cf)
+{
+	return cf->nTicks >= 2 ? 60.0 * cf->sampleRate / (24.0 * cf->period) : 0.0;
+}
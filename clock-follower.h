@@ -0,0 +1,62 @@
+/** @file clock-follower.h
+ *
+ * @brief Follows an incoming MIDI clock, for playing clicks from it.
+ *
+ * Ticks arrive with the jitter of the sender and the MIDI transport, so
+ * clicks placed on them directly would wobble.  A second order delay locked
+ * loop (as described by Fons Adriaensen for filtering audio period times)
+ * smooths the arrival times instead: it predicts when the next tick is
+ * due, and corrects that prediction and the tick period by a fraction of
+ * the error when the tick comes in.  Clicks go on the predicted ticks, to a
+ * fraction of a frame.
+ *
+ * Ticks are numbered from the last Start (or song position pointer), tick
+ * 24 b being beat b.  Realtime safe.
+ */
+
+#ifndef CLOCK_FOLLOWER_H
+#define CLOCK_FOLLOWER_H
+
+#include <stdbool.h>
+
+#define CLOCK_FOLLOWER_BANDWIDTH_HZ 1.0 // of the loop; higher follows tempo changes faster but passes more jitter
+#define CLOCK_FOLLOWER_TIMEOUT_S 0.5 // silence after which the clock counts as stopped
+
+typedef struct {
+	float sampleRate;
+
+	int nTicks; // received since the loop (re)started, counts up to 2
+	long tick; // number of the next tick due
+	double nextTickTime; // frame the next tick is predicted at
+	double period; // smoothed frames per tick
+	double lastArrival; // frame the latest tick arrived at
+
+	bool running; // transport: cleared by Stop, set by Start and Continue
+} clock_follower_t;
+
+void clock_follower_init (clock_follower_t *cf, float sampleRate);
+
+// forget the clock, the next ticks start the loop again
+void clock_follower_reset (clock_follower_t *cf);
+
+// a tick arrived at frame
+void clock_follower_tick (clock_follower_t *cf, double frame);
+
+// transport messages: Start numbers the next tick 0, Continue and Stop keep the count
+void clock_follower_start (clock_follower_t *cf);
+void clock_follower_continue (clock_follower_t *cf);
+void clock_follower_stop (clock_follower_t *cf);
+
+// song position pointer, in sixteenths: the next tick is at that position
+void clock_follower_song_position (clock_follower_t *cf, int sixteenths);
+
+// whether the tick times can be trusted at frame now
+bool clock_follower_locked (const clock_follower_t *cf, double now);
+
+// predicted frame of a tick
+double clock_follower_tick_time (const clock_follower_t *cf, long tick);
+
+// tempo of the followed clock, 0 while not locked
+double clock_follower_bpm (const clock_follower_t *cf);
+
+#endif
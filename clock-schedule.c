@@ -0,0 +1,53 @@
+/** @file clock-schedule.c
+ *
+ * @brief Predicted MIDI clock ticks, handed from the analysis thread to
+ * process().
+ */
+
+#include <string.h>
+
+#include "clock-schedule.h"
+
+void schedule_buffer_init (schedule_buffer_t *sb)
+{
+	memset(sb->slot, 0, sizeof(sb->slot));
+	atomic_store(&sb->pending, 0);
+	sb->front = 0;
+	sb->back = 0; // the first publish moves to slot 1
+}
+
+void schedule_publish (schedule_buffer_t *sb, const clock_schedule_t *schedule)
+{
+	int expected = 1;
+
+	// if the last schedule is still pending take it back and reuse its slot,
+	// otherwise process() has swapped it to the front and the other slot is free
+	if (!atomic_compare_exchange_strong(&sb->pending, &expected, 0))
+		sb->back ^= 1;
+
+	sb->slot[sb->back] = *schedule;
+	atomic_store(&sb->pending, 1);
+}
+
+const clock_schedule_t *schedule_acquire (schedule_buffer_t *sb)
+{
+	if (atomic_exchange(&sb->pending, 0))
+		sb->front ^= 1;
+
+	return &sb->slot[sb->front];
+}
+
+double clock_schedule_tick_time (const clock_schedule_t *schedule, long tick)
+{
+	return schedule->anchorFrame + tempo_ramp_offset(&schedule->ramp,
+			(double) (tick - schedule->anchorTick) / schedule->ticksPerStep);
+}
+
+int clock_schedule_bar_position (const clock_schedule_t *schedule, long beatNumber)
+{
+	if (schedule->beatsPerBar == 0)
+		return -1;
+
+	long position = (beatNumber - schedule->downbeat) % schedule->beatsPerBar;
+	return position < 0 ? position + schedule->beatsPerBar : position;
+}
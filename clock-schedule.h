@@ -0,0 +1,65 @@
+/** @file clock-schedule.h
+ *
+ * @brief Predicted MIDI clock ticks, handed from the analysis thread to
+ * process().
+ *
+ * The analysis thread describes the clock as a tick schedule: the latest
+ * onset, the tick it fell on, and the tempo curve the tracker predicts from
+ * there, plus the meter for transport messages.  Ticks are numbered from the
+ * start of tracking, tick 24 b landing on beat b, so process() only has to
+ * count the ticks it sends and evaluate the curve for the next one.
+ *
+ * Schedules go through a double buffer that neither side waits on.  The
+ * analysis thread fills the back slot and flags it; process() swaps slots
+ * when it finds the flag set at the start of a cycle, and reads the front
+ * slot until the next cycle.  A schedule published before the previous one
+ * was picked up is retracted and overwritten in place.
+ */
+
+#ifndef CLOCK_SCHEDULE_H
+#define CLOCK_SCHEDULE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "tempo-tracker.h"
+
+typedef struct {
+	long epoch; // changes whenever beat tracking starts over
+	bool valid; // false until the tempo is known
+	bool emit; // enough beats seen to send the clock to slaves
+	long firstTick; // tick to send first in a new epoch
+
+	double anchorFrame; // frame of the latest onset
+	long anchorTick; // tick that onset fell on
+	int ticksPerStep; // ticks between onsets
+	tempo_ramp_t ramp; // onsets after the anchor as a function of frames
+
+	int beatsPerBar; // 0 while the meter is unknown
+	long downbeat; // beat number of a downbeat
+	long realignRequests; // incremented whenever the downbeat moves
+} clock_schedule_t;
+
+typedef struct {
+	clock_schedule_t slot[2];
+	atomic_int pending; // the back slot holds a schedule not picked up yet
+	int front; // slot read by process()
+	int back; // slot written by the analysis thread
+} schedule_buffer_t;
+
+void schedule_buffer_init (schedule_buffer_t *sb);
+
+// analysis thread: make a schedule current, process() picks it up next cycle
+void schedule_publish (schedule_buffer_t *sb, const clock_schedule_t *schedule);
+
+// realtime thread: the current schedule, valid until the next call
+const clock_schedule_t *schedule_acquire (schedule_buffer_t *sb);
+
+// frame a tick is due at, counted on from the anchor: it may lie past the
+// wrap of the 32-bit frame count, so compare it with frame_delta()
+double clock_schedule_tick_time (const clock_schedule_t *schedule, long tick);
+
+// position of a beat within the bar, -1 while the meter is unknown
+int clock_schedule_bar_position (const clock_schedule_t *schedule, long beatNumber);
+
+#endif
@@ -0,0 +1,105 @@
+/** @file fft.c
+ *
+ * @brief Small in-place radix-2 complex FFT used by the analysis code.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+int fft_init (fft_t *fft, int size)
+{
+	int i, bits = 0;
+
+	if (size < 2 || (size & (size - 1)) != 0)
+		return -1;
+
+	while ((1 << bits) < size)
+		bits++;
+
+	fft->size = size;
+	fft->bitReverse = malloc(size * sizeof(int));
+	fft->cosTable = malloc(size / 2 * sizeof(float));
+	fft->sinTable = malloc(size / 2 * sizeof(float));
+
+	if (fft->bitReverse == NULL || fft->cosTable == NULL || fft->sinTable == NULL) {
+		fft_free(fft);
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) {
+		int b, reversed = 0;
+		for (b = 0; b < bits; b++)
+			if (i & (1 << b))
+				reversed |= 1 << (bits - 1 - b);
+		fft->bitReverse[i] = reversed;
+	}
+
+	for (i = 0; i < size / 2; i++) {
+		fft->cosTable[i] = cos(2.0 * M_PI * i / size);
+		fft->sinTable[i] = -sin(2.0 * M_PI * i / size);
+	}
+
+	return 0;
+}
+
+void fft_free (fft_t *fft)
+{
+	free(fft->bitReverse);
+	free(fft->cosTable);
+	free(fft->sinTable);
+	fft->bitReverse = NULL;
+	fft->cosTable = NULL;
+	fft->sinTable = NULL;
+	fft->size = 0;
+}
+
+static void transform (const fft_t *fft, float *re, float *im, float direction)
+{
+	int n = fft->size;
+	int i, half, step, k;
+
+	for (i = 0; i < n; i++) {
+		int j = fft->bitReverse[i];
+		if (j > i) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (half = 1, step = n / 2; half < n; half *= 2, step /= 2) {
+		for (i = 0; i < n; i += 2 * half) {
+			for (k = 0; k < half; k++) {
+				float wr = fft->cosTable[k * step];
+				float wi = direction * fft->sinTable[k * step];
+				int a = i + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+void fft_forward (const fft_t *fft, float *re, float *im)
+{
+	transform(fft, re, im, 1.0f);
+}
+
+void fft_inverse (const fft_t *fft, float *re, float *im)
+{
+	int i;
+	float scale = 1.0f / fft->size;
+
+	transform(fft, re, im, -1.0f);
+
+	for (i = 0; i < fft->size; i++) {
+		re[i] *= scale;
+		im[i] *= scale;
+	}
+}
@@ -0,0 +1,27 @@
+/** @file fft.h
+ *
+ * @brief Small in-place radix-2 complex FFT used by the analysis code.
+ *
+ * Tables are allocated by fft_init(), so call it outside of the realtime
+ * thread.  fft_forward() and fft_inverse() do not allocate and are safe to
+ * call from process().
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+typedef struct {
+	int size; // number of complex points, must be a power of two
+	int *bitReverse;
+	float *cosTable; // size / 2 twiddle factors
+	float *sinTable;
+} fft_t;
+
+int fft_init (fft_t *fft, int size);
+void fft_free (fft_t *fft);
+
+// transform re/im in place; fft_inverse() includes the 1/size scaling
+void fft_forward (const fft_t *fft, float *re, float *im);
+void fft_inverse (const fft_t *fft, float *re, float *im);
+
+#endif
@@ -0,0 +1,25 @@
+/** @file frames.c
+ *
+ * @brief Times on the JACK frame timeline, whose 32-bit count wraps about
+ * 24.8 hours in at 48 kHz.
+ */
+
+#include <math.h>
+
+#include "frames.h"
+
+double frame_delta (double to, double from)
+{
+	double delta = to - from;
+
+	// an infinite time stays before or after everything
+	if (fabs(delta) < FRAME_TIMELINE / 2 || isinf(delta))
+		return delta;
+
+	return delta - FRAME_TIMELINE * floor(delta / FRAME_TIMELINE + 0.5);
+}
+
+double frame_wrap (double frame)
+{
+	return frame - FRAME_TIMELINE * floor(frame / FRAME_TIMELINE);
+}
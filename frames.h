@@ -0,0 +1,25 @@
+/** @file frames.h
+ *
+ * @brief Times on the JACK frame timeline, whose 32-bit count wraps about
+ * 24.8 hours in at 48 kHz.
+ *
+ * Whole frames (jack_nframes_t) wrap along with the count and are compared
+ * through their int32_t difference.  Fractional frames are doubles, which
+ * don't: an onset heard after the wrap is a small number again, while a
+ * tick predicted from onsets before it lies past 2^32.  Both are fine as
+ * long as such times are only compared through frame_delta(), and brought
+ * back onto the timeline with frame_wrap() before they become whole frames.
+ */
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#define FRAME_TIMELINE 4294967296.0 // frames counted before the wrap
+
+// to minus from, for times less than half the timeline apart
+double frame_delta (double to, double from);
+
+// the same time on the timeline, 0 to FRAME_TIMELINE
+double frame_wrap (double frame);
+
+#endif
@@ -0,0 +1,1221 @@
+/** @file jack-shim.c
+ *
+ * @brief A stand-in for libjack that runs the program from a script instead
+ * of a server, for simulating hours of playing in minutes.
+ *
+ * Built as libjack.so.0 in its own directory of the build (cmake
+ * -DBUILD_JACK_SHIM=ON) and picked up in place of the real library with
+ *
+ *     LD_LIBRARY_PATH=build/jack-shim JACK_SHIM_SCRIPT=script.txt ./metronome-audio-to-midi
+ *
+ * A driver thread started by jack_activate() calls the process callback
+ * cycle after cycle, and reports what the cycles sent on the MIDI output
+ * ports, with the cycle and the offset into it, to JACK_SHIM_MIDI_LOG (or
+ * stderr), and the frame of every click (or beat of the groove) it played,
+ * to JACK_SHIM_CLICK_LOG if set.  The frame every sound on the audio output
+ * ports starts at, after at least SHIM_QUIET_S of silence, goes to
+ * JACK_SHIM_PLAYED_LOG if set, placed between samples where its first two
+ * samples point back to zero.  The logs count frames from the start of the
+ * script, whatever frame the timeline started at.  The program exits when
+ * the script ends.
+ * The script has a command per line, # starts a comment:
+ *
+ *     rate 48000           sample rate, changed mid-run through the sample rate callback
+ *     period 256           frames per cycle from here on, through the buffer size callback
+ *     speed 0              times real time, 0 to freewheel: cycles back to back
+ *     input file.wav       audio for the input ports, silence after its end
+ *     clicks 120           a click train at this tempo instead (0 for silence)
+ *     ramp 150 8 exp       the click tempo glides to 150 over 8 seconds, exp(onentially) or linearly
+ *     extras 0.3 -6        after this share of the clicks, at random, one this many dB quieter off the beat
+ *     attack 3             ms the clicks take to reach their peak (0 by default)
+ *     levels 20            dB the click level falls by, at random from click to click (0 by default)
+ *     loopback 9.1         ms the audio outputs come back on the input after (0 for none), over a period plus SHIM_SINC_TAPS frames
+ *     noise -40            dB of white noise on the input, rms (none by default)
+ *     sound groove         what plays on the beats: click, groove (kick and snare, hi-hats on the eighths, a pad, noise)
+ *                          or none (a silent train, still logged, to tap along to)
+ *     midi 1.5 fa          bytes (hex) into the MIDI input ports, at a time in seconds
+ *     clock 3 0.5          MIDI clock into the MIDI input ports, 24 ticks to the beat of the click train, this many ms
+ *                          after it, give or take up to this many ms at random (no more than the lateness); clock off stops it
+ *     key 1.5 down = =     keys typed into the UI at a time in seconds: characters, or space, up, down, left, right
+ *     run 60               seconds of cycles
+ *     xrun 0.02            seconds skipped without a cycle, as after an xrun
+ *     start 4294000000     frame the timeline starts at, before the first run (jack_nframes_t wraps)
+ *
+ * Settings before the first run or xrun apply from the start, so the
+ * program sees them when it opens the client.  At speed 0 the shim
+ * freewheels as JACK does when exporting, and says so through the freewheel
+ * callback before the first cycle: the program then has no deadline to
+ * keep and does its analysis within each cycle, so a script gives the same
+ * output every run, as fast as the machine goes.  Time runs on the frame
+ * count: jack_get_time() is in simulated microseconds, and jack_frame_time()
+ * is the start of the current cycle.
+ *
+ * Keys go through a pipe in place of the program's standard input, arrows
+ * as a vt100 sends them (TERM=vt100).  The cycles wait while the UI reads
+ * them, so the commands they send land on the same cycle every run.  The
+ * random draws of the script are seeded the same every run too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+
+#include "wav.h"
+
+#define SHIM_MAX_PERIOD 8192
+#define SHIM_MAX_PORTS 16
+#define SHIM_MAX_MIDI_EVENTS 256 // per port and cycle
+#define SHIM_MAX_COMMANDS 4096
+#define SHIM_CLICK_HZ 2000.0f
+#define SHIM_CLICK_DECAY_S 0.004f
+#define SHIM_DRUM_DECAY_S 0.12f // kick and snare
+#define SHIM_HAT_DECAY_S 0.02f
+#define SHIM_QUIET_S 0.01 // before a sound on the outputs counts as played
+#define SHIM_QUIET_LEVEL 1e-4f
+#define SHIM_LOOPBACK_FRAMES 65536 // of the outputs kept for the loopback, a power of two
+#define SHIM_SINC_TAPS 16 // each side of a fractional delay
+#define SHIM_CLOCK_QUEUE 256 // ticks generated but not yet due
+#define SHIM_KEY_WAIT_S 5.0 // for the UI to read typed keys, before going on without it
+
+typedef enum {
+	SHIM_RATE,
+	SHIM_PERIOD,
+	SHIM_SPEED,
+	SHIM_INPUT,
+	SHIM_CLICKS,
+	SHIM_RAMP,
+	SHIM_EXTRAS,
+	SHIM_ATTACK,
+	SHIM_LEVELS,
+	SHIM_LOOPBACK,
+	SHIM_NOISE,
+	SHIM_SOUND,
+	SHIM_MIDI,
+	SHIM_CLOCK,
+	SHIM_KEY,
+	SHIM_RUN,
+	SHIM_XRUN,
+	SHIM_START
+} shim_command_type_t;
+
+typedef enum {
+	SOUND_CLICK,
+	SOUND_GROOVE,
+	SOUND_NONE
+} shim_sound_t;
+
+typedef struct {
+	shim_command_type_t type;
+	double value; // seconds, tempo, rate...
+	double seconds; // ramp
+	double level_dB; // extras
+	double jitter_ms; // clock
+	bool exponential; // ramp
+	char *path; // input, the bytes of key
+	jack_midi_data_t data[3]; // midi
+	size_t size;
+} shim_command_t;
+
+typedef struct {
+	jack_nframes_t time;
+	jack_midi_data_t data[3];
+	size_t size;
+} shim_midi_event_t;
+
+struct _jack_port {
+	char name[64];
+	unsigned long flags;
+	bool midi;
+	float audio[SHIM_MAX_PERIOD];
+	shim_midi_event_t events[SHIM_MAX_MIDI_EVENTS];
+	uint32_t nEvents;
+
+	// the sounds played on an audio output
+	double quiet; // frames of silence before the current sample
+	double soundFrame; // of the first sample of a sound whose second is still to come, or -1
+	float soundSample;
+};
+
+struct _jack_client {
+	char name[64];
+};
+
+static struct _jack_client shimClient;
+static struct _jack_port ports[SHIM_MAX_PORTS];
+static int nPorts = 0;
+
+static shim_command_t commands[SHIM_MAX_COMMANDS];
+static int nCommands = 0;
+static int firstCycleCommand = 0; // the settings before it were applied at open
+
+static JackProcessCallback processCallback;
+static void *processArg;
+static JackBufferSizeCallback bufferSizeCallback;
+static void *bufferSizeArg;
+static JackSampleRateCallback sampleRateCallback;
+static void *sampleRateArg;
+static JackXRunCallback xrunCallback;
+static void *xrunArg;
+static JackFreewheelCallback freewheelCallback;
+static void *freewheelArg;
+static bool freewheeling = false; // as last reported
+static pthread_t driverThread;
+
+// settings, as the script has it so far
+static jack_nframes_t sampleRate = 48000;
+static jack_nframes_t period = 256;
+static double speed = 0.0;
+static jack_nframes_t startFrame = 0;
+static float *inputSamples = NULL; // of the input file
+static long nInputSamples = 0;
+static double clickTempo_bpm = 0.0; // where a ramp ends
+static double rampFrom_bpm = 0.0;
+static double rampStart = 0.0, rampLength = 0.0; // frames
+static bool rampExponential = false;
+static double extrasShare = 0.0;
+static float extrasGain = 1.0f;
+static double clickAttack_s = 0.0;
+static double levelSpread_dB = 0.0;
+static shim_sound_t sound = SOUND_CLICK;
+static double loopbackDelay = 0.0; // frames
+static float noiseLevel = 0.0f; // peak of the uniform noise
+static bool clockOn = false;
+static double clockLate = 0.0, clockJitter = 0.0; // frames
+
+// the simulated timeline; the current cycle is read by the program's other threads
+static atomic_uint cycleStart;
+static _Atomic double cycleTime_us;
+static double frames = 0.0; // since the start, for the input and clicks, driver thread only
+static FILE *midiLog;
+static FILE *clickLog;
+static FILE *playedLog;
+
+// the click train, driver thread only
+static double clickPhase = 1.0; // beats since the last click, a click is due at the start
+static double lastClickFrame = -INFINITY;
+static long clickBeat = -1; // of the last click, counting from 0
+static float clickGain = 1.0f; // of the last click
+static double lastHatFrame = -INFINITY;
+static float hatNoise = 0.0f; // the previous white noise sample, for the hats' high pass
+static double extraPhase = INFINITY; // where in the beat the next extra click is due
+static double lastExtraFrame = -INFINITY;
+static double clickFrames = 0.0; // the next frame of the train
+static float cycleInput[SHIM_MAX_PERIOD];
+static float loopbackOutput[SHIM_LOOPBACK_FRAMES]; // summed over the audio outputs, by frame
+static double loopbackEnd = 0.0; // frame after the last one kept
+static uint64_t randomState = 1;
+
+// the MIDI clock of the click train, driver thread only: when each byte is due, in order
+static double clockQueueFrame[SHIM_CLOCK_QUEUE];
+static jack_midi_data_t clockQueueByte[SHIM_CLOCK_QUEUE];
+static int clockQueueFirst = 0, clockQueueLength = 0;
+static bool clockStarted = false; // the start message was sent
+
+// the MIDI input and keys of the script, in time order, and the next ones due
+static int nextMidiCommand = 0;
+static int nextKeyCommand = 0;
+static int keyPipe = -1; // written for the program's standard input
+
+static int parseScript (const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[512], word[32], argument[448];
+
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL && nCommands < SHIM_MAX_COMMANDS) {
+		shim_command_t *c = &commands[nCommands];
+		char *comment = strchr(line, '#');
+
+		if (comment != NULL)
+			*comment = '\0';
+
+		int n = sscanf(line, "%31s %447[^\n]", word, argument);
+		if (n < 1)
+			continue;
+		if (n < 2) {
+			fprintf(stderr, "%s: %s needs an argument\n", path, word);
+			fclose(file);
+			return -1;
+		}
+
+		memset(c, 0, sizeof(*c));
+		c->value = atof(argument);
+
+		if (strcmp(word, "rate") == 0)
+			c->type = SHIM_RATE;
+		else if (strcmp(word, "period") == 0)
+			c->type = SHIM_PERIOD;
+		else if (strcmp(word, "speed") == 0)
+			c->type = SHIM_SPEED;
+		else if (strcmp(word, "clicks") == 0)
+			c->type = SHIM_CLICKS;
+		else if (strcmp(word, "ramp") == 0) {
+			char shape[16] = "";
+
+			if (sscanf(argument, "%lf %lf %15s", &c->value, &c->seconds, shape) < 2 || c->seconds <= 0.0
+					|| (shape[0] != '\0' && strcmp(shape, "exp") != 0)) {
+				fprintf(stderr, "%s: ramp needs a tempo, seconds and optionally exp\n", path);
+				fclose(file);
+				return -1;
+			}
+
+			c->type = SHIM_RAMP;
+			c->exponential = shape[0] != '\0';
+		}
+		else if (strcmp(word, "run") == 0)
+			c->type = SHIM_RUN;
+		else if (strcmp(word, "xrun") == 0)
+			c->type = SHIM_XRUN;
+		else if (strcmp(word, "start") == 0)
+			c->type = SHIM_START;
+		else if (strcmp(word, "input") == 0) {
+			c->type = SHIM_INPUT;
+			c->path = strdup(argument);
+		}
+		else if (strcmp(word, "extras") == 0) {
+			if (sscanf(argument, "%lf %lf", &c->value, &c->level_dB) < 2 || c->value < 0.0 || c->value > 1.0) {
+				fprintf(stderr, "%s: extras needs a share of the clicks from 0 to 1 and a level in dB\n", path);
+				fclose(file);
+				return -1;
+			}
+
+			c->type = SHIM_EXTRAS;
+		}
+		else if (strcmp(word, "attack") == 0)
+			c->type = SHIM_ATTACK;
+		else if (strcmp(word, "levels") == 0)
+			c->type = SHIM_LEVELS;
+		else if (strcmp(word, "loopback") == 0)
+			c->type = SHIM_LOOPBACK;
+		else if (strcmp(word, "noise") == 0)
+			c->type = SHIM_NOISE;
+		else if (strcmp(word, "sound") == 0) {
+			char name[16] = "";
+
+			sscanf(argument, "%15s", name);
+			if (strcmp(name, "click") == 0)
+				c->value = SOUND_CLICK;
+			else if (strcmp(name, "groove") == 0)
+				c->value = SOUND_GROOVE;
+			else if (strcmp(name, "none") == 0)
+				c->value = SOUND_NONE;
+			else {
+				fprintf(stderr, "%s: sound needs click, groove or none\n", path);
+				fclose(file);
+				return -1;
+			}
+
+			c->type = SHIM_SOUND;
+		}
+		else if (strcmp(word, "key") == 0) {
+			char keys[448] = "", token[32];
+			int offset, used;
+
+			if (sscanf(argument, "%lf %n", &c->value, &offset) < 1 || argument[offset] == '\0') {
+				fprintf(stderr, "%s: key needs a time and keys\n", path);
+				fclose(file);
+				return -1;
+			}
+
+			for (; sscanf(argument + offset, "%31s%n", token, &used) == 1; offset += used) {
+				const char *bytes = strcmp(token, "space") == 0 ? " "
+						: strcmp(token, "up") == 0 ? "\033OA"
+						: strcmp(token, "down") == 0 ? "\033OB"
+						: strcmp(token, "right") == 0 ? "\033OC"
+						: strcmp(token, "left") == 0 ? "\033OD" : token;
+
+				if (strlen(keys) + strlen(bytes) < sizeof(keys))
+					strcat(keys, bytes);
+			}
+
+			c->type = SHIM_KEY;
+			c->path = strdup(keys);
+		}
+		else if (strcmp(word, "clock") == 0) {
+			c->type = SHIM_CLOCK;
+			c->value = -1.0;
+
+			if (strncmp(argument, "off", 3) != 0
+					&& (sscanf(argument, "%lf %lf", &c->value, &c->jitter_ms) < 1 || c->jitter_ms < 0.0 || c->jitter_ms > c->value)) {
+				fprintf(stderr, "%s: clock needs ms late and up to that many ms of jitter, or off\n", path);
+				fclose(file);
+				return -1;
+			}
+		}
+		else if (strcmp(word, "midi") == 0) {
+			unsigned int bytes[3];
+			int fields = sscanf(argument, "%lf %x %x %x", &c->value, &bytes[0], &bytes[1], &bytes[2]);
+
+			// a time and one to three bytes
+			if (fields < 2 || bytes[0] > 0xFF || (fields > 2 && bytes[1] > 0xFF) || (fields > 3 && bytes[2] > 0xFF)) {
+				fprintf(stderr, "%s: midi needs a time and 1 to 3 bytes in hex\n", path);
+				fclose(file);
+				return -1;
+			}
+
+			c->type = SHIM_MIDI;
+			c->size = fields - 1;
+			for (size_t b = 0; b < c->size; b++)
+				c->data[b] = bytes[b];
+		}
+		else {
+			fprintf(stderr, "%s: unknown command %s\n", path, word);
+			fclose(file);
+			return -1;
+		}
+
+		if (c->type == SHIM_PERIOD && (c->value < 1 || c->value > SHIM_MAX_PERIOD)) {
+			fprintf(stderr, "%s: period must be 1 to %d frames\n", path, SHIM_MAX_PERIOD);
+			fclose(file);
+			return -1;
+		}
+
+		nCommands++;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+// a setting; returns false for commands that take time
+static bool applySetting (const shim_command_t *c, bool running)
+{
+	switch (c->type) {
+		case SHIM_RATE:
+		sampleRate = c->value;
+		if (running && sampleRateCallback != NULL)
+			sampleRateCallback(sampleRate, sampleRateArg);
+		return true;
+
+		case SHIM_PERIOD:
+		period = c->value;
+		if (running && bufferSizeCallback != NULL)
+			bufferSizeCallback(period, bufferSizeArg);
+		return true;
+
+		case SHIM_SPEED:
+		speed = c->value;
+		return true;
+
+		case SHIM_INPUT: {
+			float fileRate;
+			free(inputSamples);
+			inputSamples = NULL;
+			nInputSamples = 0;
+			if (wav_read_mono(c->path, &inputSamples, &nInputSamples, &fileRate) == 0 && fileRate != sampleRate)
+				fprintf(stderr, "jack shim: %s is at %.0f Hz, played at %u Hz\n", c->path, fileRate, sampleRate);
+			clickTempo_bpm = 0.0;
+			return true;
+		}
+
+		case SHIM_CLICKS:
+		case SHIM_RAMP:
+		rampFrom_bpm = clickTempo_bpm;
+		rampStart = frames;
+		rampLength = c->type == SHIM_RAMP ? c->seconds * sampleRate : 0.0;
+		rampExponential = c->exponential && rampFrom_bpm > 0.0 && c->value > 0.0;
+		clickTempo_bpm = c->value;
+		free(inputSamples);
+		inputSamples = NULL;
+		return true;
+
+		case SHIM_EXTRAS:
+		extrasShare = c->value;
+		extrasGain = pow(10.0, c->level_dB / 20.0);
+		return true;
+
+		case SHIM_ATTACK:
+		clickAttack_s = c->value * 0.001;
+		return true;
+
+		case SHIM_LEVELS:
+		levelSpread_dB = c->value;
+		return true;
+
+		case SHIM_LOOPBACK:
+		loopbackDelay = c->value * 0.001 * sampleRate;
+		return true;
+
+		case SHIM_NOISE:
+		noiseLevel = sqrt(3.0) * pow(10.0, c->value / 20.0);
+		return true;
+
+		case SHIM_SOUND:
+		sound = c->value;
+		return true;
+
+		case SHIM_CLOCK:
+		clockOn = c->value >= 0.0;
+		clockLate = c->value * 0.001 * sampleRate;
+		clockJitter = c->jitter_ms * 0.001 * sampleRate;
+		return true;
+
+		case SHIM_MIDI:
+		case SHIM_KEY:
+		return true;
+
+		// the timeline has already started once cycles run
+		case SHIM_START:
+		if (!running)
+			startFrame = c->value;
+		return true;
+
+		default:
+		return false;
+	}
+}
+
+static double clickTempoAt (double frame)
+{
+	if (frame >= rampStart + rampLength)
+		return clickTempo_bpm;
+
+	double x = (frame - rampStart) / rampLength;
+
+	if (rampExponential)
+		return rampFrom_bpm * pow(clickTempo_bpm / rampFrom_bpm, x);
+	return rampFrom_bpm + (clickTempo_bpm - rampFrom_bpm) * x;
+}
+
+// xorshift64*, so a script draws the same every run
+static double uniform (double low, double high)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return low + (high - low) * ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// a click t seconds after its onset
+static float clickVoice (double t)
+{
+	if (t < 0.0 || t > clickAttack_s + 50.0 * SHIM_CLICK_DECAY_S)
+		return 0.0f;
+
+	// a raised cosine attack, then the decay from the peak
+	float envelope = t < clickAttack_s ? 0.5f - 0.5f * cosf(M_PI * t / clickAttack_s) : expf(-(t - clickAttack_s) / SHIM_CLICK_DECAY_S);
+
+	return 0.8f * sinf(2.0f * M_PI * SHIM_CLICK_HZ * t) * envelope;
+}
+
+// a tick of the clock, played late with jitter; the first one is preceded by a start
+static void queueClockTick (double frame)
+{
+	double due = frame + clockLate + uniform(-clockJitter, clockJitter);
+
+	if (clockQueueLength + 2 > SHIM_CLOCK_QUEUE)
+		return;
+
+	if (!clockStarted) {
+		clockQueueFrame[(clockQueueFirst + clockQueueLength) % SHIM_CLOCK_QUEUE] = due;
+		clockQueueByte[(clockQueueFirst + clockQueueLength++) % SHIM_CLOCK_QUEUE] = 0xFA;
+		clockStarted = true;
+	}
+
+	// jitter up to half a tick keeps the ticks in order
+	clockQueueFrame[(clockQueueFirst + clockQueueLength) % SHIM_CLOCK_QUEUE] = due;
+	clockQueueByte[(clockQueueFirst + clockQueueLength++) % SHIM_CLOCK_QUEUE] = 0xF8;
+}
+
+// a kick (even beats) or snare (odd beats) t seconds after its onset
+static float drumVoice (long beat, double t)
+{
+	if (t < 0.0 || t > 10.0 * SHIM_DRUM_DECAY_S)
+		return 0.0f;
+
+	float envelope = expf(-t / SHIM_DRUM_DECAY_S);
+
+	// the kick's pitch falls from 150 to 50 Hz, the snare is a tone under noise
+	if (beat % 2 == 0)
+		return 0.9f * sinf(2.0f * M_PI * (50.0f * t + 100.0f * 0.03f * (1.0f - expf(-t / 0.03f)))) * envelope;
+	return (0.3f * sinf(2.0f * M_PI * 200.0f * t) + 0.5f * uniform(-1.0, 1.0)) * envelope;
+}
+
+// a bar of four of the groove: drums on the beats, hats on the eighths, over a pad and noise
+static float grooveSample (double frame, long beat, double t)
+{
+	double padT = frame / sampleRate;
+	float noise = uniform(-1.0, 1.0), hat = noise - hatNoise;
+	double hatT = (frame - lastHatFrame) / sampleRate;
+
+	hatNoise = noise;
+	return drumVoice(beat, t)
+			+ (hatT >= 0.0 && hatT < 10.0 * SHIM_HAT_DECAY_S ? 0.15f * hat * expf(-hatT / SHIM_HAT_DECAY_S) : 0.0f)
+			+ 0.05f * (sinf(2.0f * M_PI * 110.0f * padT) + sinf(2.0f * M_PI * 138.6f * padT) + sinf(2.0f * M_PI * 164.8f * padT))
+			+ 0.01f * uniform(-1.0, 1.0);
+}
+
+// the next sample of the click train; a click starts wherever the beat count crosses a whole beat
+static float clickSample (double frame)
+{
+	double step = clickTempoAt(frame) / (60.0 * sampleRate);
+
+	// no clicks at tempo 0, the phase stays put until they start
+	if (clickPhase >= 1.0 && step > 0.0) {
+		lastClickFrame = frame - (clickPhase - 1.0) / step;
+		lastHatFrame = lastClickFrame;
+		clickBeat++;
+		clickGain = levelSpread_dB > 0.0 ? pow(10.0, uniform(-levelSpread_dB, 0.0) / 20.0) : 1.0f;
+		clickPhase -= 1.0;
+		if (clickLog != NULL)
+			fprintf(clickLog, "%.3f\n", lastClickFrame);
+		if (clockOn)
+			queueClockTick(lastClickFrame);
+
+		// the extras fall between 20% and 80% of the beat, not in the clicks' tails
+		extraPhase = extrasShare > 0.0 && uniform(0.0, 1.0) < extrasShare ? uniform(0.2, 0.8) : INFINITY;
+	}
+	if (clickPhase >= extraPhase) {
+		lastExtraFrame = frame - (clickPhase - extraPhase) / step;
+		extraPhase = INFINITY;
+	}
+	if (clickPhase < 0.5 && clickPhase + step >= 0.5)
+		lastHatFrame = frame + (0.5 - clickPhase) / step;
+
+	// the clock's other ticks, wherever the phase crosses a 24th of the beat
+	if (clockOn && step > 0.0) {
+		for (int k = floor(24.0 * clickPhase) + 1; k < 24 && k <= 24.0 * (clickPhase + step); k++)
+			queueClockTick(frame + (k / 24.0 - clickPhase) / step);
+	}
+	clickPhase += step;
+
+	double t = (frame - lastClickFrame) / sampleRate;
+
+	if (sound == SOUND_NONE)
+		return 0.0f;
+	return (sound == SOUND_GROOVE ? grooveSample(frame, clickBeat, t) : clickGain * clickVoice(t))
+			+ extrasGain * clickVoice((frame - lastExtraFrame) / sampleRate);
+}
+
+// the outputs at a time between frames, through a Hann windowed sinc
+static float loopbackSample (double time)
+{
+	double first = floor(time) - SHIM_SINC_TAPS + 1;
+	float sum = 0.0f;
+
+	for (int k = 0; k < 2 * SHIM_SINC_TAPS; k++) {
+		double x = time - (first + k);
+		double window = 0.5 + 0.5 * cos(M_PI * x / SHIM_SINC_TAPS);
+		double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+
+		if (first + k >= 0.0)
+			sum += window * sinc * loopbackOutput[(long) (first + k) & (SHIM_LOOPBACK_FRAMES - 1)];
+	}
+
+	return sum;
+}
+
+static void renderInput (void)
+{
+	static bool shortLoopback = false;
+
+	// the metronome plays on through an xrun
+	while (clickFrames < frames)
+		clickSample(clickFrames++);
+
+	if (loopbackDelay > 0.0 && loopbackDelay < period + SHIM_SINC_TAPS && !shortLoopback) {
+		fprintf(stderr, "jack shim: the loopback needs %u frames at least\n", period + SHIM_SINC_TAPS);
+		shortLoopback = true;
+	}
+
+	for (jack_nframes_t i = 0; i < period; i++) {
+		double frame = frames + i;
+
+		if (inputSamples != NULL)
+			cycleInput[i] = frame < nInputSamples ? inputSamples[(long) frame] : 0.0f;
+		else
+			cycleInput[i] = clickSample(frame);
+
+		if (loopbackDelay > 0.0)
+			cycleInput[i] += loopbackSample(frame - loopbackDelay);
+		if (noiseLevel > 0.0f)
+			cycleInput[i] += uniform(-noiseLevel, noiseLevel);
+	}
+	clickFrames = frames + period;
+}
+
+// keep what the cycle played for the loopback, silence for the frames an xrun skipped
+static void keepOutput (void)
+{
+	for (; loopbackEnd < frames; loopbackEnd++)
+		loopbackOutput[(long) loopbackEnd & (SHIM_LOOPBACK_FRAMES - 1)] = 0.0f;
+
+	for (jack_nframes_t i = 0; i < period; i++)
+		loopbackOutput[(long) (frames + i) & (SHIM_LOOPBACK_FRAMES - 1)] = 0.0f;
+
+	for (int p = 0; p < nPorts; p++)
+		if (!ports[p].midi && (ports[p].flags & JackPortIsOutput))
+			for (jack_nframes_t i = 0; i < period; i++)
+				loopbackOutput[(long) (frames + i) & (SHIM_LOOPBACK_FRAMES - 1)] += ports[p].audio[i];
+	loopbackEnd = frames + period;
+}
+
+// type keys into the UI, and hold the cycles until it has read them and acted
+static void typeKeys (const char *keys)
+{
+	struct timespec poll = { 0, 1000000 }, act = { 0, 50000000 };
+	int pending = 0;
+
+	if (write(keyPipe, keys, strlen(keys)) != (ssize_t) strlen(keys)) {
+		perror("jack shim: keys");
+		return;
+	}
+
+	for (int waited = 0; waited < SHIM_KEY_WAIT_S * 1000; waited++) {
+		if (ioctl(STDIN_FILENO, FIONREAD, &pending) || pending == 0)
+			break;
+		nanosleep(&poll, NULL);
+	}
+
+	if (pending > 0)
+		fprintf(stderr, "jack shim: the UI did not read the keys %s\n", keys);
+	nanosleep(&act, NULL);
+}
+
+// log where sounds start on an audio output, after enough silence
+static void logPlayed (struct _jack_port *port)
+{
+	for (jack_nframes_t i = 0; i < period; i++) {
+		float x = port->audio[i];
+
+		// a straight line through the first two samples, back to zero
+		if (port->soundFrame >= 0.0) {
+			double start = port->soundFrame;
+			if (fabsf(x) > fabsf(port->soundSample) && (x > 0.0f) == (port->soundSample > 0.0f))
+				start -= port->soundSample / (x - port->soundSample);
+			fprintf(playedLog, "%.3f\n", start);
+			port->soundFrame = -1.0;
+		}
+
+		if (fabsf(x) < SHIM_QUIET_LEVEL) {
+			port->quiet++;
+			continue;
+		}
+		if (port->quiet >= SHIM_QUIET_S * sampleRate) {
+			port->soundFrame = frames + i;
+			port->soundSample = x;
+		}
+		port->quiet = 0.0;
+	}
+}
+
+// an event into every MIDI input port at an offset into the cycle, in time order
+static void deliverMidi (double offset, const jack_midi_data_t *data, size_t size)
+{
+	jack_nframes_t time = offset > 0.0 ? offset : 0;
+
+	for (int p = 0; p < nPorts; p++) {
+		struct _jack_port *port = &ports[p];
+		if (!port->midi || !(port->flags & JackPortIsInput) || port->nEvents == SHIM_MAX_MIDI_EVENTS)
+			continue;
+
+		uint32_t e = port->nEvents++;
+		for (; e > 0 && port->events[e - 1].time > time; e--)
+			port->events[e] = port->events[e - 1];
+		port->events[e].time = time;
+		memcpy(port->events[e].data, data, size);
+		port->events[e].size = size;
+	}
+}
+
+static void runCycle (void)
+{
+	double endTime_s = atomic_load(&cycleTime_us) * 1e-6 + (double) period / sampleRate;
+
+	// keys due in this cycle are stamped with its start, as the UI would see them
+	for (; nextKeyCommand < nCommands; nextKeyCommand++) {
+		const shim_command_t *c = &commands[nextKeyCommand];
+		if (c->type != SHIM_KEY)
+			continue;
+		if (c->value >= endTime_s)
+			break;
+		typeKeys(c->path);
+	}
+
+	renderInput();
+
+	for (int p = 0; p < nPorts; p++) {
+		struct _jack_port *port = &ports[p];
+
+		port->nEvents = 0;
+		if (!(port->flags & JackPortIsInput))
+			continue;
+
+		if (!port->midi)
+			memcpy(port->audio, cycleInput, period * sizeof(float));
+	}
+
+	// MIDI input due in this cycle goes to every MIDI input port, late events at its start
+	for (; nextMidiCommand < nCommands; nextMidiCommand++) {
+		const shim_command_t *c = &commands[nextMidiCommand];
+		if (c->type != SHIM_MIDI)
+			continue;
+		if (c->value >= endTime_s)
+			break;
+
+		deliverMidi((c->value - atomic_load(&cycleTime_us) * 1e-6) * sampleRate, c->data, c->size);
+	}
+
+	for (; clockQueueLength > 0 && clockQueueFrame[clockQueueFirst] < frames + period; clockQueueLength--) {
+		deliverMidi(clockQueueFrame[clockQueueFirst] - frames, &clockQueueByte[clockQueueFirst], 1);
+		clockQueueFirst = (clockQueueFirst + 1) % SHIM_CLOCK_QUEUE;
+	}
+
+	processCallback(period, processArg);
+	keepOutput();
+
+	for (int p = 0; p < nPorts; p++) {
+		struct _jack_port *port = &ports[p];
+		if (!(port->flags & JackPortIsOutput))
+			continue;
+
+		if (!port->midi) {
+			if (playedLog != NULL)
+				logPlayed(port);
+			continue;
+		}
+
+		for (uint32_t e = 0; e < port->nEvents; e++) {
+			fprintf(midiLog, "%.0f %u", frames, port->events[e].time);
+			for (size_t b = 0; b < port->events[e].size; b++)
+				fprintf(midiLog, " %02x", port->events[e].data[b]);
+			fprintf(midiLog, "\n");
+		}
+	}
+}
+
+// move the timeline on by n frames
+static void advance (jack_nframes_t n)
+{
+	atomic_store(&cycleStart, atomic_load(&cycleStart) + n);
+	atomic_store(&cycleTime_us, atomic_load(&cycleTime_us) + n * 1e6 / sampleRate);
+	frames += n;
+}
+
+// tell the program whether cycles now run back to back
+static void reportFreewheel (void)
+{
+	if (freewheelCallback != NULL && (speed <= 0.0) != freewheeling) {
+		freewheeling = speed <= 0.0;
+		freewheelCallback(freewheeling, freewheelArg);
+	}
+}
+
+// in real time (or a multiple), wait for the simulated time to come
+static void pace (struct timespec *wallStart, double *simulatedStart_us)
+{
+	if (speed <= 0.0)
+		return;
+
+	double wait_us = (atomic_load(&cycleTime_us) - *simulatedStart_us) / speed;
+	struct timespec due = *wallStart;
+
+	due.tv_sec += (time_t) (wait_us * 1e-6);
+	due.tv_nsec += (long) fmod(wait_us * 1000.0, 1e9);
+	if (due.tv_nsec >= 1000000000) {
+		due.tv_sec++;
+		due.tv_nsec -= 1000000000;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+		;
+}
+
+static void *driver (void *arg)
+{
+	struct timespec wallStart;
+	double simulatedStart_us = 0.0;
+
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	reportFreewheel();
+
+	for (int k = firstCycleCommand; k < nCommands; k++) {
+		const shim_command_t *c = &commands[k];
+
+		if (applySetting(c, true)) {
+			// pacing starts over from a new speed
+			if (c->type == SHIM_SPEED) {
+				clock_gettime(CLOCK_MONOTONIC, &wallStart);
+				simulatedStart_us = atomic_load(&cycleTime_us);
+				reportFreewheel();
+			}
+			continue;
+		}
+
+		double end_us = atomic_load(&cycleTime_us) + c->value * 1e6;
+
+		if (c->type == SHIM_XRUN) {
+			jack_nframes_t skipped = c->value * sampleRate;
+			advance(skipped);
+			if (xrunCallback != NULL)
+				xrunCallback(xrunArg);
+			continue;
+		}
+
+		while (atomic_load(&cycleTime_us) < end_us) {
+			runCycle();
+			advance(period);
+			pace(&wallStart, &simulatedStart_us);
+		}
+	}
+
+	fflush(midiLog);
+	if (clickLog != NULL)
+		fflush(clickLog);
+	if (playedLog != NULL)
+		fflush(playedLog);
+	exit (0);
+	return NULL;
+}
+
+jack_client_t *jack_client_open (const char *client_name, jack_options_t options, jack_status_t *status, ...)
+{
+	const char *script = getenv("JACK_SHIM_SCRIPT");
+	const char *log = getenv("JACK_SHIM_MIDI_LOG");
+	const char *clicks = getenv("JACK_SHIM_CLICK_LOG");
+	const char *played = getenv("JACK_SHIM_PLAYED_LOG");
+
+	*status = 0;
+
+	if (script == NULL) {
+		fprintf(stderr, "jack shim: set JACK_SHIM_SCRIPT to the script to run\n");
+		*status = JackFailure | JackServerFailed;
+		return NULL;
+	}
+
+	midiLog = log != NULL ? fopen(log, "w") : stderr;
+	clickLog = clicks != NULL ? fopen(clicks, "w") : NULL;
+	playedLog = played != NULL ? fopen(played, "w") : NULL;
+
+	if (midiLog == NULL || (clicks != NULL && clickLog == NULL) || (played != NULL && playedLog == NULL) || parseScript(script)) {
+		*status = JackFailure;
+		return NULL;
+	}
+
+	// the keys of the script take the place of the terminal's
+	for (int k = 0; k < nCommands; k++) {
+		int fds[2];
+
+		if (commands[k].type != SHIM_KEY)
+			continue;
+
+		if (pipe(fds) || dup2(fds[0], STDIN_FILENO) < 0) {
+			perror("jack shim: keys");
+			*status = JackFailure;
+			return NULL;
+		}
+		close(fds[0]);
+		keyPipe = fds[1];
+		break;
+	}
+
+	// the settings up to the first cycle are there from the start
+	while (firstCycleCommand < nCommands && applySetting(&commands[firstCycleCommand], false))
+		firstCycleCommand++;
+
+	atomic_init(&cycleStart, startFrame);
+	atomic_init(&cycleTime_us, 0.0);
+	snprintf(shimClient.name, sizeof(shimClient.name), "%s", client_name);
+	return &shimClient;
+}
+
+int jack_client_close (jack_client_t *client)
+{
+	fflush(midiLog);
+	return 0;
+}
+
+char *jack_get_client_name (jack_client_t *client)
+{
+	return client->name;
+}
+
+int jack_set_process_callback (jack_client_t *client, JackProcessCallback callback, void *arg)
+{
+	processCallback = callback;
+	processArg = arg;
+	return 0;
+}
+
+int jack_set_buffer_size_callback (jack_client_t *client, JackBufferSizeCallback callback, void *arg)
+{
+	bufferSizeCallback = callback;
+	bufferSizeArg = arg;
+	return 0;
+}
+
+int jack_set_sample_rate_callback (jack_client_t *client, JackSampleRateCallback callback, void *arg)
+{
+	sampleRateCallback = callback;
+	sampleRateArg = arg;
+	return 0;
+}
+
+int jack_set_xrun_callback (jack_client_t *client, JackXRunCallback callback, void *arg)
+{
+	xrunCallback = callback;
+	xrunArg = arg;
+	return 0;
+}
+
+int jack_set_freewheel_callback (jack_client_t *client, JackFreewheelCallback callback, void *arg)
+{
+	freewheelCallback = callback;
+	freewheelArg = arg;
+	return 0;
+}
+
+// nothing is shut down or has latencies to report
+void jack_on_shutdown (jack_client_t *client, JackShutdownCallback callback, void *arg)
+{
+}
+
+int jack_set_latency_callback (jack_client_t *client, JackLatencyCallback callback, void *arg)
+{
+	return 0;
+}
+
+int jack_recompute_total_latencies (jack_client_t *client)
+{
+	return 0;
+}
+
+void jack_port_get_latency_range (jack_port_t *port, jack_latency_callback_mode_t mode, jack_latency_range_t *range)
+{
+	range->min = range->max = 0;
+}
+
+void jack_port_set_latency_range (jack_port_t *port, jack_latency_callback_mode_t mode, jack_latency_range_t *range)
+{
+}
+
+int jack_activate (jack_client_t *client)
+{
+	if (processCallback == NULL || pthread_create(&driverThread, NULL, driver, NULL))
+		return -1;
+	return 0;
+}
+
+int jack_deactivate (jack_client_t *client)
+{
+	return 0;
+}
+
+jack_nframes_t jack_get_sample_rate (jack_client_t *client)
+{
+	return sampleRate;
+}
+
+jack_nframes_t jack_get_buffer_size (jack_client_t *client)
+{
+	return period;
+}
+
+jack_port_t *jack_port_register (jack_client_t *client, const char *port_name, const char *port_type,
+		unsigned long flags, unsigned long buffer_size)
+{
+	if (nPorts == SHIM_MAX_PORTS)
+		return NULL;
+
+	jack_port_t *port = &ports[nPorts++];
+
+	snprintf(port->name, sizeof(port->name), "%s:%s", client->name, port_name);
+	port->flags = flags;
+	port->midi = strcmp(port_type, JACK_DEFAULT_MIDI_TYPE) == 0;
+	port->soundFrame = -1.0;
+	return port;
+}
+
+void *jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	return port->midi ? (void *) port : (void *) port->audio;
+}
+
+const char *jack_port_name (const jack_port_t *port)
+{
+	return port->name;
+}
+
+int jack_port_connected (const jack_port_t *port)
+{
+	return 1;
+}
+
+// one made up port of the kind asked for; the program frees the list
+const char **jack_get_ports (jack_client_t *client, const char *port_name_pattern,
+		const char *type_name_pattern, unsigned long flags)
+{
+	const char **names = malloc(2 * sizeof(*names));
+
+	if (names != NULL) {
+		names[0] = flags & JackPortIsInput ? "system:playback_1" : "system:capture_1";
+		names[1] = NULL;
+	}
+	return names;
+}
+
+int jack_connect (jack_client_t *client, const char *source_port, const char *destination_port)
+{
+	return 0;
+}
+
+void jack_free (void *ptr)
+{
+	free(ptr);
+}
+
+jack_nframes_t jack_frame_time (const jack_client_t *client)
+{
+	return atomic_load(&cycleStart);
+}
+
+jack_nframes_t jack_last_frame_time (const jack_client_t *client)
+{
+	return atomic_load(&cycleStart);
+}
+
+jack_time_t jack_frames_to_time (const jack_client_t *client, jack_nframes_t frame)
+{
+	int32_t since = frame - atomic_load(&cycleStart);
+	return atomic_load(&cycleTime_us) + since * 1e6 / sampleRate;
+}
+
+jack_time_t jack_get_time (void)
+{
+	return atomic_load(&cycleTime_us);
+}
+
+// MIDI buffers are the ports themselves
+uint32_t jack_midi_get_event_count (void *port_buffer)
+{
+	return ((jack_port_t *) port_buffer)->nEvents;
+}
+
+int jack_midi_event_get (jack_midi_event_t *event, void *port_buffer, uint32_t event_index)
+{
+	jack_port_t *port = port_buffer;
+
+	if (event_index >= port->nEvents)
+		return -ENODATA;
+
+	event->time = port->events[event_index].time;
+	event->size = port->events[event_index].size;
+	event->buffer = port->events[event_index].data;
+	return 0;
+}
+
+void jack_midi_clear_buffer (void *port_buffer)
+{
+	((jack_port_t *) port_buffer)->nEvents = 0;
+}
+
+int jack_midi_event_write (void *port_buffer, jack_nframes_t time, const jack_midi_data_t *data, size_t data_size)
+{
+	jack_port_t *port = port_buffer;
+
+	if (port->nEvents == SHIM_MAX_MIDI_EVENTS || data_size > sizeof(port->events[0].data))
+		return -ENOBUFS;
+
+	port->events[port->nEvents].time = time;
+	memcpy(port->events[port->nEvents].data, data, data_size);
+	port->events[port->nEvents].size = data_size;
+	port->nEvents++;
+	return 0;
+}
+
+/*
+ * Ring buffers work as libjack's do: single reader and writer, one byte
+ * kept free to tell full from empty.
+ */
+jack_ringbuffer_t *jack_ringbuffer_create (size_t sz)
+{
+	jack_ringbuffer_t *rb = calloc(1, sizeof(*rb));
+	size_t size = 1;
+
+	while (size < sz + 1)
+		size *= 2;
+
+	if (rb == NULL || (rb->buf = calloc(size, 1)) == NULL) {
+		free(rb);
+		return NULL;
+	}
+
+	rb->size = size;
+	rb->size_mask = size - 1;
+	return rb;
+}
+
+void jack_ringbuffer_free (jack_ringbuffer_t *rb)
+{
+	free(rb->buf);
+	free(rb);
+}
+
+size_t jack_ringbuffer_read_space (const jack_ringbuffer_t *rb)
+{
+	size_t w = __atomic_load_n(&rb->write_ptr, __ATOMIC_ACQUIRE);
+	return (w - rb->read_ptr) & rb->size_mask;
+}
+
+size_t jack_ringbuffer_write_space (const jack_ringbuffer_t *rb)
+{
+	size_t r = __atomic_load_n(&rb->read_ptr, __ATOMIC_ACQUIRE);
+	return (r - rb->write_ptr - 1) & rb->size_mask;
+}
+
+size_t jack_ringbuffer_peek (jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t available = jack_ringbuffer_read_space(rb);
+
+	if (cnt > available)
+		cnt = available;
+	for (size_t i = 0; i < cnt; i++)
+		dest[i] = rb->buf[(rb->read_ptr + i) & rb->size_mask];
+	return cnt;
+}
+
+void jack_ringbuffer_read_advance (jack_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n(&rb->read_ptr, (rb->read_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+}
+
+size_t jack_ringbuffer_read (jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	cnt = jack_ringbuffer_peek(rb, dest, cnt);
+	jack_ringbuffer_read_advance(rb, cnt);
+	return cnt;
+}
+
+void jack_ringbuffer_write_advance (jack_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n(&rb->write_ptr, (rb->write_ptr + cnt) & rb->size_mask, __ATOMIC_RELEASE);
+}
+
+size_t jack_ringbuffer_write (jack_ringbuffer_t *rb, const char *src, size_t cnt)
+{
+	size_t available = jack_ringbuffer_write_space(rb);
+
+	if (cnt > available)
+		cnt = available;
+	for (size_t i = 0; i < cnt; i++)
+		rb->buf[(rb->write_ptr + i) & rb->size_mask] = src[i];
+	jack_ringbuffer_write_advance(rb, cnt);
+	return cnt;
+}
@@ -0,0 +1,208 @@
+/** @file loopback.c
+ *
+ * @brief Round trip latency measurement through a loopback from the audio
+ * output to the audio input.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "loopback.h"
+
+#define CHIRP_START_HZ 500.0f
+#define CHIRP_END_HZ 8000.0f
+#define CHIRP_LEVEL 0.5f
+
+int loopback_init (loopback_t *lb, float sampleRate)
+{
+	memset(lb, 0, sizeof(*lb));
+
+	lb->sampleRate = sampleRate;
+	lb->chirpLength = sampleRate * LOOPBACK_CHIRP_MS / 1000.0f;
+	lb->window = sampleRate * LOOPBACK_MAX_LATENCY_S + lb->chirpLength;
+	lb->interval = sampleRate * LOOPBACK_INTERVAL_S;
+	lb->chirp = malloc(lb->chirpLength * sizeof(float));
+	lb->recording = malloc(LOOPBACK_TRIALS * lb->window * sizeof(float));
+	atomic_init(&lb->state, LOOPBACK_IDLE);
+
+	if (lb->chirp == NULL || lb->recording == NULL || lb->window > lb->interval) {
+		loopback_free(lb);
+		return -1;
+	}
+
+	// Hann windowed linear sweep: broadband, so the correlation has one sharp peak
+	float duration = lb->chirpLength / sampleRate;
+	float sweep = (CHIRP_END_HZ - CHIRP_START_HZ) / duration;
+
+	for (jack_nframes_t k = 0; k < lb->chirpLength; k++) {
+		float t = k / sampleRate;
+		float window = 0.5f - 0.5f * cosf(2.0f * (float) M_PI * k / (lb->chirpLength - 1));
+		lb->chirp[k] = CHIRP_LEVEL * window * sinf(2.0f * (float) M_PI * (CHIRP_START_HZ + 0.5f * sweep * t) * t);
+	}
+
+	return 0;
+}
+
+void loopback_free (loopback_t *lb)
+{
+	free(lb->chirp);
+	free(lb->recording);
+	lb->chirp = NULL;
+	lb->recording = NULL;
+}
+
+void loopback_start (loopback_t *lb)
+{
+	int state = atomic_load(&lb->state);
+
+	if (state == LOOPBACK_RUNNING || state == LOOPBACK_RECORDED || state == LOOPBACK_ANALYZING)
+		return;
+
+	lb->started = false;
+	atomic_store(&lb->state, LOOPBACK_RUNNING);
+}
+
+bool loopback_process (loopback_t *lb, const float *in, float *out, jack_nframes_t nframes, jack_nframes_t startFrame)
+{
+	if (atomic_load(&lb->state) != LOOPBACK_RUNNING)
+		return false;
+
+	if (!lb->started) {
+		lb->firstFrame = startFrame;
+		lb->started = true;
+	}
+
+	for (jack_nframes_t i = 0; i < nframes; i++) {
+		jack_nframes_t elapsed = startFrame + i - lb->firstFrame;
+		jack_nframes_t trial = elapsed / lb->interval;
+		jack_nframes_t position = elapsed % lb->interval;
+
+		if (trial >= LOOPBACK_TRIALS) {
+			out[i] = 0.0f;
+			continue;
+		}
+
+		out[i] = position < lb->chirpLength ? lb->chirp[position] : 0.0f;
+
+		if (position < lb->window)
+			lb->recording[trial * lb->window + position] = in[i];
+	}
+
+	if (startFrame + nframes - lb->firstFrame >= LOOPBACK_TRIALS * lb->interval)
+		atomic_store(&lb->state, LOOPBACK_RECORDED);
+
+	return true;
+}
+
+static double correlate (const loopback_t *lb, const float *x, jack_nframes_t lag)
+{
+	double correlation = 0.0;
+
+	for (jack_nframes_t k = 0; k < lb->chirpLength; k++)
+		correlation += lb->chirp[k] * x[lag + k];
+
+	return correlation;
+}
+
+/*
+ * Lag of the chirp in one trial's recording, to a fraction of a frame from
+ * the parabola through the correlation peak, or a negative value if the
+ * chirp isn't clearly there.
+ */
+static float measureTrial (const loopback_t *lb, const float *x)
+{
+	jack_nframes_t n = lb->chirpLength;
+	jack_nframes_t lags = lb->window - n + 1;
+	double chirpEnergy = 0.0, energy = 0.0, best = 0.0;
+	jack_nframes_t bestLag = 0;
+
+	for (jack_nframes_t k = 0; k < n; k++) {
+		chirpEnergy += lb->chirp[k] * lb->chirp[k];
+		energy += x[k] * x[k];
+	}
+
+	for (jack_nframes_t lag = 0; lag < lags; lag++) {
+		// a chirp 60 dB down is no longer told apart from noise
+		if (energy > 1e-6 * chirpEnergy) {
+			double normalized = correlate(lb, x, lag) / sqrt(chirpEnergy * energy);
+			if (normalized > best) {
+				best = normalized;
+				bestLag = lag;
+			}
+		}
+
+		// slide the energy window along
+		if (lag + 1 < lags)
+			energy += x[lag + n] * x[lag + n] - x[lag] * x[lag];
+	}
+
+	if (best < LOOPBACK_MIN_CORRELATION)
+		return -1.0f;
+
+	if (bestLag == 0 || bestLag == lags - 1)
+		return bestLag;
+
+	double before = correlate(lb, x, bestLag - 1);
+	double at = correlate(lb, x, bestLag);
+	double after = correlate(lb, x, bestLag + 1);
+	double curvature = before - 2.0 * at + after;
+
+	return curvature < 0.0 ? bestLag + 0.5 * (before - after) / curvature : bestLag;
+}
+
+static int compareFloats (const void *a, const void *b)
+{
+	float x = *(const float *) a, y = *(const float *) b;
+	return (x > y) - (x < y);
+}
+
+static void *loopbackThread (void *arg)
+{
+	loopback_t *lb = arg;
+	float lag[LOOPBACK_TRIALS], deviation[LOOPBACK_TRIALS];
+	int n = 0;
+
+	for (int trial = 0; trial < LOOPBACK_TRIALS; trial++) {
+		float measured = measureTrial(lb, lb->recording + trial * lb->window);
+		if (measured >= 0.0f)
+			lag[n++] = measured;
+	}
+
+	lb->nTrials = n;
+
+	// half the chirps or more must come back, the median then ignores stray ones
+	if (n < LOOPBACK_TRIALS / 2) {
+		atomic_store(&lb->state, LOOPBACK_FAILED);
+		return NULL;
+	}
+
+	qsort(lag, n, sizeof(float), compareFloats);
+	lb->latency_frames = n % 2 ? lag[n / 2] : 0.5f * (lag[n / 2 - 1] + lag[n / 2]);
+
+	for (int k = 0; k < n; k++)
+		deviation[k] = fabsf(lag[k] - lb->latency_frames);
+	qsort(deviation, n, sizeof(float), compareFloats);
+	lb->spread_frames = deviation[n / 2];
+
+	atomic_store(&lb->state, LOOPBACK_DONE);
+	return NULL;
+}
+
+void loopback_poll (loopback_t *lb, bool inPlace)
+{
+	pthread_t thread;
+
+	if (atomic_load(&lb->state) != LOOPBACK_RECORDED)
+		return;
+
+	atomic_store(&lb->state, LOOPBACK_ANALYZING);
+
+	if (inPlace)
+		loopbackThread(lb);
+	else if (pthread_create(&thread, NULL, loopbackThread, lb))
+		atomic_store(&lb->state, LOOPBACK_FAILED);
+	else
+		pthread_detach(thread);
+}
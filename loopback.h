@@ -0,0 +1,77 @@
+/** @file loopback.h
+ *
+ * @brief Round trip latency measurement through a loopback from the audio
+ * output to the audio input.
+ *
+ * The latencies JACK reports for a device are often off by the converter
+ * delays or a period, so they are measured instead.  process() plays a
+ * short chirp on the audio output every LOOPBACK_INTERVAL_S and records
+ * the input after each one into a buffer allocated up front.  Once all
+ * trials are in, the analysis thread hands the recording to a worker thread
+ * (loopback_poll()), which finds each chirp by normalized cross-correlation
+ * with parabolic interpolation of the peak, and takes the median over the
+ * trials, to a fraction of a frame.  While JACK freewheels, the analysis
+ * thread works through the recording itself.
+ *
+ * Ticks are sent that much ahead of the onsets they are predicted from, so
+ * slaves land on the clicks rather than a round trip behind them.
+ */
+
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <jack/jack.h>
+
+#define LOOPBACK_TRIALS 16
+#define LOOPBACK_INTERVAL_S 0.25f // between chirps
+#define LOOPBACK_MAX_LATENCY_S 0.1f // longest round trip searched
+#define LOOPBACK_CHIRP_MS 2.5f
+#define LOOPBACK_MIN_CORRELATION 0.5f // for a trial to count
+
+enum {
+	LOOPBACK_IDLE,
+	LOOPBACK_RUNNING, // process() playing chirps and recording
+	LOOPBACK_RECORDED, // all trials recorded, waiting for a worker
+	LOOPBACK_ANALYZING, // worker running
+	LOOPBACK_DONE, // results ready to apply
+	LOOPBACK_APPLIED,
+	LOOPBACK_FAILED // too few chirps came back
+};
+
+typedef struct {
+	float *chirp;
+	jack_nframes_t chirpLength;
+	float *recording; // LOOPBACK_TRIALS windows
+	jack_nframes_t window; // frames recorded per trial
+	jack_nframes_t interval; // frames between chirps
+	float sampleRate;
+	atomic_int state;
+
+	// realtime state
+	bool started;
+	jack_nframes_t firstFrame; // frame the first chirp starts at
+
+	// results
+	int nTrials; // trials that found the chirp
+	float latency_frames; // median round trip
+	float spread_frames; // median absolute deviation of the trials
+} loopback_t;
+
+int loopback_init (loopback_t *lb, float sampleRate);
+void loopback_free (loopback_t *lb);
+
+// begin a measurement; ignored while one is in progress
+void loopback_start (loopback_t *lb);
+
+/*
+ * Realtime thread: while measuring, write the chirps to out and record in.
+ * Returns true if it wrote out, which then carries nothing else.
+ */
+bool loopback_process (loopback_t *lb, const float *in, float *out, jack_nframes_t nframes, jack_nframes_t startFrame);
+
+// analysis thread: once all trials are recorded, analyze them on a worker thread, or right away if inPlace
+void loopback_poll (loopback_t *lb, bool inPlace);
+
+#endif
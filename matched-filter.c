@@ -0,0 +1,256 @@
+/** @file matched-filter.c
+ *
+ * @brief Click detector that learns a template from the first detected clicks
+ * and then locates clicks by normalized cross-correlation.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "matched-filter.h"
+
+#define HISTORY_MASK (MATCHED_FILTER_HISTORY - 1)
+
+int matched_filter_init (matched_filter_t *mf, int nLearnClicks)
+{
+	memset(mf, 0, sizeof(*mf));
+
+	if (fft_init(&mf->fft, 2 * MATCHED_FILTER_LENGTH))
+		return -1;
+
+	mf->templateRe = calloc(2 * MATCHED_FILTER_LENGTH, sizeof(float));
+	mf->templateIm = calloc(2 * MATCHED_FILTER_LENGTH, sizeof(float));
+	mf->workRe = calloc(2 * MATCHED_FILTER_LENGTH, sizeof(float));
+	mf->workIm = calloc(2 * MATCHED_FILTER_LENGTH, sizeof(float));
+
+	if (mf->templateRe == NULL || mf->templateIm == NULL || mf->workRe == NULL || mf->workIm == NULL) {
+		matched_filter_free(mf);
+		return -1;
+	}
+
+	mf->nLearnClicks = nLearnClicks > 0 ? nLearnClicks : 1;
+	mf->matchThreshold = 0.7f;
+	mf->minEnergy = 1e-5f;
+	mf->minInterval = MATCHED_FILTER_LENGTH;
+
+	return 0;
+}
+
+void matched_filter_free (matched_filter_t *mf)
+{
+	fft_free(&mf->fft);
+	free(mf->templateRe);
+	free(mf->templateIm);
+	free(mf->workRe);
+	free(mf->workIm);
+	mf->templateRe = mf->templateIm = mf->workRe = mf->workIm = NULL;
+}
+
+void matched_filter_reset (matched_filter_t *mf)
+{
+	mf->ready = false;
+	mf->capturePending = false;
+	mf->nLearned = 0;
+	mf->candidate = false;
+	mf->hopFill = 0;
+}
+
+void matched_filter_learn (matched_filter_t *mf, jack_nframes_t crossingFrame)
+{
+	if (mf->ready || mf->capturePending)
+		return;
+
+	mf->captureStart = crossingFrame - MATCHED_FILTER_PREROLL;
+	mf->capturePending = true;
+}
+
+static float historyAt (const matched_filter_t *mf, jack_nframes_t frame)
+{
+	return mf->history[frame & HISTORY_MASK];
+}
+
+static void finishTemplate (matched_filter_t *mf)
+{
+	int k;
+	float energy = 0.0f;
+	float *re = mf->templateRe;
+	float *im = mf->templateIm;
+
+	for (k = 0; k < MATCHED_FILTER_LENGTH; k++)
+		energy += mf->templateSum[k] * mf->templateSum[k];
+
+	float scale = energy > 0.0f ? 1.0f / sqrtf(energy) : 0.0f;
+
+	mf->templatePeak = 0.0f;
+	for (k = 0; k < MATCHED_FILTER_LENGTH; k++) {
+		mf->template[k] = mf->templateSum[k] * scale;
+		if (fabsf(mf->template[k]) > mf->templatePeak)
+			mf->templatePeak = fabsf(mf->template[k]);
+	}
+
+	// store the conjugate spectrum so a product with the input spectrum gives correlation
+	for (k = 0; k < 2 * MATCHED_FILTER_LENGTH; k++) {
+		re[k] = k < MATCHED_FILTER_LENGTH ? mf->template[k] : 0.0f;
+		im[k] = 0.0f;
+	}
+	fft_forward(&mf->fft, re, im);
+	for (k = 0; k < 2 * MATCHED_FILTER_LENGTH; k++)
+		im[k] = -im[k];
+
+	memset(mf->window, 0, sizeof(mf->window));
+	mf->hopFill = 0;
+	mf->prev1 = mf->prev2 = 0.0f;
+	mf->candidate = false;
+	mf->refractoryUntil = mf->historyEndFrame;
+	mf->ready = true;
+}
+
+/* Copy a captured click into the template sum.  The first capture is taken
+ * as is; later ones are shifted to best line up with the sum so far, since
+ * the threshold crossing of each click lands at a slightly different point.
+ */
+static void captureClick (matched_filter_t *mf)
+{
+	int k, shift, bestShift = 0;
+	jack_nframes_t start = mf->captureStart;
+
+	if (mf->nLearned > 0) {
+		float bestCorrelation = -INFINITY;
+		for (shift = -MATCHED_FILTER_MAX_ALIGN; shift <= MATCHED_FILTER_MAX_ALIGN; shift++) {
+			float correlation = 0.0f;
+			for (k = 0; k < MATCHED_FILTER_LENGTH; k++)
+				correlation += mf->templateSum[k] * historyAt(mf, start + shift + k);
+			if (correlation > bestCorrelation) {
+				bestCorrelation = correlation;
+				bestShift = shift;
+			}
+		}
+	}
+
+	float energy = 0.0f;
+	for (k = 0; k < MATCHED_FILTER_LENGTH; k++) {
+		float x = historyAt(mf, start + bestShift + k);
+		energy += x * x;
+	}
+
+	if (energy <= 0.0f)
+		return;
+
+	float scale = 1.0f / sqrtf(energy);
+	for (k = 0; k < MATCHED_FILTER_LENGTH; k++) {
+		float x = historyAt(mf, start + bestShift + k) * scale;
+		mf->templateSum[k] = mf->nLearned > 0 ? mf->templateSum[k] + x : x;
+	}
+
+	if (++mf->nLearned >= mf->nLearnClicks)
+		finishTemplate(mf);
+}
+
+static int correlateHop (matched_filter_t *mf, matched_filter_onset_t *onsets, int maxOnsets)
+{
+	int n, nOnsets = 0;
+	float *re = mf->workRe;
+	float *im = mf->workIm;
+	const float *w = mf->window;
+
+	for (n = 0; n < 2 * MATCHED_FILTER_LENGTH; n++) {
+		re[n] = w[n];
+		im[n] = 0.0f;
+	}
+
+	fft_forward(&mf->fft, re, im);
+	for (n = 0; n < 2 * MATCHED_FILTER_LENGTH; n++) {
+		float a = re[n] * mf->templateRe[n] - im[n] * mf->templateIm[n];
+		float b = re[n] * mf->templateIm[n] + im[n] * mf->templateRe[n];
+		re[n] = a;
+		im[n] = b;
+	}
+	fft_inverse(&mf->fft, re, im);
+
+	// re[n] now holds the correlation of the template starting at window[n]
+	double energy = 0.0;
+	for (n = 0; n < MATCHED_FILTER_LENGTH; n++)
+		energy += w[n] * w[n];
+
+	for (n = 0; n < MATCHED_FILTER_LENGTH; n++) {
+		float cur = 0.0f;
+		if (energy > mf->minEnergy * MATCHED_FILTER_LENGTH)
+			cur = re[n] / sqrtf(energy);
+
+		jack_nframes_t alignFrame = mf->windowStartFrame + n;
+
+		if (mf->prev1 > mf->prev2 && mf->prev1 >= cur && mf->prev1 >= mf->matchThreshold) {
+			float denominator = mf->prev2 - 2.0f * mf->prev1 + cur;
+			float delta = denominator < 0.0f ? 0.5f * (mf->prev2 - cur) / denominator : 0.0f;
+			jack_nframes_t peakFrame = alignFrame - 1 + MATCHED_FILTER_PREROLL;
+
+			if ((int32_t) (peakFrame - mf->refractoryUntil) >= 0 && (!mf->candidate || mf->prev1 > mf->candidateOnset.score)) {
+				if (!mf->candidate)
+					mf->candidateDeadline = peakFrame + MATCHED_FILTER_LENGTH / 2;
+				mf->candidate = true;
+				mf->candidateFrame = peakFrame;
+				mf->candidateOnset.frame = (double) peakFrame + delta;
+				mf->candidateOnset.score = mf->prev1;
+				mf->candidateOnset.amplitude = fabsf(mf->prevCorrelation) * mf->templatePeak;
+			}
+		}
+
+		// the strongest peak within half a template of the first one wins
+		if (mf->candidate && (int32_t) (alignFrame + MATCHED_FILTER_PREROLL - mf->candidateDeadline) > 0) {
+			if (nOnsets < maxOnsets)
+				onsets[nOnsets++] = mf->candidateOnset;
+			mf->candidate = false;
+			mf->refractoryUntil = mf->candidateFrame + (jack_nframes_t) ceil(mf->minInterval);
+		}
+
+		mf->prev2 = mf->prev1;
+		mf->prev1 = cur;
+		mf->prevCorrelation = re[n];
+
+		energy += w[n + MATCHED_FILTER_LENGTH] * w[n + MATCHED_FILTER_LENGTH] - w[n] * w[n];
+		if (energy < 0.0)
+			energy = 0.0;
+	}
+
+	return nOnsets;
+}
+
+int matched_filter_process (matched_filter_t *mf, const float *in, jack_nframes_t nframes,
+		jack_nframes_t startFrame, matched_filter_onset_t *onsets, int maxOnsets)
+{
+	jack_nframes_t i;
+	int nOnsets = 0;
+
+	for (i = 0; i < nframes; i++) {
+		jack_nframes_t frame = startFrame + i;
+
+		mf->history[frame & HISTORY_MASK] = in[i];
+
+		if (!mf->ready)
+			continue;
+
+		if (mf->hopFill == 0)
+			mf->windowStartFrame = frame - MATCHED_FILTER_LENGTH;
+
+		mf->window[MATCHED_FILTER_LENGTH + mf->hopFill++] = in[i];
+
+		if (mf->hopFill == MATCHED_FILTER_LENGTH) {
+			nOnsets += correlateHop(mf, onsets + nOnsets, maxOnsets - nOnsets);
+			memcpy(mf->window, mf->window + MATCHED_FILTER_LENGTH, MATCHED_FILTER_LENGTH * sizeof(float));
+			mf->hopFill = 0;
+		}
+	}
+
+	mf->historyEndFrame = startFrame + nframes;
+
+	// wait until the click plus alignment slack is in history before capturing
+	if (mf->capturePending && (int32_t) (mf->historyEndFrame - mf->captureStart)
+			>= MATCHED_FILTER_LENGTH + MATCHED_FILTER_MAX_ALIGN) {
+		mf->capturePending = false;
+		captureClick(mf);
+	}
+
+	return nOnsets;
+}
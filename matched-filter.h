@@ -0,0 +1,84 @@
+/** @file matched-filter.h
+ *
+ * @brief Click detector that learns a template from the first detected clicks
+ * and then locates clicks by normalized cross-correlation.
+ *
+ * The correlation runs as overlap-save FFT convolution in hops of
+ * MATCHED_FILTER_LENGTH frames, so onsets are reported about two hops after
+ * they happen, with sub-sample precision and independent of click amplitude.
+ * Everything is preallocated by matched_filter_init(); the other calls are
+ * realtime safe.
+ */
+
+#ifndef MATCHED_FILTER_H
+#define MATCHED_FILTER_H
+
+#include <stdbool.h>
+#include <jack/jack.h>
+
+#include "fft.h"
+
+#define MATCHED_FILTER_LENGTH 256 // template length in frames (also the hop size)
+#define MATCHED_FILTER_PREROLL 32 // template frames before the threshold crossing
+#define MATCHED_FILTER_HISTORY 4096 // input history kept for capturing clicks (power of two)
+#define MATCHED_FILTER_MAX_ALIGN 16 // max shift when aligning a capture to the template
+
+typedef struct {
+	double frame; // onset time in frames, with sub-sample fraction
+	float amplitude; // estimated peak amplitude of the matched click
+	float score; // normalized correlation of the match, 0 to 1
+} matched_filter_onset_t;
+
+typedef struct {
+	fft_t fft;
+
+	// learning
+	int nLearnClicks; // clicks averaged into the template
+	int nLearned;
+	bool ready; // template complete, correlation running
+	bool capturePending;
+	jack_nframes_t captureStart;
+	float templateSum[MATCHED_FILTER_LENGTH];
+	float template[MATCHED_FILTER_LENGTH]; // unit energy
+	float templatePeak;
+	float *templateRe, *templateIm; // conjugate spectrum of template
+
+	// input history
+	float history[MATCHED_FILTER_HISTORY];
+	jack_nframes_t historyEndFrame; // frame after the newest sample in history
+
+	// overlap-save correlation
+	float window[2 * MATCHED_FILTER_LENGTH]; // previous hop followed by current hop
+	int hopFill;
+	jack_nframes_t windowStartFrame;
+	float *workRe, *workIm;
+
+	// peak picking
+	float prev1, prev2; // last two normalized correlation values
+	float prevCorrelation;
+	bool candidate;
+	matched_filter_onset_t candidateOnset;
+	jack_nframes_t candidateFrame; // whole frame of the candidate's peak
+	jack_nframes_t candidateDeadline;
+	jack_nframes_t refractoryUntil; // frames compared across the wrap of the timeline
+
+	// tunables
+	float matchThreshold; // normalized correlation needed to accept a click
+	float minEnergy; // minimum mean square over the template window
+	double minInterval; // frames between accepted onsets
+} matched_filter_t;
+
+int matched_filter_init (matched_filter_t *mf, int nLearnClicks);
+void matched_filter_free (matched_filter_t *mf);
+
+// forget the template and start learning again
+void matched_filter_reset (matched_filter_t *mf);
+
+// request capture of a click whose threshold crossing happened at crossingFrame
+void matched_filter_learn (matched_filter_t *mf, jack_nframes_t crossingFrame);
+
+// feed one block of input; returns number of onsets written to onsets
+int matched_filter_process (matched_filter_t *mf, const float *in, jack_nframes_t nframes,
+		jack_nframes_t startFrame, matched_filter_onset_t *onsets, int maxOnsets);
+
+#endif
@@ -0,0 +1,215 @@
+/** @file meter.c
+ *
+ * @brief Accent classification and meter inference from per-beat click
+ * level and spectral centroid.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "meter.h"
+
+int meter_init (meter_t *meter, float sampleRate)
+{
+	int i;
+
+	if (fft_init(&meter->fft, METER_CENTROID_LENGTH))
+		return -1;
+
+	meter->sampleRate = sampleRate;
+	meter->re = malloc(METER_CENTROID_LENGTH * sizeof(float));
+	meter->im = malloc(METER_CENTROID_LENGTH * sizeof(float));
+	meter->window = malloc(METER_CENTROID_LENGTH * sizeof(float));
+
+	if (meter->re == NULL || meter->im == NULL || meter->window == NULL) {
+		meter_free(meter);
+		return -1;
+	}
+
+	for (i = 0; i < METER_CENTROID_LENGTH; i++)
+		meter->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / METER_CENTROID_LENGTH);
+
+	meter->minSeparation = 3.0f;
+	meter->minConfidence = 0.8f;
+	meter_reset(meter);
+
+	return 0;
+}
+
+void meter_free (meter_t *meter)
+{
+	fft_free(&meter->fft);
+	free(meter->re);
+	free(meter->im);
+	free(meter->window);
+	meter->re = meter->im = meter->window = NULL;
+}
+
+void meter_reset (meter_t *meter)
+{
+	int i;
+
+	for (i = 0; i < METER_HISTORY; i++)
+		meter->slotBeat[i] = -1;
+
+	meter->lastBeat = -1;
+	meter->accentSeparation = 0.0f;
+	meter->beatsPerBar = 0;
+	meter->downbeat = 0;
+	meter->confidence = 0.0f;
+}
+
+float meter_spectral_centroid (meter_t *meter, const float *x)
+{
+	int i;
+	float weighted = 0.0f, total = 0.0f;
+
+	for (i = 0; i < METER_CENTROID_LENGTH; i++) {
+		meter->re[i] = x[i] * meter->window[i];
+		meter->im[i] = 0.0f;
+	}
+
+	fft_forward(&meter->fft, meter->re, meter->im);
+
+	for (i = 1; i < METER_CENTROID_LENGTH / 2; i++) {
+		float magnitude = sqrtf(meter->re[i] * meter->re[i] + meter->im[i] * meter->im[i]);
+		weighted += magnitude * i;
+		total += magnitude;
+	}
+
+	return total > 0.0f ? weighted / total * meter->sampleRate / METER_CENTROID_LENGTH : 0.0f;
+}
+
+// split scores into two clusters; accented beats are the louder/brighter one
+static void classifyAccents (meter_t *meter)
+{
+	int i, iteration;
+	float low = INFINITY, high = -INFINITY;
+
+	for (i = 0; i < METER_HISTORY; i++) {
+		if (meter->slotBeat[i] < 0)
+			continue;
+		if (meter->score[i] < low)
+			low = meter->score[i];
+		if (meter->score[i] > high)
+			high = meter->score[i];
+	}
+
+	for (iteration = 0; iteration < 8; iteration++) {
+		float lowSum = 0.0f, highSum = 0.0f;
+		int nLow = 0, nHigh = 0;
+
+		for (i = 0; i < METER_HISTORY; i++) {
+			if (meter->slotBeat[i] < 0)
+				continue;
+			if (meter->score[i] - low < high - meter->score[i]) {
+				lowSum += meter->score[i];
+				nLow++;
+			} else {
+				highSum += meter->score[i];
+				nHigh++;
+			}
+		}
+
+		if (nLow == 0 || nHigh == 0)
+			break;
+
+		low = lowSum / nLow;
+		high = highSum / nHigh;
+	}
+
+	meter->accentSeparation = high - low;
+
+	for (i = 0; i < METER_HISTORY; i++)
+		meter->accented[i] = meter->accentSeparation >= meter->minSeparation
+				&& meter->slotBeat[i] >= 0 && meter->score[i] - low >= high - meter->score[i];
+}
+
+/* Try every bar length and phase, and keep the one whose downbeats best
+ * match the accented beats (F-measure).  Ties go to the shorter bar, so a
+ * pattern that repeats every 4 beats isn't reported as 8.
+ */
+static void inferMeter (meter_t *meter)
+{
+	int beatsPerBar, phase, i, nBeats = 0, nAccented = 0;
+	int bestBeatsPerBar = 0, bestPhase = 0;
+	float bestF = 0.0f;
+
+	for (i = 0; i < METER_HISTORY; i++) {
+		if (meter->slotBeat[i] >= 0) {
+			nBeats++;
+			nAccented += meter->accented[i];
+		}
+	}
+
+	if (nAccented == 0 || 2 * nAccented > nBeats)
+		goto done;
+
+	for (beatsPerBar = 2; beatsPerBar <= METER_MAX_BEATS_PER_BAR; beatsPerBar++) {
+		if (nBeats < 2 * beatsPerBar)
+			break;
+
+		for (phase = 0; phase < beatsPerBar; phase++) {
+			int hits = 0, missed = 0, extra = 0;
+
+			for (i = 0; i < METER_HISTORY; i++) {
+				long beat = meter->slotBeat[i];
+				if (beat < 0)
+					continue;
+
+				bool downbeat = (beat - phase) % beatsPerBar == 0;
+				if (downbeat && meter->accented[i])
+					hits++;
+				else if (downbeat)
+					missed++;
+				else if (meter->accented[i])
+					extra++;
+			}
+
+			float f = hits > 0 ? 2.0f * hits / (2.0f * hits + missed + extra) : 0.0f;
+			if (f > bestF) {
+				bestF = f;
+				bestBeatsPerBar = beatsPerBar;
+				bestPhase = phase;
+			}
+		}
+	}
+
+done:
+	meter->confidence = bestF;
+	if (bestF >= meter->minConfidence) {
+		meter->beatsPerBar = bestBeatsPerBar;
+		meter->downbeat = bestPhase;
+	} else {
+		meter->beatsPerBar = 0;
+	}
+}
+
+void meter_beat (meter_t *meter, long beatNumber, float peak, float centroid)
+{
+	int slot = beatNumber % METER_HISTORY;
+	float level_dB = 20.0f * log10f(peak > 1e-6f ? peak : 1e-6f);
+	float pitch = centroid > 0.0f ? 12.0f * log2f(centroid / 1000.0f) : 0.0f;
+
+	meter->score[slot] = level_dB + pitch;
+	meter->slotBeat[slot] = beatNumber;
+	meter->lastBeat = beatNumber;
+
+	classifyAccents(meter);
+	inferMeter(meter);
+}
+
+bool meter_is_accented (const meter_t *meter, long beatNumber)
+{
+	int slot = beatNumber % METER_HISTORY;
+	return meter->slotBeat[slot] == beatNumber && meter->accented[slot];
+}
+
+int meter_bar_position (const meter_t *meter, long beatNumber)
+{
+	if (meter->beatsPerBar == 0)
+		return -1;
+
+	long position = (beatNumber - meter->downbeat) % meter->beatsPerBar;
+	return position < 0 ? position + meter->beatsPerBar : position;
+}
@@ -0,0 +1,59 @@
+/** @file meter.h
+ *
+ * @brief Accent classification and meter inference from per-beat click
+ * level and spectral centroid.
+ *
+ * Every beat is scored by its peak level in dB plus its spectral centroid in
+ * semitones, split into accented and plain beats by two-means clustering,
+ * and the accent pattern is matched against bars of 2 to
+ * METER_MAX_BEATS_PER_BAR beats.  Work per beat is bounded by
+ * METER_HISTORY, so meter_beat() can be called from process().
+ */
+
+#ifndef METER_H
+#define METER_H
+
+#include <stdbool.h>
+
+#include "fft.h"
+
+#define METER_HISTORY 48 // beats remembered for classification
+#define METER_MAX_BEATS_PER_BAR 12
+#define METER_CENTROID_LENGTH 256 // frames analyzed for the spectral centroid
+
+typedef struct {
+	float score[METER_HISTORY]; // level dB + centroid semitones
+	long slotBeat[METER_HISTORY]; // beat number held by each slot, -1 if empty
+	bool accented[METER_HISTORY];
+	long lastBeat;
+
+	float accentSeparation; // distance between the two clusters
+	float minSeparation; // needed before any beat counts as accented
+
+	// inferred meter, beatsPerBar is 0 until a pattern fits well enough
+	int beatsPerBar;
+	long downbeat; // beat number of some downbeat
+	float confidence; // F-measure of the accent pattern, 0 to 1
+	float minConfidence;
+
+	fft_t fft;
+	float sampleRate;
+	float *re, *im, *window;
+} meter_t;
+
+int meter_init (meter_t *meter, float sampleRate);
+void meter_free (meter_t *meter);
+void meter_reset (meter_t *meter);
+
+// spectral centroid in Hz of METER_CENTROID_LENGTH frames starting at x
+float meter_spectral_centroid (meter_t *meter, const float *x);
+
+// add a beat; centroid may be 0 when not measured
+void meter_beat (meter_t *meter, long beatNumber, float peak, float centroid);
+
+bool meter_is_accented (const meter_t *meter, long beatNumber);
+
+// position of beatNumber within its bar (0 is the downbeat), or -1 if unknown
+int meter_bar_position (const meter_t *meter, long beatNumber);
+
+#endif
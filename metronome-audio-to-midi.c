@@ -13,20 +13,53 @@
 #include <string.h>
 #include <curses.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include <jack/jack.h>
 #include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+
+#include "matched-filter.h"
+#include "adaptive-threshold.h"
+#include "calibration.h"
+#include "meter.h"
+#include "tempo-tracker.h"
+#include "tempo-agents.h"
+#include "clock-schedule.h"
+#include "snapshot.h"
+#include "frames.h"
+#include "click-synth.h"
+#include "loopback.h"
+#include "clock-alignment.h"
+#include "clock-follower.h"
+#include "warm-start.h"
+#include "music-tracker.h"
+#ifdef HAVE_ALSA
+#include "alsa-seq.h"
+#endif
+#include "offline-analysis.h"
+#include "audio-backend.h"
 
 jack_port_t *input_audio_port;
 jack_port_t *output_audio_port;
 jack_port_t *output_midi_port;
-jack_client_t *client;
+jack_port_t *input_midi_port;
+jack_client_t *client; // NULL with the other backends
+
+// the audio comes through JACK unless another backend is asked for
+audio_backend_t backend;
+const char *backendSpec = "jack";
 
 int maxRows, maxCols; // screen dimensions
 
+jack_nframes_t sample_rate;
+
 #define linear_from_dB(dB) powf(10.0f, 0.05f * (dB))
 #define dB_from_linear(linear) (20.0f * log10f(linear))
 
+// detection settings, written by the analysis thread only (see setThresholds())
 float risingThreshold_dB;
 float risingThreshold;
 
@@ -41,23 +74,1497 @@ int nDetectedBeats = 0;
 
 float beatMaxAmplitude = 0.0f;
 
-jack_nframes_t currBeatStart = 0;
+// beat onsets in frames; fractional when located by the matched filter
+double currBeatStart = 0.0;
 jack_nframes_t currBeatEnd = 0;
 
-jack_nframes_t lastBeatStart = 0;
+double lastBeatStart = 0.0;
 jack_nframes_t lastBeatEnd = 0;
 
 jack_nframes_t earliestNextBeatStart = 0;
 
-jack_nframes_t framesPerClockTick = 0;
-jack_nframes_t nextClockTick = 0;
+// lookahead: threshold onsets wait for the rest of the attack, so they can be
+// placed where the click reaches a fixed fraction of its peak instead of
+// where it happens to cross the rising threshold, which moves with the click
+// level.  The monitor output is delayed to match, and the delay is reported
+// to JACK as latency.  process() owns the setting and passes the analysis
+// thread its own copy.
+#define LOOKAHEAD_MAX_MS 10.0f
+#define ONSET_PEAK_FRACTION 0.25f
+
+float lookahead_ms = 0.0f; // 0 for none
+jack_nframes_t lookahead_frames = 0; // analysis thread's copy
+bool refinePending = false; // the pending onset is a threshold crossing
+
+float *monitorDelay; // input of the previous cycles, allocated for LOOKAHEAD_MAX_MS
+jack_nframes_t monitorDelayMask;
+jack_nframes_t monitorDelayWrite = 0;
+jack_nframes_t monitorDelay_frames = 0; // process()'s copy of the lookahead
+atomic_uint monitorLatency_frames; // for the latency callback, see monitorLatency()
+
+// what the audio output plays: views of the (delayed) input to check the
+// detection against, or the beats of the outgoing clock, as impulses or as
+// resynthesized clicks to hear the clock against the source.  Nothing is
+// written while the output isn't connected.
+typedef enum {
+	MONITOR_RECTIFIED,
+	MONITOR_ENVELOPE,
+	MONITOR_GATE,
+	MONITOR_IMPULSE,
+	MONITOR_CLICK,
+	MONITOR_OFF,
+	N_MONITOR_MODES
+} monitor_mode_t;
+
+static const char *monitorModeNames[N_MONITOR_MODES] = {
+	"rectified input",
+	"smoothed envelope",
+	"threshold gate",
+	"beat impulses",
+	"resynthesized click",
+	"off"
+};
+
+#define ENVELOPE_ATTACK_MS 1.0f
+#define ENVELOPE_RELEASE_MS 50.0f
+#define MAX_MONITOR_BEATS 4 // per cycle
+
+typedef struct {
+	jack_nframes_t offset; // in the cycle
+	double frame; // when the beat was due
+	bool downbeat;
+} monitor_beat_t;
+
+monitor_mode_t monitorMode = MONITOR_RECTIFIED;
+click_synth_t clickSynth;
+
+// beats of ticks given to the sequencer early, waiting for the cycle they are due in
+monitor_beat_t dueBeats[MAX_MONITOR_BEATS];
+int nDueBeats = 0;
+
+// monitor state of process()
+float envelopeAttack, envelopeRelease; // one pole coefficients
+float envelope = 0.0f;
+bool gateOpen = false;
+jack_nframes_t gateEarliestOpen = 0;
+
+// everything but sending the clock runs in an analysis thread: process()
+// passes it the input through a ring buffer, and sends ticks from the
+// schedule it publishes, rephased at every onset (which may be a
+// subdivision of the beat).  While JACK freewheels, cycles come as fast as
+// they are done and there is no deadline to keep, so process() analyzes
+// each block itself before returning.
+#define ANALYSIS_BUFFER_S 1.0 // audio buffered between process() and the analysis thread
+#define ANALYSIS_CHUNK 1024 // frames analyzed at a time
+
+typedef struct {
+	jack_nframes_t startFrame;
+	jack_nframes_t nframes;
+} block_header_t;
+
+jack_ringbuffer_t *analysisRing;
+atomic_long analysisOverruns; // blocks dropped because the analysis fell behind
+pthread_t analysisThread;
+pthread_mutex_t analysisLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t analysisReady = PTHREAD_COND_INITIALIZER;
+atomic_bool freewheeling;
+
+// clock returned from downstream gear: process() timestamps its ticks, the
+// analysis thread compares them with the beats
+#define RETURN_TICKS 1024 // buffered between process() and the analysis thread
+
+jack_ringbuffer_t *returnTicks; // frames of received ticks
+clock_alignment_t clockAlignment;
+FILE *alignmentLog = NULL;
+
+// reverse mode: clicks from a MIDI clock received on the return port, for
+// in-ear monitors driven by a sequencer; they take over the audio output
+#define REVERSE_BEATS_PER_BAR 4 // for the accents, counted from Start
+
+bool reverseMode = false;
+clock_follower_t clockFollower; // fed by process() in either mode
+long reverseClickTick = -1; // tick of the next beat to click, -1 to find it again
+
+// ticks can go out through the ALSA sequencer instead of the JACK MIDI port:
+// process() takes them a period and a margin early and passes them with
+// their exact times to a sender thread, which queues them on the sequencer
+// to go out when due
+#define SEQ_EVENTS 1024 // buffered between process() and the sender thread
+#define SEQ_MARGIN_MS 2.0f // on top of a period, for the sender to queue ticks in time
+
+typedef struct {
+	double frame; // when due
+	unsigned char message[3];
+	int size;
+} seq_event_t;
+
+bool seqOutput = false;
+const char *seqDestination = NULL; // connected at startup if given
+jack_ringbuffer_t *seqRing;
+atomic_long seqOverruns; // events dropped because the sender fell behind
+pthread_t seqThread;
+pthread_mutex_t seqLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t seqReady = PTHREAD_COND_INITIALIZER;
+#ifdef HAVE_ALSA
+alsa_seq_t alsaSeq;
+#endif
+
+clock_schedule_t schedule; // analysis thread's copy, published whenever it changes
+schedule_buffer_t scheduleBuffer;
+
+// ticks go out this much ahead of the schedule, to make up for the round
+// trip latency that onsets arrive late by and ticks leave late by; measured
+// through a loopback on request
+float clockLead_ms = 0.0f;
+double clockLead_frames = 0.0;
+loopback_t loopback;
+
+// clock state of process(); ticks owed after the schedule moves forward
+// catch up at no more than 1 / CATCH_UP_SPACING times the tempo, so slaves
+// see a short rush rather than a burst
+#define CATCH_UP_SPACING 0.5 // of a tick interval, the least between ticks sent
+
+long clockEpoch = -1; // epoch of the schedule being followed
+bool clockRunning = false; // nextTick is valid
+long nextTick = 0;
+double lastTickTime = -INFINITY; // frame the last tick went out at
+double clockNudge_frames = 0.0; // operator's correction, positive sends the clock earlier
+
+// operator commands, timestamped on the JACK frame timeline when the key is
+// pressed and passed to process() through a ring buffer, the only way the
+// UI acts on realtime or analysis state.  process() takes a few at the start
+// of each cycle and passes those about detection and tracking on to the
+// analysis thread through another ring buffer; taps count as onsets there.
+// Setting changes come as deltas, each thread clamps the settings it owns.
+#define COMMANDS 64 // queued between the UI and process()
+#define ANALYSIS_COMMANDS 64 // queued between process() and the analysis thread
+#define MAX_COMMANDS_PER_CYCLE 4 // the rest wait for the next cycle
+#define TAPS 64 // waiting for the analysis to reach them
+#define NUDGE_MS 2.0f // clock moved per nudge
+
+typedef enum {
+	COMMAND_TAP, // analysis
+	COMMAND_RESET_TRACKER, // analysis: forget the tempo and start over
+	COMMAND_FREEZE_TEMPO, // analysis: toggle holding the tempo, onsets only rephase
+	COMMAND_NUDGE_FORWARD,
+	COMMAND_NUDGE_BACK,
+	COMMAND_RESYNC, // realign the slaves to the bar at the next downbeat
+	COMMAND_START_STOP, // stop now, or start at the next downbeat
+	COMMAND_SONG_POSITION, // send the song position at the next sixteenth
+	COMMAND_RISING_THRESHOLD, // analysis: change by value dB
+	COMMAND_FALLING_THRESHOLD, // analysis: change by value dB
+	COMMAND_LOW_MIN_TIME, // analysis: change by value ms
+	COMMAND_MATCH_THRESHOLD, // analysis: change by value
+	COMMAND_PREFERRED_TEMPO, // analysis: change by value BPM
+	COMMAND_SUBDIVISION, // analysis: change by value clicks per beat
+	COMMAND_MATCHED_FILTER, // analysis: toggle matched filter detection
+	COMMAND_ADAPTIVE_THRESHOLDS, // analysis: toggle
+	COMMAND_RAMP_TRACKING, // analysis: toggle
+	COMMAND_MUSIC_ENGINE, // analysis: toggle
+	COMMAND_HYPOTHESES, // analysis: toggle filtering onsets by hypothesis
+	COMMAND_CALIBRATE, // analysis: record and analyze the input again for the thresholds
+	COMMAND_LOOKAHEAD, // change by value ms; the analysis thread gets the result in frames
+	COMMAND_CLOCK_LEAD, // change by value ms
+	COMMAND_MONITOR_MODE, // cycle what the audio output plays
+	COMMAND_REVERSE, // toggle clicks from the returned clock
+	COMMAND_AUTO_START, // toggle starting slaves on the first downbeat
+	COMMAND_LOOPBACK // measure the round trip latency
+} command_type_t;
+
+typedef struct {
+	command_type_t type;
+	jack_nframes_t frame; // when the key was pressed
+	float value; // of a setting change
+} command_t;
+
+jack_ringbuffer_t *commandRing;
+jack_ringbuffer_t *analysisCommandRing;
+
+// taps waiting for the analysis to reach them
+jack_nframes_t pendingTaps[TAPS];
+int nPendingTaps = 0;
+bool tapPending = false; // the pending onset is a tap
+
+// tempo held by the operator, in ticks per frame
+bool tempoFrozen = false;
+double frozenTickRate;
+
+tempo_tracker_t tempoTracker;
+float subdivisionSetting = 0.0f; // onsets per beat, 0 to detect
+
+// competing tempo/phase hypotheses; when enabled, onsets off the best
+// hypothesis' grid and the tracker's prediction are dropped before they
+// reach the tempo tracker
+tempo_agents_t tempoAgents;
+long droppedOnsets = 0; // that hypothesis mode drops, or would drop while off
+bool hypothesisMode = false;
+
+// music engine: beats of a drum or band feed found by a worker thread, in
+// place of click onsets
+music_tracker_t musicTracker;
+bool musicMode = false;
+
+// matched filter detection: learn a click template from the first threshold
+// crossings, then take onsets from cross-correlation instead
+#define TEMPLATE_CLICKS 8
+#define MAX_ONSETS_PER_CYCLE 16
+
+matched_filter_t matchedFilter;
+bool matchedFilterMode = false;
+float lastMatchScore = 0.0f;
+
+// adaptive thresholds: follow the noise floor and click level instead of
+// using the hand tuned rising/falling thresholds
+adaptive_threshold_t adaptiveThreshold;
+bool adaptiveThresholdMode = false;
+
+// calibration pass run at startup (and on request) to pick the thresholds;
+// the clock is only sent once the startup pass is over
+#define CALIBRATION_SECONDS 4.0f
+
+calibration_t calibration;
+bool calibrationHold = false;
+
+// onsets are analyzed once the click has played out: peak level for the
+// tempo tracker, and level plus spectral centroid for accents and meter
+#define CLICK_HISTORY 4096 // power of two
+
+float clickHistory[CLICK_HISTORY];
+bool onsetPending = false;
+double pendingOnset;
+
+meter_t meter;
+long lastDownbeat = 0;
+int lastBeatsPerBar = 0;
+
+// transport: start slaves on a downbeat, and realign them to the bar with a
+// song position pointer when the downbeat moves
+bool autoStart = true;
+bool transportRunning = false;
+long realignsDone = 0; // schedule realign requests already acted on
+
+// operator transport requests, acted on by process()
+bool transportHeld = false; // stopped by the operator, not started automatically
+bool startRequested = false;
+bool resyncRequested = false;
+bool positionRequested = false;
+long songPositionTicks = 0; // clock ticks since start
+
+// settings and tempo kept in the file given with --state, so a restart
+// mid-show skips calibration and sends the clock from the first click.  Only
+// on request: a saved state stands in for calibrating to the room and the
+// click at hand.
+char *statePath = NULL; // NULL if not kept
+warm_start_t warmStart;
+bool stateLoaded = false;
+warm_state_t loadedState;
+bool warmStarted = false; // the tracker was seeded with the saved tempo, the clock needn't wait for beats
+
+// startup trace: how long each step of getting the clock out takes, printed
+// on exit with --startup-trace
+#define MAX_TRACE_STEPS 16
+
+// connections connectPorts could not make
+enum { MISSED_INPUT = 1, MISSED_MIDI_OUTPUT = 2, MISSED_AUDIO_OUTPUT = 4 };
+
+typedef struct {
+	const char *step;
+	double start_ms, end_ms; // since launch
+} trace_step_t;
+
+bool startupTrace = false;
+struct timespec launchTime;
+trace_step_t traceSteps[MAX_TRACE_STEPS];
+atomic_int nTraceSteps;
+pthread_t connectionThread;
+atomic_bool connectionFailed; // the main loop exits, and prints why once the terminal is restored
+const char *connectionError;
+atomic_int missedConnections; // MISSED_* bits of the connections connectPorts could not make, shown on the UI
+atomic_bool firstTickSent; // set by process() along with firstTickFrame
+jack_nframes_t firstTickFrame;
+
+// what the UI shows and saves: the analysis thread publishes its status
+// after every block and process() its own every cycle, and the UI reads the
+// latest of each (see snapshot.h) instead of state changing under it
+typedef struct {
+	// settings
+	float risingThreshold_dB, fallingThreshold_dB, lowMinTime_ms;
+	float matchThreshold;
+	float preferredTempo_bpm;
+	float subdivisionSetting;
+	bool matchedFilterMode, adaptiveThresholdMode, rampTracking, hypothesisMode, musicMode;
+
+	// detection
+	bool detectedBeat;
+	float risingThreshold, fallingThreshold;
+	double currBeatStart, lastBeatStart;
+	jack_nframes_t lowMinTime_frames, earliestNextBeatStart;
+	int nDetectedBeats;
+	bool templateReady;
+	int nLearned;
+	float lastMatchScore;
+	float noiseFloor_dB, clickPeak_dB; // of the adaptive thresholds
+	jack_nframes_t calibrationFilled;
+
+	// tracking
+	int barPosition, beatsPerBar; // -1 and 0 while the meter is unknown
+	float meterConfidence, accentSeparation;
+	double tempo_bpm; // 0 until the tempo is known
+	int subdivision;
+	double ramp_bpm_per_beat;
+	bool tempoFrozen;
+	double frozen_bpm;
+	int nAgents, bestAgent; // bestAgent -1 if none
+	float bestAgent_bpm, bestAgentScore;
+	long rejectedOnsets;
+	float musicTempo_bpm;
+	long musicBeats;
+
+	// returned clock
+	bool returnReceiving;
+	int nOffsets;
+	float phase_ms, jitter_ms, drift_ms_per_min;
+} analysis_status_t;
+
+typedef struct {
+	float lookahead_ms;
+	jack_nframes_t lookahead_frames;
+	float clockLead_ms;
+	double clockNudge_ms;
+	monitor_mode_t monitorMode;
+	bool reverseMode;
+	bool autoStart, transportRunning, startRequested, transportHeld;
+	long songPositionTicks;
+	bool followerLocked, followerRunning;
+	double follower_bpm;
+} cycle_status_t;
+
+snapshot_buffer_t analysisStatus;
+snapshot_buffer_t cycleStatus;
 
 #define ms_to_frames(x) (((float) (sample_rate)) * ((float) (x)) / 1000.0f)
 
+/*
+ * Called from the analysis for every detected onset, whichever detector found
+ * it.  The onset is analyzed once METER_CENTROID_LENGTH frames of it are in
+ * the click history (see onsetAnalysis()).
+ */
+static void beatOnset (double onsetFrame)
+{
+	onsetPending = true;
+	refinePending = false;
+	tapPending = false;
+	pendingOnset = onsetFrame;
+}
+
+/*
+ * Move a threshold crossing to where the click first reaches
+ * ONSET_PEAK_FRACTION of its peak within the lookahead, interpolated between
+ * samples.  Quiet clicks reach that level before crossing the rising
+ * threshold, so the search starts as far before the crossing as the
+ * lookahead reaches after it.
+ */
+static double refineOnset (jack_nframes_t crossing)
+{
+	float peak = 0.0f;
+
+	for (jack_nframes_t k = 0; k <= lookahead_frames; k++)
+		if (fabsf(clickHistory[(crossing + k) & (CLICK_HISTORY - 1)]) > peak)
+			peak = fabsf(clickHistory[(crossing + k) & (CLICK_HISTORY - 1)]);
+
+	float level = ONSET_PEAK_FRACTION * peak;
+	if (level < fallingThreshold)
+		level = fallingThreshold;
+
+	jack_nframes_t frame = crossing - lookahead_frames;
+	float previous = fabsf(clickHistory[(frame - 1) & (CLICK_HISTORY - 1)]);
+
+	for (; frame != crossing + lookahead_frames; frame++) {
+		float x = fabsf(clickHistory[frame & (CLICK_HISTORY - 1)]);
+
+		if (x >= level)
+			return previous < level ? frame - (x - level) / (x - previous) : frame;
+
+		previous = x;
+	}
+
+	return crossing;
+}
+
+// a new epoch stops the clock until the tempo is known again
+static void resetBeatTracking (void)
+{
+	nDetectedBeats = 0;
+	onsetPending = false;
+	warmStarted = false;
+	tempo_tracker_reset(&tempoTracker);
+	tempo_agents_reset(&tempoAgents);
+	droppedOnsets = 0;
+	meter_reset(&meter);
+
+	schedule.epoch++;
+	schedule.valid = false;
+	schedule.emit = false;
+	schedule.beatsPerBar = 0;
+	schedule_publish(&scheduleBuffer, &schedule);
+}
+
+static void meterBeat (float peak, const float *click)
+{
+	meter_beat(&meter, nDetectedBeats - 1, peak, meter_spectral_centroid(&meter, click));
+
+	// process() ignores requests made while the transport is stopped
+	if (meter.beatsPerBar > 0 && (meter.beatsPerBar != lastBeatsPerBar
+			|| (meter.downbeat - lastDownbeat) % meter.beatsPerBar != 0))
+		schedule.realignRequests++;
+
+	lastBeatsPerBar = meter.beatsPerBar;
+	lastDownbeat = meter.downbeat;
+	schedule.beatsPerBar = meter.beatsPerBar;
+	schedule.downbeat = meter.downbeat;
+}
+
+/*
+ * Feed a played out onset to the tempo tracker and publish a clock schedule
+ * rephased from it.  Onsets usually arrive a little after the fact (they
+ * wait for the click to play out, the matched filter reports them about two
+ * hops late, and the analysis thread runs behind process()), so the
+ * schedule is anchored at the onset time rather than at the current frame.
+ * Ticks are numbered from the start of tracking, so every beat gets exactly
+ * 24 ticks: process() doesn't repeat ticks it already sent for the new beat,
+ * and catches up on ticks still owed for the previous one.
+ */
+static void onsetAnalysis (void)
+{
+	float click[METER_CENTROID_LENGTH];
+	float peak = 0.0f;
+	jack_nframes_t start = frame_wrap(pendingOnset);
+	bool tap = tapPending;
+
+	onsetPending = false;
+
+	if (refinePending) {
+		pendingOnset = refineOnset(start);
+		start = pendingOnset;
+	}
+
+	for (int k = 0; k < METER_CENTROID_LENGTH; k++) {
+		click[k] = clickHistory[(start + k) & (CLICK_HISTORY - 1)];
+		if (fabsf(click[k]) > peak)
+			peak = fabsf(click[k]);
+	}
+
+	// a tap has no click to measure, it counts as loud as the last one
+	if (tap)
+		peak = beatMaxAmplitude;
+
+	/* The agents always run, so switching hypothesis mode on needs no warm
+	 * up.  Their grids lag behind a tempo ramp, so onsets on the tracker's
+	 * own prediction are kept whatever the agents make of them. */
+	if (!tempo_agents_onset(&tempoAgents, pendingOnset, peak)
+			&& !tempo_tracker_predicts(&tempoTracker, pendingOnset, tempoAgents.innerWindow)) {
+		droppedOnsets++;
+		if (hypothesisMode)
+			return;
+	}
+
+	long previousGrid = tempoTracker.grid;
+	bool isBeat = tempo_tracker_onset(&tempoTracker, pendingOnset, peak);
+	int subdivision = tempoTracker.subdivision;
+
+	if (tempoTracker.pulsePeriod <= 0.0) {
+		// first onset, nothing to time the clock with yet
+		nDetectedBeats++;
+		currBeatStart = pendingOnset;
+		return;
+	}
+
+	// a seeded tracker has the tempo at the first onset, which is taken for the first beat
+	if (nDetectedBeats == 0) {
+		nDetectedBeats = 1;
+		currBeatStart = pendingOnset;
+	}
+
+	// count the beats passed since the previous onset, including any missed ones
+	for (long g = previousGrid + 1; g <= tempoTracker.grid; g++)
+		if ((g - tempoTracker.pulsePhase) % subdivision == 0)
+			nDetectedBeats++;
+
+	long step = ((tempoTracker.grid - tempoTracker.pulsePhase) % subdivision + subdivision) % subdivision;
+
+	schedule.ticksPerStep = 24 / subdivision;
+	schedule.anchorFrame = pendingOnset;
+	schedule.anchorTick = 24L * (nDetectedBeats - 1) + step * schedule.ticksPerStep;
+	schedule.ramp = tempoTracker.ramp;
+
+	// a frozen tempo keeps its rate whatever the subdivision, onsets only rephase the clock
+	if (tempoFrozen) {
+		schedule.ramp.linear = frozenTickRate / schedule.ticksPerStep;
+		schedule.ramp.quadratic = 0.0;
+		schedule.ramp.cubic = 0.0;
+	}
+	schedule.emit = (nDetectedBeats > 4 || warmStarted) && !calibrationHold;
+
+	if (!schedule.valid) {
+		schedule.firstTick = schedule.anchorTick + 1;
+		schedule.valid = true;
+	}
+
+	if (isBeat) {
+		lastBeatStart = currBeatStart;
+		currBeatStart = pendingOnset;
+
+		// nor an accent, or a time the returned clock should match
+		if (!tap) {
+			meterBeat(peak, click);
+			clock_alignment_beat(&clockAlignment, pendingOnset);
+		}
+	}
+
+	schedule_publish(&scheduleBuffer, &schedule);
+}
+
+/*
+ * Status byte alone when data is negative, otherwise status plus 14 bit data.
+ * The JACK port takes it at offset into the cycle, the sequencer at the
+ * (fractional) frame it is due.
+ */
+static void writeMidi (void *midi_out_buffer, jack_nframes_t offset, double frame, unsigned char status, int data)
+{
+	unsigned char message[3] = { status, data & 0x7F, (data >> 7) & 0x7F };
+	int size = data < 0 ? 1 : 3;
+
+	if (!seqOutput) {
+		if (midi_out_buffer != NULL)
+			jack_midi_event_write(midi_out_buffer, offset, message, size);
+		return;
+	}
+
+	seq_event_t event = { frame, { message[0], message[1], message[2] }, size };
+
+	if (jack_ringbuffer_write_space(seqRing) >= sizeof(event))
+		jack_ringbuffer_write(seqRing, (const char *) &event, sizeof(event));
+	else
+		atomic_fetch_add(&seqOverruns, 1);
+}
+
+/*
+ * Send one clock tick, preceded by Start when it is the first downbeat after
+ * the meter is known (or after the operator asked for a start), by
+ * Stop/Song Position/Continue when the downbeat has moved since the slaves
+ * were started (or the operator asked for a resync), or by the song position
+ * on its own on the operator's request.
+ */
+static void emitClockTick (void *midi_out_buffer, jack_nframes_t offset, double frame, const clock_schedule_t *s)
+{
+	bool onDownbeat = (nextTick % 24 == 0) && clock_schedule_bar_position(s, nextTick / 24) == 0;
+
+	if (onDownbeat && !transportRunning && !transportHeld && (autoStart || startRequested)) {
+		writeMidi(midi_out_buffer, offset, frame, 0xFA, -1);
+		transportRunning = true;
+		startRequested = false;
+		resyncRequested = false;
+		songPositionTicks = 0;
+		realignsDone = s->realignRequests;
+	}
+	else if (onDownbeat && transportRunning && (realignsDone != s->realignRequests || resyncRequested)) {
+		long ticksPerBar = 24 * s->beatsPerBar;
+		songPositionTicks = (songPositionTicks + ticksPerBar - 1) / ticksPerBar * ticksPerBar;
+
+		// song position pointer counts sixteenth notes, 6 ticks each
+		writeMidi(midi_out_buffer, offset, frame, 0xFC, -1);
+		writeMidi(midi_out_buffer, offset, frame, 0xF2, (songPositionTicks / 6) & 0x3FFF);
+		writeMidi(midi_out_buffer, offset, frame, 0xFB, -1);
+		realignsDone = s->realignRequests;
+		resyncRequested = false;
+		positionRequested = false;
+	}
+	else if (positionRequested && (!transportRunning || songPositionTicks % 6 == 0)) {
+		// a running slave only takes a new position while stopped
+		if (transportRunning)
+			writeMidi(midi_out_buffer, offset, frame, 0xFC, -1);
+		writeMidi(midi_out_buffer, offset, frame, 0xF2, (songPositionTicks / 6) & 0x3FFF);
+		if (transportRunning)
+			writeMidi(midi_out_buffer, offset, frame, 0xFB, -1);
+		positionRequested = false;
+	}
+
+	writeMidi(midi_out_buffer, offset, frame, 0xF8, -1);
+
+	if (transportRunning)
+		songPositionTicks++;
+}
+
+/*
+ * Set the detection thresholds and minimum low time, and what follows from
+ * them.  Calibration, adaptive mode and the operator all set them through
+ * here, in the analysis thread (or before it starts).
+ */
+static void setThresholds (float rising_dB, float falling_dB, float lowMin_ms)
+{
+	if (rising_dB > 0.0f)
+		rising_dB = 0.0f;
+
+	if (falling_dB < -100.0f)
+		falling_dB = -100.0f;
+
+	if (falling_dB > rising_dB)
+		falling_dB = rising_dB;
+
+	if (lowMin_ms < 0.0f)
+		lowMin_ms = 0.0f;
+
+	risingThreshold_dB = rising_dB;
+	fallingThreshold_dB = falling_dB;
+	lowMinTime_ms = lowMin_ms;
+
+	risingThreshold = linear_from_dB(risingThreshold_dB);
+	fallingThreshold = linear_from_dB(fallingThreshold_dB);
+	lowMinTime_frames = ms_to_frames(lowMinTime_ms);
+
+	matchedFilter.minEnergy = fallingThreshold * fallingThreshold;
+	matchedFilter.minInterval = lowMinTime_frames > MATCHED_FILTER_LENGTH ? lowMinTime_frames : MATCHED_FILTER_LENGTH;
+}
+
+/*
+ * Whether frame is no later than earliest, a hold-off of at most the minimum
+ * low time.  One further ahead was set before the frame count wrapped, or
+ * before a silence of half its span, and has long passed.
+ */
+static bool heldOff (jack_nframes_t frame, jack_nframes_t earliest)
+{
+	return earliest - frame <= lowMinTime_frames;
+}
+
+/*
+ * Publish what the UI shows of the analysis, as of frame now; in the
+ * analysis thread (or before it starts).
+ */
+static void publishAnalysisStatus (jack_nframes_t now)
+{
+	analysis_status_t status;
+
+	status.risingThreshold_dB = risingThreshold_dB;
+	status.fallingThreshold_dB = fallingThreshold_dB;
+	status.lowMinTime_ms = lowMinTime_ms;
+	status.matchThreshold = matchedFilter.matchThreshold;
+	status.preferredTempo_bpm = tempoTracker.preferredTempo_bpm;
+	status.subdivisionSetting = subdivisionSetting;
+	status.matchedFilterMode = matchedFilterMode;
+	status.adaptiveThresholdMode = adaptiveThresholdMode;
+	status.rampTracking = tempoTracker.rampTracking;
+	status.hypothesisMode = hypothesisMode;
+	status.musicMode = musicMode;
+
+	status.detectedBeat = detectedBeat;
+	status.risingThreshold = risingThreshold;
+	status.fallingThreshold = fallingThreshold;
+	status.currBeatStart = currBeatStart;
+	status.lastBeatStart = lastBeatStart;
+	status.lowMinTime_frames = lowMinTime_frames;
+	status.earliestNextBeatStart = earliestNextBeatStart;
+	status.nDetectedBeats = nDetectedBeats;
+	status.templateReady = matchedFilter.ready;
+	status.nLearned = matchedFilter.nLearned;
+	status.lastMatchScore = lastMatchScore;
+	status.noiseFloor_dB = adaptiveThreshold.noiseFloor_dB.value;
+	status.clickPeak_dB = adaptiveThreshold.clickPeak_dB.value;
+	status.calibrationFilled = calibration.filled;
+
+	status.barPosition = meter_bar_position(&meter, nDetectedBeats - 1);
+	status.beatsPerBar = meter.beatsPerBar;
+	status.meterConfidence = meter.confidence;
+	status.accentSeparation = meter.accentSeparation;
+
+	status.tempo_bpm = 0.0;
+	status.ramp_bpm_per_beat = 0.0;
+	if (tempoTracker.pulsePeriod > 0.0) {
+		// tempo change per beat from the change in period per step
+		status.tempo_bpm = 60.0 * sample_rate / tempoTracker.pulsePeriod;
+		status.ramp_bpm_per_beat = -status.tempo_bpm * tempoTracker.periodSlope * tempoTracker.subdivision / tempoTracker.onsetPeriod;
+	}
+	status.subdivision = tempoTracker.subdivision;
+	status.tempoFrozen = tempoFrozen;
+	status.frozen_bpm = 60.0 * sample_rate * frozenTickRate / 24.0;
+
+	status.nAgents = tempoAgents.nAgents;
+	status.bestAgent = tempoAgents.best;
+	status.bestAgent_bpm = 0.0f;
+	status.bestAgentScore = 0.0f;
+	if (tempoAgents.best >= 0) {
+		status.bestAgent_bpm = tempo_agents_best_bpm(&tempoAgents);
+		status.bestAgentScore = tempoAgents.score[tempoAgents.best];
+	}
+	status.rejectedOnsets = droppedOnsets;
+	status.musicTempo_bpm = music_tracker_tempo(&musicTracker);
+	status.musicBeats = atomic_load(&musicTracker.nBeats);
+
+	status.returnReceiving = clock_alignment_receiving(&clockAlignment, now);
+	status.nOffsets = clockAlignment.nOffsets;
+	status.phase_ms = clockAlignment.phase_ms;
+	status.jitter_ms = clockAlignment.jitter_ms;
+	status.drift_ms_per_min = clockAlignment.drift_ms_per_min;
+
+	snapshot_publish(&analysisStatus, &status);
+}
+
+/*
+ * Detection and tracking of one chunk of input, in the analysis thread.
+ */
+static void analyzeBlock (const float *in, jack_nframes_t nframes, jack_nframes_t startFrame)
+{
+	int i;
+	float blockPeak = 0.0f;
+
+	jack_nframes_t tickFrame;
+	while (jack_ringbuffer_read(returnTicks, (char *) &tickFrame, sizeof(tickFrame)) == sizeof(tickFrame))
+		clock_alignment_tick(&clockAlignment, tickFrame);
+
+	command_t command;
+	while (jack_ringbuffer_read(analysisCommandRing, (char *) &command, sizeof(command)) == sizeof(command)) {
+		switch (command.type) {
+			case COMMAND_TAP:
+			if (nPendingTaps < TAPS)
+				pendingTaps[nPendingTaps++] = command.frame;
+			break;
+
+			case COMMAND_RESET_TRACKER:
+			tempoFrozen = false;
+			resetBeatTracking();
+			break;
+
+			// nothing to hold before the tempo is known
+			case COMMAND_FREEZE_TEMPO:
+			if (!tempoFrozen && schedule.valid) {
+				frozenTickRate = schedule.ramp.linear * schedule.ticksPerStep;
+				tempoFrozen = true;
+			}
+			else
+				tempoFrozen = false;
+			break;
+
+			// adaptive mode overrides these until it is turned off
+			case COMMAND_RISING_THRESHOLD:
+			setThresholds(risingThreshold_dB + command.value, fallingThreshold_dB, lowMinTime_ms);
+			break;
+
+			case COMMAND_FALLING_THRESHOLD:
+			setThresholds(risingThreshold_dB, fallingThreshold_dB + command.value, lowMinTime_ms);
+			break;
+
+			case COMMAND_LOW_MIN_TIME:
+			setThresholds(risingThreshold_dB, fallingThreshold_dB, lowMinTime_ms + command.value);
+			break;
+
+			case COMMAND_MATCH_THRESHOLD:
+			matchedFilter.matchThreshold += command.value;
+			if (matchedFilter.matchThreshold < 0.0f)
+				matchedFilter.matchThreshold = 0.0f;
+			if (matchedFilter.matchThreshold > 1.0f)
+				matchedFilter.matchThreshold = 1.0f;
+			break;
+
+			case COMMAND_PREFERRED_TEMPO:
+			tempoTracker.preferredTempo_bpm += command.value;
+			if (tempoTracker.preferredTempo_bpm < 30.0f)
+				tempoTracker.preferredTempo_bpm = 30.0f;
+			if (tempoTracker.preferredTempo_bpm > 300.0f)
+				tempoTracker.preferredTempo_bpm = 300.0f;
+			musicTracker.preferredTempo_bpm = tempoTracker.preferredTempo_bpm;
+			break;
+
+			case COMMAND_SUBDIVISION:
+			subdivisionSetting += command.value;
+			if (subdivisionSetting < 0.0f)
+				subdivisionSetting = 0.0f;
+			if (subdivisionSetting > TEMPO_MAX_SUBDIVISION)
+				subdivisionSetting = TEMPO_MAX_SUBDIVISION;
+			tempoTracker.forcedSubdivision = musicMode ? 1 : lrintf(subdivisionSetting);
+			break;
+
+			// switching modes starts a fresh template
+			case COMMAND_MATCHED_FILTER:
+			matchedFilterMode = !matchedFilterMode;
+			matched_filter_reset(&matchedFilter);
+			break;
+
+			// manual threshold edits are overridden while on
+			case COMMAND_ADAPTIVE_THRESHOLDS:
+			adaptiveThresholdMode = !adaptiveThresholdMode;
+			if (adaptiveThresholdMode)
+				adaptive_threshold_init(&adaptiveThreshold, risingThreshold_dB, fallingThreshold_dB);
+			break;
+
+			case COMMAND_RAMP_TRACKING:
+			tempoTracker.rampTracking = !tempoTracker.rampTracking;
+			break;
+
+			// the music engine already reports beats, not subdivisions
+			case COMMAND_MUSIC_ENGINE:
+			musicMode = !musicMode;
+			tempoTracker.forcedSubdivision = musicMode ? 1 : lrintf(subdivisionSetting);
+			resetBeatTracking();
+			break;
+
+			case COMMAND_HYPOTHESES:
+			hypothesisMode = !hypothesisMode;
+			break;
+
+			// the recording starts with the next block
+			case COMMAND_CALIBRATE:
+			calibration_start(&calibration);
+			break;
+
+			// already clamped by process()
+			case COMMAND_LOOKAHEAD:
+			lookahead_frames = command.value;
+			break;
+
+			default:
+			break;
+		}
+	}
+
+	bool useMatchedFilter = matchedFilterMode && matchedFilter.ready;
+
+	// the onset and what follows must be in the click history, and the lookahead past the crossing
+	jack_nframes_t onsetDelay = METER_CENTROID_LENGTH - 1;
+	if (lookahead_frames > onsetDelay)
+		onsetDelay = lookahead_frames;
+
+	calibration_record(&calibration, in, nframes);
+	calibration_poll(&calibration, atomic_load(&freewheeling));
+	loopback_poll(&loopback, atomic_load(&freewheeling));
+
+	// the whole chunk goes into the click history first, so onsets the detectors report in it can be analyzed at once
+	for (i = 0; i < nframes; i++)
+		clickHistory[(startFrame + i) & (CLICK_HISTORY - 1)] = in[i];
+
+	// new thresholds from calibration, taken up by the running tracker: the onsets it locked on stay clicks
+	if (atomic_load(&calibration.state) == CALIBRATION_DONE) {
+		setThresholds(calibration.risingThreshold_dB, calibration.fallingThreshold_dB, calibration.lowMinTime_ms);
+
+		// the tail of the last click may still ring above a lower rising threshold
+		earliestNextBeatStart = currBeatEnd + lowMinTime_frames;
+
+		if (adaptiveThresholdMode)
+			adaptive_threshold_set_levels(&adaptiveThreshold, calibration.noiseFloor_dB, calibration.clickPeak_dB);
+
+		atomic_store(&calibration.state, CALIBRATION_APPLIED);
+	}
+
+	// the startup pass is over, whatever it found: let out a clock already locked
+	if (calibrationHold && (atomic_load(&calibration.state) == CALIBRATION_APPLIED
+			|| atomic_load(&calibration.state) == CALIBRATION_FAILED)) {
+		calibrationHold = false;
+
+		if (schedule.valid) {
+			schedule.emit = nDetectedBeats > 4 || warmStarted;
+			schedule_publish(&scheduleBuffer, &schedule);
+		}
+	}
+
+	// the loopback chirps may have been taken for clicks; relock once they stop
+	static bool loopbackWasRunning = false;
+	bool loopbackRunning = atomic_load(&loopback.state) == LOOPBACK_RUNNING;
+	if (loopbackWasRunning && !loopbackRunning)
+		resetBeatTracking();
+	loopbackWasRunning = loopbackRunning;
+
+	// the music engine only passes audio to its worker and collects its beats here
+	if (musicMode) {
+		music_beat_t beats[MAX_ONSETS_PER_CYCLE];
+
+		music_tracker_write(&musicTracker, in, nframes, startFrame);
+		if (atomic_load(&freewheeling))
+			music_tracker_drain(&musicTracker);
+		int nBeats = music_tracker_read(&musicTracker, beats, MAX_ONSETS_PER_CYCLE);
+
+		// beats are reported well after they were heard, analyze them right away
+		for (int n = 0; n < nBeats; n++) {
+			beatOnset(beats[n].frame);
+			onsetAnalysis();
+		}
+	}
+
+	if (matchedFilterMode && !musicMode) {
+		matched_filter_onset_t onsets[MAX_ONSETS_PER_CYCLE];
+		int nOnsets = matched_filter_process(&matchedFilter, in, nframes, startFrame,
+				onsets, MAX_ONSETS_PER_CYCLE);
+
+		// reported hops late, with the click played out; a tap close to one gives way to it, as below
+		for (int n = 0; n < nOnsets; n++) {
+			if (onsetPending && !(tapPending && fabs(frame_delta(onsets[n].frame, pendingOnset)) <= onsetDelay))
+				onsetAnalysis();
+
+			lastMatchScore = onsets[n].score;
+			beatOnset(onsets[n].frame);
+			onsetAnalysis();
+		}
+	}
+
+	for (i = 0; i < nframes; i++) {
+
+		float absoluteInput = fabs(in[i]);
+
+		jack_nframes_t currFrame = startFrame + i;
+
+		if (absoluteInput > blockPeak)
+			blockPeak = absoluteInput;
+
+		if (!detectedBeat && !heldOff(currFrame, earliestNextBeatStart) && absoluteInput > risingThreshold) {
+			detectedBeat = true;
+			beatMaxAmplitude = absoluteInput;
+
+			if (matchedFilterMode)
+				matched_filter_learn(&matchedFilter, currFrame);
+
+			if (!useMatchedFilter && !musicMode) {
+				beatOnset(currFrame);
+				refinePending = lookahead_frames > 0;
+			}
+		}
+		else if (detectedBeat && absoluteInput < fallingThreshold) {
+			detectedBeat = false;
+
+			if (adaptiveThresholdMode)
+				adaptive_threshold_click(&adaptiveThreshold, beatMaxAmplitude);
+
+			lastBeatEnd = currBeatEnd;
+			currBeatEnd = startFrame + i;
+			earliestNextBeatStart = lowMinTime_frames + currFrame;
+		}
+		else if (detectedBeat && absoluteInput > beatMaxAmplitude) {
+			beatMaxAmplitude = absoluteInput;
+		}
+
+		// a tap stands in for a click, unless one was just heard; a click right after it takes its place
+		if (nPendingTaps > 0 && (int32_t) (currFrame - pendingTaps[0]) >= 0) {
+			if (!onsetPending) {
+				beatOnset(pendingTaps[0]);
+				tapPending = true;
+			}
+			memmove(pendingTaps, pendingTaps + 1, --nPendingTaps * sizeof(jack_nframes_t));
+		}
+
+		if (onsetPending && frame_delta(currFrame, pendingOnset) >= onsetDelay)
+			onsetAnalysis();
+	}
+
+	if (adaptiveThresholdMode) {
+		adaptive_threshold_block(&adaptiveThreshold, blockPeak, (float) nframes / sample_rate);
+		setThresholds(adaptiveThreshold.risingThreshold_dB, adaptiveThreshold.fallingThreshold_dB, lowMinTime_ms);
+	}
+
+	publishAnalysisStatus(startFrame + nframes);
+}
+
+// consume one block from the analysis ring, false if none is complete yet
+static bool analyzeQueuedBlock (void)
+{
+	static float chunk[ANALYSIS_CHUNK];
+	block_header_t header;
+
+	if (jack_ringbuffer_read_space(analysisRing) < sizeof(header))
+		return false;
+
+	jack_ringbuffer_peek(analysisRing, (char *) &header, sizeof(header));
+
+	if (jack_ringbuffer_read_space(analysisRing) < sizeof(header) + header.nframes * sizeof(float))
+		return false;
+
+	jack_ringbuffer_read_advance(analysisRing, sizeof(header));
+
+	for (jack_nframes_t done = 0; done < header.nframes; done += ANALYSIS_CHUNK) {
+		jack_nframes_t n = header.nframes - done < ANALYSIS_CHUNK ? header.nframes - done : ANALYSIS_CHUNK;
+
+		jack_ringbuffer_read(analysisRing, (char *) chunk, n * sizeof(float));
+		analyzeBlock(chunk, n, header.startFrame + done);
+	}
+
+	return true;
+}
+
+static void *analysisWorker (void *arg)
+{
+	pthread_mutex_lock(&analysisLock);
+
+	while (TRUE) {
+		while (analyzeQueuedBlock())
+			;
+		pthread_cond_wait(&analysisReady, &analysisLock);
+	}
+
+	return NULL;
+}
+
+#ifdef HAVE_ALSA
+/*
+ * Queue the sequencer events process() passed on.  Their times go from
+ * frames to the backend's microsecond clock, which the sequencer queue is
+ * lined up with now and then in case the two clocks drift.
+ */
+static void *seqSender (void *arg)
+{
+	seq_event_t event;
+	uint64_t aligned = 0;
+
+	pthread_mutex_lock(&seqLock);
+
+	while (TRUE) {
+		uint64_t now = backend.get_time(&backend);
+		if (now - aligned >= ALSA_SEQ_ALIGN_S * 1000000) {
+			alsa_seq_align(&alsaSeq, now);
+			aligned = now;
+		}
+
+		while (jack_ringbuffer_read(seqRing, (char *) &event, sizeof(event)) == sizeof(event)) {
+			double frame = frame_wrap(event.frame);
+			jack_nframes_t whole = floor(frame);
+			uint64_t due = backend.frames_to_time(&backend, whole) + (frame - whole) * 1e6 / sample_rate;
+			alsa_seq_send(&alsaSeq, due, event.message, event.size);
+		}
+
+		pthread_cond_wait(&seqReady, &seqLock);
+	}
+
+	return NULL;
+}
+#endif
+
+// input i frames into the cycle, delayed by the lookahead
+static inline float delayedInput (const float *in, jack_nframes_t i, jack_nframes_t delay)
+{
+	return i >= delay ? in[i - delay] : monitorDelay[(monitorDelayWrite + i - delay) & monitorDelayMask];
+}
+
+/*
+ * Fill the monitor output for one cycle.  Input views come from the delay
+ * line, so they line up with the lookahead; beats are those of the clock
+ * due in this cycle.
+ */
+static void writeMonitor (const float *in, float *out, jack_nframes_t nframes, jack_nframes_t startFrame,
+		const monitor_beat_t *beats, int nBeats)
+{
+	jack_nframes_t i, delay = monitorDelay_frames;
+	int b = 0;
+
+	switch (monitorMode) {
+		case MONITOR_RECTIFIED:
+		for (i = 0; i < nframes; i++)
+			out[i] = fabsf(delayedInput(in, i, delay));
+		break;
+
+		case MONITOR_ENVELOPE:
+		for (i = 0; i < nframes; i++) {
+			float x = fabsf(delayedInput(in, i, delay));
+			envelope += (x > envelope ? envelopeAttack : envelopeRelease) * (x - envelope);
+			out[i] = envelope;
+		}
+
+		// don't decay into denormals in silence
+		if (envelope < 1e-10f)
+			envelope = 0.0f;
+		break;
+
+		// the threshold detector runs in the analysis thread, this replays its thresholds on the delayed input
+		case MONITOR_GATE:
+		for (i = 0; i < nframes; i++) {
+			float x = fabsf(delayedInput(in, i, delay));
+			jack_nframes_t frame = startFrame + i;
+
+			if (!gateOpen && !heldOff(frame, gateEarliestOpen) && x > risingThreshold)
+				gateOpen = true;
+			else if (gateOpen && x < fallingThreshold) {
+				gateOpen = false;
+				gateEarliestOpen = frame + lowMinTime_frames;
+			}
+
+			out[i] = gateOpen ? 1.0f : 0.0f;
+		}
+		break;
+
+		case MONITOR_IMPULSE:
+		memset(out, 0, nframes * sizeof(float));
+		for (b = 0; b < nBeats; b++)
+			out[beats[b].offset] = beats[b].downbeat ? 1.0f : 0.5f;
+		break;
+
+		case MONITOR_CLICK:
+		for (i = 0; i < nframes; i++) {
+			if (b < nBeats && beats[b].offset == i) {
+				click_synth_trigger(&clickSynth, beats[b].frame, beats[b].downbeat);
+				b++;
+			}
+			out[i] = click_synth_sample(&clickSynth, startFrame + i);
+		}
+		break;
+
+		default:
+		memset(out, 0, nframes * sizeof(float));
+		break;
+	}
+
+	// keep the end of the cycle for the next one
+	i = nframes > monitorDelayMask ? nframes - monitorDelayMask - 1 : 0;
+	for (; i < nframes; i++)
+		monitorDelay[(monitorDelayWrite + i) & monitorDelayMask] = in[i];
+	monitorDelayWrite += nframes;
+}
+
+/*
+ * Reverse mode: play the beats of the followed clock that fall in the cycle,
+ * where the clock predicts them rather than where the ticks arrived.
+ */
+static void writeReverseClicks (float *out, jack_nframes_t nframes, jack_nframes_t startFrame)
+{
+	if (clock_follower_locked(&clockFollower, startFrame) && clockFollower.running) {
+		// the beat of the latest tick received, or the one it leads up to
+		long latestBeatTick = (clockFollower.tick + 22) / 24 * 24;
+		if (reverseClickTick < latestBeatTick)
+			reverseClickTick = latestBeatTick;
+
+		double due, offset; // into the cycle
+		while ((offset = frame_delta(due = clock_follower_tick_time(&clockFollower, reverseClickTick), startFrame)) < nframes) {
+			// a beat more than a tick past is not worth a late click
+			if (offset > -clockFollower.period)
+				click_synth_trigger(&clickSynth, offset > 0.0 ? due : startFrame,
+						reverseClickTick / 24 % REVERSE_BEATS_PER_BAR == 0);
+			reverseClickTick += 24;
+		}
+	}
+
+	for (jack_nframes_t i = 0; i < nframes; i++)
+		out[i] = click_synth_sample(&clickSynth, startFrame + i);
+}
+
+/*
+ * When process() sends a tick: as the schedule has it, or, while catching up
+ * with the schedule, CATCH_UP_SPACING of a tick after the last one sent.
+ */
+static double tickSendTime (const clock_schedule_t *s, long tick, double lead)
+{
+	double due = clock_schedule_tick_time(s, tick) - lead;
+	double earliest = lastTickTime + CATCH_UP_SPACING * (clock_schedule_tick_time(s, tick + 1) - clock_schedule_tick_time(s, tick));
+
+	return frame_delta(due, earliest) > 0.0 ? due : earliest;
+}
+
+// frames the monitor output lags the input, in process()
+static jack_nframes_t monitorLatency (void)
+{
+	switch (monitorMode) {
+		case MONITOR_RECTIFIED:
+		case MONITOR_ENVELOPE:
+		case MONITOR_GATE:
+		return monitorDelay_frames;
+
+		default:
+		return 0;
+	}
+}
+
+// pass a command on to the analysis thread, dropped if its queue is full
+static void passToAnalysis (const command_t *command)
+{
+	if (jack_ringbuffer_write_space(analysisCommandRing) >= sizeof(*command))
+		jack_ringbuffer_write(analysisCommandRing, (const char *) command, sizeof(*command));
+}
+
+// publish what the UI shows of process(), as of frame now
+static void publishCycleStatus (jack_nframes_t now)
+{
+	cycle_status_t status;
+
+	status.lookahead_ms = lookahead_ms;
+	status.lookahead_frames = monitorDelay_frames;
+	status.clockLead_ms = clockLead_ms;
+	status.clockNudge_ms = 1000.0 * clockNudge_frames / sample_rate;
+	status.monitorMode = monitorMode;
+	status.reverseMode = reverseMode;
+	status.autoStart = autoStart;
+	status.transportRunning = transportRunning;
+	status.startRequested = startRequested;
+	status.transportHeld = transportHeld;
+	status.songPositionTicks = songPositionTicks;
+	status.followerLocked = clock_follower_locked(&clockFollower, now);
+	status.followerRunning = clockFollower.running;
+	status.follower_bpm = status.followerLocked ? clock_follower_bpm(&clockFollower) : 0.0;
+
+	snapshot_publish(&cycleStatus, &status);
+}
+
+/*
+ * One audio cycle, in the realtime thread of whichever backend runs it.  It
+ * only queues the input for the analysis thread and sends the clock ticks
+ * that fall in the cycle, so the cost of the analysis doesn't risk xruns.
+ * The MIDI buffers are JACK's, NULL with the other backends; ticks then go
+ * through the sequencer, if at all.
+ */
+static void runCycle (const float *in, float *out, jack_nframes_t nframes, jack_nframes_t jack_callback_start_frame,
+		void *midi_out_buffer, void *midi_in_buffer, bool monitorConnected)
+{
+	int i;
+
+	// operator commands, a few per cycle so a burst of them can't make it overrun
+	command_t command;
+	for (int c = 0; c < MAX_COMMANDS_PER_CYCLE
+			&& jack_ringbuffer_read(commandRing, (char *) &command, sizeof(command)) == sizeof(command); c++) {
+		switch (command.type) {
+			case COMMAND_TAP:
+			case COMMAND_RESET_TRACKER:
+			case COMMAND_FREEZE_TEMPO:
+			case COMMAND_RISING_THRESHOLD:
+			case COMMAND_FALLING_THRESHOLD:
+			case COMMAND_LOW_MIN_TIME:
+			case COMMAND_MATCH_THRESHOLD:
+			case COMMAND_PREFERRED_TEMPO:
+			case COMMAND_SUBDIVISION:
+			case COMMAND_MATCHED_FILTER:
+			case COMMAND_ADAPTIVE_THRESHOLDS:
+			case COMMAND_RAMP_TRACKING:
+			case COMMAND_MUSIC_ENGINE:
+			case COMMAND_HYPOTHESES:
+			case COMMAND_CALIBRATE:
+			passToAnalysis(&command);
+			break;
+
+			// the monitor delays its input views as long as the analysis waits for the attack
+			case COMMAND_LOOKAHEAD:
+			lookahead_ms += command.value;
+			if (lookahead_ms < 0.0f)
+				lookahead_ms = 0.0f;
+			if (lookahead_ms > LOOKAHEAD_MAX_MS)
+				lookahead_ms = LOOKAHEAD_MAX_MS;
+			monitorDelay_frames = ms_to_frames(lookahead_ms);
+			atomic_store(&monitorLatency_frames, monitorLatency());
+
+			command.value = monitorDelay_frames;
+			passToAnalysis(&command);
+			break;
+
+			case COMMAND_CLOCK_LEAD:
+			clockLead_ms += command.value;
+			if (clockLead_ms < 0.0f)
+				clockLead_ms = 0.0f;
+			if (clockLead_ms > 1000.0f * LOOPBACK_MAX_LATENCY_S)
+				clockLead_ms = 1000.0f * LOOPBACK_MAX_LATENCY_S;
+			clockLead_frames = clockLead_ms * sample_rate / 1000.0;
+			break;
+
+			case COMMAND_MONITOR_MODE:
+			monitorMode = (monitorMode + 1) % N_MONITOR_MODES;
+			atomic_store(&monitorLatency_frames, monitorLatency());
+			break;
+
+			case COMMAND_REVERSE:
+			reverseMode = !reverseMode;
+			break;
+
+			case COMMAND_AUTO_START:
+			autoStart = !autoStart;
+			break;
+
+			case COMMAND_LOOPBACK:
+			loopback_start(&loopback);
+			break;
+
+			case COMMAND_RESYNC:
+			resyncRequested = true;
+			break;
+
+			case COMMAND_START_STOP:
+			if (transportRunning || startRequested) {
+				if (transportRunning)
+					writeMidi(midi_out_buffer, 0, jack_callback_start_frame, 0xFC, -1);
+				transportRunning = false;
+				startRequested = false;
+				transportHeld = true;
+			}
+			else {
+				startRequested = true;
+				transportHeld = false;
+			}
+			break;
+
+			case COMMAND_SONG_POSITION:
+			positionRequested = true;
+			break;
+
+			case COMMAND_NUDGE_FORWARD:
+			clockNudge_frames += ms_to_frames(NUDGE_MS);
+			break;
+
+			case COMMAND_NUDGE_BACK:
+			clockNudge_frames -= ms_to_frames(NUDGE_MS);
+			break;
+		}
+	}
+
+	// a loopback measurement the analysis thread finished becomes the clock lead
+	if (atomic_load(&loopback.state) == LOOPBACK_DONE) {
+		clockLead_ms = 1000.0f * loopback.latency_frames / sample_rate;
+		clockLead_frames = loopback.latency_frames;
+		atomic_store(&loopback.state, LOOPBACK_APPLIED);
+	}
+
+	// timestamp the returned clock for the analysis thread
+	uint32_t nEvents = midi_in_buffer != NULL ? jack_midi_get_event_count(midi_in_buffer) : 0;
+
+	for (uint32_t e = 0; e < nEvents; e++) {
+		jack_midi_event_t event;
+
+		if (jack_midi_event_get(&event, midi_in_buffer, e) != 0 || event.size == 0)
+			continue;
+
+		jack_nframes_t eventFrame = jack_callback_start_frame + event.time;
+
+		switch (event.buffer[0]) {
+			case 0xF8:
+			if (event.size == 1) {
+				if (jack_ringbuffer_write_space(returnTicks) >= sizeof(eventFrame))
+					jack_ringbuffer_write(returnTicks, (const char *) &eventFrame, sizeof(eventFrame));
+				clock_follower_tick(&clockFollower, eventFrame);
+			}
+			break;
+
+			case 0xFA:
+			clock_follower_start(&clockFollower);
+			reverseClickTick = -1;
+			break;
+
+			case 0xFB:
+			clock_follower_continue(&clockFollower);
+			break;
+
+			case 0xFC:
+			clock_follower_stop(&clockFollower);
+			break;
+
+			case 0xF2:
+			if (event.size == 3) {
+				clock_follower_song_position(&clockFollower, event.buffer[1] | event.buffer[2] << 7);
+				reverseClickTick = -1;
+			}
+			break;
+		}
+	}
+
+	block_header_t header = { jack_callback_start_frame, nframes };
+
+	// a block that doesn't fit is dropped whole, the analysis copes with the gap
+	if (jack_ringbuffer_write_space(analysisRing) >= sizeof(header) + nframes * sizeof(float)) {
+		jack_ringbuffer_write(analysisRing, (const char *) &header, sizeof(header));
+		jack_ringbuffer_write(analysisRing, (const char *) in, nframes * sizeof(float));
+
+		// freewheeling, analyze it now (once a worker still busy from before is done); else
+		// wake the analysis unless it is busy, in which case it will find the block anyway
+		if (atomic_load(&freewheeling)) {
+			pthread_mutex_lock(&analysisLock);
+			while (analyzeQueuedBlock())
+				;
+			pthread_mutex_unlock(&analysisLock);
+		}
+		else if (pthread_mutex_trylock(&analysisLock) == 0) {
+			pthread_cond_signal(&analysisReady);
+			pthread_mutex_unlock(&analysisLock);
+		}
+	}
+	else
+		atomic_fetch_add(&analysisOverruns, 1);
+
+	const clock_schedule_t *s = schedule_acquire(&scheduleBuffer);
+
+	// a new epoch restarts the count at the tick after its first onset
+	if (s->epoch != clockEpoch) {
+		clockEpoch = s->epoch;
+		clockRunning = false;
+	}
+
+	if (s->valid && !clockRunning) {
+		nextTick = s->firstTick;
+		clockRunning = true;
+	}
+
+	// ticks short of the latest beat are still owed and catch up; at most one beat is owed
+	long beatTick = s->anchorTick / 24 * 24;
+	if (clockRunning && nextTick < beatTick - 24)
+		nextTick = beatTick - 24;
+
+	double lead = clockLead_frames + clockNudge_frames;
+	double nextTickTime = clockRunning ? tickSendTime(s, nextTick, lead) : INFINITY;
+
+	// the tick is placed by its offset into the cycle, which holds across the wrap of the timeline
+	double nextTickOffset = frame_delta(nextTickTime, jack_callback_start_frame);
+
+	// the sequencer is given ticks early enough to have them queued by the time they are due
+	double early = seqOutput ? nframes + ms_to_frames(SEQ_MARGIN_MS) : 0.0;
+
+	for (i = 0; i < nframes; i++) {
+
+		jack_nframes_t currFrame = jack_callback_start_frame + i;
+
+		// keep counting ticks before the clock is output so the count stays beat aligned; only ticks sent are spaced
+		if (i + early >= nextTickOffset) {
+			if (s->emit) {
+				lastTickTime = nextTickOffset > i ? nextTickTime : currFrame;
+				emitClockTick(midi_out_buffer, i, lastTickTime, s);
+
+				// stamped when it plays, not when it was handed to the sequencer
+				if (!atomic_load_explicit(&firstTickSent, memory_order_relaxed)) {
+					firstTickFrame = jack_callback_start_frame + (jack_nframes_t) ceil(nextTickOffset > i ? nextTickOffset : i);
+					atomic_store(&firstTickSent, true);
+				}
+
+				// beats are due between samples like the ticks; owed ticks are late, their beats are now
+				if (nextTick % 24 == 0 && nDueBeats < MAX_MONITOR_BEATS) {
+					dueBeats[nDueBeats].frame = i - nextTickOffset < 1.0 ? nextTickTime : currFrame;
+					dueBeats[nDueBeats].downbeat = clock_schedule_bar_position(s, nextTick / 24) == 0;
+					nDueBeats++;
+				}
+			}
+			nextTick++;
+			nextTickTime = tickSendTime(s, nextTick, lead);
+			nextTickOffset = frame_delta(nextTickTime, jack_callback_start_frame);
+		}
+	}
+
+	// the monitor plays the beats due in this cycle, at the frame they are due
+	monitor_beat_t beats[MAX_MONITOR_BEATS];
+	int nBeats = 0, nLater = 0;
+
+	for (int b = 0; b < nDueBeats; b++) {
+		double offset = frame_delta(dueBeats[b].frame, jack_callback_start_frame);
+
+		if (ceil(offset) < nframes) {
+			beats[nBeats] = dueBeats[b];
+			beats[nBeats++].offset = offset > 0.0 ? ceil(offset) : 0;
+		}
+		else
+			dueBeats[nLater++] = dueBeats[b];
+	}
+	nDueBeats = nLater;
+
+	// wake the sender unless it is busy, in which case it will find the events anyway
+	if (seqOutput && jack_ringbuffer_read_space(seqRing) > 0 && pthread_mutex_trylock(&seqLock) == 0) {
+		pthread_cond_signal(&seqReady);
+		pthread_mutex_unlock(&seqLock);
+	}
+
+	// the loopback measurement takes over the output while it runs
+	if (!loopback_process(&loopback, in, out, nframes, jack_callback_start_frame) && monitorConnected) {
+		if (reverseMode)
+			writeReverseClicks(out, nframes, jack_callback_start_frame);
+		else
+			writeMonitor(in, out, nframes, jack_callback_start_frame, beats, nBeats);
+	}
+
+	publishCycleStatus(jack_callback_start_frame + nframes);
+}
+
 /*
  * The process callback for this JACK application is called in a
  * special realtime thread once for each audio cycle.
- *
  */
 int process (jack_nframes_t nframes, void *arg)
 {
@@ -66,66 +1573,197 @@ int process (jack_nframes_t nframes, void *arg)
 	in = jack_port_get_buffer (input_audio_port, nframes);
 	out = jack_port_get_buffer (output_audio_port, nframes);
 
-	jack_nframes_t jack_callback_start_frame = jack_last_frame_time(client);
+	void* midi_out_buffer = jack_port_get_buffer(output_midi_port, nframes);
+	jack_midi_clear_buffer(midi_out_buffer); // this should be called at beginning of each process cycle
+
+	runCycle(in, out, nframes, jack_last_frame_time(client), midi_out_buffer,
+			jack_port_get_buffer(input_midi_port, nframes), jack_port_connected(output_audio_port));
+
+	return 0;      
+}
+
+// the cycle callback of the other backends
+static void backendCycle (const float *in, float *out, uint32_t nframes, uint32_t startFrame, void *arg)
+{
+	runCycle(in, out, nframes, startFrame, NULL, NULL, true);
+}
+
+/**
+ * JACK calls this when port latencies need to be recomputed: views of the
+ * input on the monitor output lag it by the lookahead, beats follow the
+ * clock instead.
+ */
+
+void latency (jack_latency_callback_mode_t mode, void *arg)
+{
+	jack_latency_range_t range;
+	jack_nframes_t delay = atomic_load(&monitorLatency_frames);
+
+	if (mode == JackCaptureLatency) {
+		jack_port_get_latency_range(input_audio_port, mode, &range);
+		range.min += delay;
+		range.max += delay;
+		jack_port_set_latency_range(output_audio_port, mode, &range);
+	}
+	else {
+		jack_port_get_latency_range(output_audio_port, mode, &range);
+		range.min += delay;
+		range.max += delay;
+		jack_port_set_latency_range(input_audio_port, mode, &range);
+	}
+}
+
+/**
+ * JACK calls this when it starts or stops freewheeling: running cycles
+ * back to back rather than in real time, as when a session is exported or
+ * the jack shim runs a script flat out.
+ */
+
+void freewheel (int starting, void *arg)
+{
+	atomic_store(&freewheeling, starting != 0);
+}
+
+/**
+ * JACK calls this shutdown_callback if the server ever shuts down or
+ * decides to disconnect the client.
+ */
+
+void jack_shutdown (void *arg)
+{
+	exit (1);
+}
+
+// the JACK backend, for what is shared with the others; process() runs the cycle
+static int jackStart (audio_backend_t *ab, audio_cycle_t cycle, void *arg)
+{
+	if (jack_activate (client)) {
+		fprintf (stderr, "cannot activate client");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t jackFrameTime (audio_backend_t *ab)
+{
+	return jack_frame_time(client);
+}
+
+static uint64_t jackFramesToTime (audio_backend_t *ab, uint32_t frame)
+{
+	return jack_frames_to_time(client, frame);
+}
+
+static uint64_t jackGetTime (audio_backend_t *ab)
+{
+	return jack_get_time();
+}
+
+
+// queue a command for process(), stamped with the frame the key was read at (getch() returns as soon as a key is pressed)
+static void sendCommand (command_type_t type, jack_nframes_t frame)
+{
+	command_t command = { type, frame, 0.0f };
+
+	if (jack_ringbuffer_write_space(commandRing) >= sizeof(command))
+		jack_ringbuffer_write(commandRing, (const char *) &command, sizeof(command));
+}
+
+/*
+ * Change a parameter from the UI.  Every setting belongs to the analysis
+ * thread or process(), which applies the change and clamps the result.
+ */
+static void adjustParameter (command_type_t type, float change)
+{
+	command_t command = { type, backend.frame_time(&backend), change };
+
+	if (jack_ringbuffer_write_space(commandRing) >= sizeof(command))
+		jack_ringbuffer_write(commandRing, (const char *) &command, sizeof(command));
+}
+
+static double msSinceLaunch (void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return 1000.0 * (now.tv_sec - launchTime.tv_sec) + 1e-6 * (now.tv_nsec - launchTime.tv_nsec);
+}
 
-	void* midi_out_buffer = jack_port_get_buffer(output_midi_port, nframes);
-	jack_midi_clear_buffer(midi_out_buffer); // this should be called at beginning of each process cycle
+// record a step of startup; safe from any thread
+static void traceSpan (const char *step, double start_ms, double end_ms)
+{
+	int n = atomic_fetch_add(&nTraceSteps, 1);
 
-	unsigned char jbuffer[4];
-	jbuffer[0] = 0xF8;
-	jbuffer[1] = 0;
-	jbuffer[2] = 0;
-	jbuffer[3] = 0;
+	if (n < MAX_TRACE_STEPS)
+		traceSteps[n] = (trace_step_t) { step, start_ms, end_ms };
+}
 
-	int i;
+// a step that started at start_ms and just finished
+static void traceStep (const char *step, double start_ms)
+{
+	traceSpan(step, start_ms, msSinceLaunch());
+}
 
-	for (i = 0; i < nframes; i++) {
+static void printStartupTrace (void)
+{
+	int n = atomic_load(&nTraceSteps);
 
-		float absoluteInput = fabs(in[i]);
+	fprintf(stderr, "startup trace (ms since launch):\n");
+	for (int k = 0; k < n && k < MAX_TRACE_STEPS; k++)
+		fprintf(stderr, "%9.2f %9.2f %9.2f  %s\n", traceSteps[k].start_ms, traceSteps[k].end_ms,
+				traceSteps[k].end_ms - traceSteps[k].start_ms, traceSteps[k].step);
+}
 
-		jack_nframes_t currFrame = jack_callback_start_frame + i;
+/*
+ * Connect the ports.  You can't do this before the client is activated,
+ * because we can't make connections to clients that aren't running.  Note
+ * the confusing (but necessary) orientation of the driver backend ports:
+ * playback ports are "input" to the backend, and capture ports are
+ * "output" from it.  Runs in a thread of its own while the UI starts, so
+ * it leaves exiting to the main loop.
+ */
+static void *connectPorts (void *arg)
+{
+	const char **ports;
+	double start = msSinceLaunch();
 
-		if (!detectedBeat && currFrame > earliestNextBeatStart && absoluteInput > risingThreshold) {
-			detectedBeat = true;
-			nDetectedBeats++;
-			beatMaxAmplitude = absoluteInput;
-			lastBeatStart = currBeatStart;
-			currBeatStart = currFrame;
+	ports = jack_get_ports (client, NULL, NULL,
+				JackPortIsPhysical|JackPortIsOutput);
+	if (ports == NULL) {
+		connectionError = "no physical capture ports";
+		atomic_store(&connectionFailed, true);
+		return NULL;
+	}
 
-			if (nDetectedBeats > 1) {
-				framesPerClockTick = (currBeatStart - lastBeatStart) / 24;
-				nextClockTick = currFrame + framesPerClockTick;
-			}
-		}
-		else if (detectedBeat && absoluteInput < fallingThreshold) {
-			detectedBeat = false;
-			lastBeatEnd = currBeatEnd;
-			currBeatEnd = jack_callback_start_frame + i;
-			earliestNextBeatStart = lowMinTime_frames + currFrame;
-		}
+	if (jack_connect (client, ports[0], jack_port_name (input_audio_port))) {
+		atomic_fetch_or(&missedConnections, MISSED_INPUT);
+	}
 
-		out[i] = absoluteInput;
+	free (ports);
+	
+	ports = jack_get_ports (client, NULL, NULL,
+				JackPortIsPhysical|JackPortIsInput);
+	if (ports == NULL) {
+		connectionError = "no physical playback ports";
+		atomic_store(&connectionFailed, true);
+		return NULL;
+	}
 
-		if (currFrame == nextClockTick && nDetectedBeats > 4) {
-			jack_midi_event_write(midi_out_buffer, 0, jbuffer, 3);
-			nextClockTick = currFrame + framesPerClockTick;
-		}
+	if (jack_connect (client, jack_port_name (output_midi_port), ports[0])) {
+		atomic_fetch_or(&missedConnections, MISSED_MIDI_OUTPUT);
 	}
 
-	return 0;      
-}
+	if (jack_connect (client, jack_port_name (output_audio_port), ports[0])) {
+		atomic_fetch_or(&missedConnections, MISSED_AUDIO_OUTPUT);
+	}
 
-/**
- * JACK calls this shutdown_callback if the server ever shuts down or
- * decides to disconnect the client.
- */
+	free (ports);
 
-void jack_shutdown (void *arg)
-{
-	exit (1);
+	traceStep("port connection", start);
+	return NULL;
 }
 
-
 void printbar( float amplitude, int columnsavailable)
 {
 		int nfullchars = (columnsavailable > 0) ? amplitude * (float) columnsavailable : 0;
@@ -135,23 +1773,19 @@ void printbar( float amplitude, int columnsavailable)
 			addch(ACS_CKBOARD);
 }
 
-int main (int argc, char *argv[])
+/*
+ * Open a client connection to the JACK server and register the ports.
+ * Everything the clock needs comes first; the UI starts once the client is
+ * active.  Returns the name the client got.
+ */
+static const char *openJack (const char *client_name)
 {
-	const char **ports;
-	const char *client_name = "metronome-audio-to-midi";
 	const char *server_name = NULL;
 	jack_options_t options = JackNullOption;
 	jack_status_t status;
+	double stepStart;
 
-	// ncurses setup
-	initscr(); // ncurses init terminal
-	cbreak; // only input one character at a time
-	noecho(); // disable echoing of typed keyboard input
-	keypad(stdscr, TRUE); // allow capture of special keystrokes, like arrow keys
-	timeout(16); // make getch() only block for 16 ms (to allow realtime output 60 fps)
-
-	/* open a client connection to the JACK server */
-
+	stepStart = msSinceLaunch();
 	client = jack_client_open (client_name, options, &status, server_name);
 	if (client == NULL) {
 		fprintf (stderr, "jack_client_open() failed, "
@@ -168,6 +1802,7 @@ int main (int argc, char *argv[])
 		client_name = jack_get_client_name(client);
 		fprintf (stderr, "unique name `%s' assigned\n", client_name);
 	}
+	traceStep("jack_client_open", stepStart);
 
 	/* tell the JACK server to call `process()' whenever
 	   there is work to be done.
@@ -182,12 +1817,20 @@ int main (int argc, char *argv[])
 
 	jack_on_shutdown (client, jack_shutdown, 0);
 
-	/* display the current sample rate. 
-	 */
+	jack_set_latency_callback (client, latency, 0);
 
-	jack_nframes_t sample_rate = jack_get_sample_rate(client);
-	printf ("engine sample rate: %" PRIu32 "\n", sample_rate);
+	jack_set_freewheel_callback (client, freewheel, 0);
 
+	backend.name = "JACK";
+	backend.sampleRate = jack_get_sample_rate(client);
+	backend.periodFrames = jack_get_buffer_size(client);
+	backend.start = jackStart;
+	backend.stop = NULL; // closed with the client
+	backend.frame_time = jackFrameTime;
+	backend.frames_to_time = jackFramesToTime;
+	backend.get_time = jackGetTime;
+
+	stepStart = msSinceLaunch();
 	input_audio_port = jack_port_register (client, "Metronome Audio input",
 					 JACK_DEFAULT_AUDIO_TYPE,
 					 JackPortIsInput, 0);
@@ -197,86 +1840,327 @@ int main (int argc, char *argv[])
 	output_midi_port = jack_port_register (client, "MIDI Clock output",
 					  JACK_DEFAULT_MIDI_TYPE,
 					  JackPortIsOutput, 0);
+	input_midi_port = jack_port_register (client, "MIDI Clock return",
+					  JACK_DEFAULT_MIDI_TYPE,
+					  JackPortIsInput, 0);
 
-	if ((input_audio_port == NULL) || (output_audio_port == NULL) || (output_midi_port == NULL)) {
+	if ((input_audio_port == NULL) || (output_audio_port == NULL) || (output_midi_port == NULL) || (input_midi_port == NULL)) {
 		fprintf(stderr, "no more JACK ports available\n");
 		exit (1);
 	}
+	traceStep("port registration", stepStart);
+
+	return client_name;
+}
+
+/*
+ * One of the backends without a server: "null", "file:recording.wav", or
+ * "alsa" with an optional ":device" (hw:0 by default).
+ */
+static void openBackend (const char *spec)
+{
+	double stepStart = msSinceLaunch();
+	int error;
+
+	if (strcmp(spec, "null") == 0)
+		error = audio_backend_file_open(&backend, NULL);
+	else if (strncmp(spec, "file:", 5) == 0)
+		error = audio_backend_file_open(&backend, spec + 5);
+#ifdef HAVE_ALSA
+	else if (strcmp(spec, "alsa") == 0)
+		error = audio_backend_alsa_open(&backend, "hw:0");
+	else if (strncmp(spec, "alsa:", 5) == 0)
+		error = audio_backend_alsa_open(&backend, spec + 5);
+#endif
+	else {
+		fprintf(stderr, "unknown audio backend %s\n", spec);
+		exit (1);
+	}
+
+	if (error)
+		exit (1);
+
+	traceStep("backend open", stepStart);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *client_name = "metronome-audio-to-midi";
+	const char *offlineInput = NULL, *offlineOutput = NULL;
+	float offlineTempo_bpm = 120.0f;
+	double stepStart;
+
+	clock_gettime(CLOCK_MONOTONIC, &launchTime);
+
+	for (int a = 1; a < argc; a++) {
+		// offline analysis of a recording: no JACK client, no UI
+		if (strcmp(argv[a], "--offline") == 0 && a + 2 < argc) {
+			offlineInput = argv[++a];
+			offlineOutput = argv[++a];
+		}
+
+		// the tempo --offline leans towards where the beat is ambiguous, as the tracker's setting does live
+		else if (strcmp(argv[a], "--preferred-tempo") == 0 && a + 1 < argc) {
+			offlineTempo_bpm = atof(argv[++a]);
+			if (offlineTempo_bpm < 30.0f || offlineTempo_bpm > 300.0f) {
+				fprintf(stderr, "--preferred-tempo takes 30 to 300 BPM\n");
+				exit (1);
+			}
+		}
+
+		// a line per beat on how the returned clock lines up
+		else if (strcmp(argv[a], "--alignment-log") == 0 && a + 1 < argc) {
+			alignmentLog = fopen(argv[++a], "a");
+			if (alignmentLog == NULL) {
+				perror(argv[a]);
+				exit (1);
+			}
+		}
+
+		// where settings and tempo are kept across restarts
+		else if (strcmp(argv[a], "--state") == 0 && a + 1 < argc)
+			statePath = strdup(argv[++a]);
+
+		// print how long startup took on exit
+		else if (strcmp(argv[a], "--startup-trace") == 0)
+			startupTrace = true;
+
+		// start with clicks from the MIDI clock return instead of the monitor
+		else if (strcmp(argv[a], "--reverse") == 0)
+			reverseMode = true;
+
+		// audio through jack (the default), null, file:recording.wav or alsa[:device]
+		else if (strcmp(argv[a], "--backend") == 0 && a + 1 < argc)
+			backendSpec = argv[++a];
+
+		// send the clock through the ALSA sequencer, optionally connected to client:port
+		else if (strcmp(argv[a], "--alsa-seq") == 0) {
+#ifdef HAVE_ALSA
+			seqOutput = true;
+			if (a + 1 < argc && argv[a + 1][0] != '-')
+				seqDestination = argv[++a];
+#else
+			fprintf(stderr, "built without ALSA, --alsa-seq is not available\n");
+			exit (1);
+#endif
+		}
+
+		else {
+			fprintf(stderr, "usage: %s [--backend name] [--reverse] [--alsa-seq [client:port]] [--startup-trace] [--state file] [--alignment-log file] [--offline recording.wav tempo-map.mid [--preferred-tempo bpm]]\n", argv[0]);
+			exit (1);
+		}
+	}
+
+	if (offlineInput != NULL)
+		return offline_analyze(offlineInput, offlineOutput, offlineTempo_bpm);
+
+	stepStart = msSinceLaunch();
+	if (statePath != NULL)
+		stateLoaded = warm_start_load(statePath, &loadedState) == 0;
+	traceStep("state load", stepStart);
+
+	if (strcmp(backendSpec, "jack") == 0)
+		client_name = openJack(client_name);
+	else
+		openBackend(backendSpec);
+
+	sample_rate = backend.sampleRate;
+	printf ("engine sample rate: %" PRIu32 "\n", sample_rate);
 
 	// initialize parameters
+	stepStart = msSinceLaunch();
 
-	risingThreshold_dB = -30.0f;
-	fallingThreshold_dB = -50.0f;
-	risingThreshold = linear_from_dB(risingThreshold_dB);
-	fallingThreshold_dB = linear_from_dB(fallingThreshold_dB);
+	if (matched_filter_init(&matchedFilter, TEMPLATE_CLICKS)) {
+		fprintf(stderr, "cannot allocate matched filter\n");
+		exit (1);
+	}
 
-	lowMinTime_ms = 20.0f;
-	lowMinTime_frames = ms_to_frames(lowMinTime_ms);
+	if (stateLoaded) {
+		setThresholds(loadedState.risingThreshold_dB, loadedState.fallingThreshold_dB, loadedState.lowMinTime_ms);
+		clockLead_ms = loadedState.clockLead_ms;
+		clockLead_frames = clockLead_ms * sample_rate / 1000.0;
+	}
+	else
+		setThresholds(-30.0f, -50.0f, 20.0f);
 
+	if (calibration_init(&calibration, sample_rate, CALIBRATION_SECONDS)) {
+		fprintf(stderr, "cannot allocate calibration buffer\n");
+		exit (1);
+	}
 
-	/* Tell the JACK server that we are ready to roll.  Our
-	 * process() callback will start running now. */
+	// saved thresholds stand in for the calibration pass
+	if (!stateLoaded) {
+		calibration_start(&calibration);
+		calibrationHold = true;
+	}
 
-	if (jack_activate (client)) {
-		fprintf (stderr, "cannot activate client");
+	if (meter_init(&meter, sample_rate)) {
+		fprintf(stderr, "cannot allocate meter analysis\n");
 		exit (1);
 	}
 
-	/* Connect the ports.  You can't do this before the client is
-	 * activated, because we can't make connections to clients
-	 * that aren't running.  Note the confusing (but necessary)
-	 * orientation of the driver backend ports: playback ports are
-	 * "input" to the backend, and capture ports are "output" from
-	 * it.
-	 */
+	tempo_tracker_init(&tempoTracker, sample_rate);
 
-	ports = jack_get_ports (client, NULL, NULL,
-				JackPortIsPhysical|JackPortIsOutput);
-	if (ports == NULL) {
-		fprintf(stderr, "no physical capture ports\n");
+	if (stateLoaded && loadedState.tempo_bpm > 0.0f
+			&& loadedState.subdivision >= 1 && loadedState.subdivision <= TEMPO_MAX_SUBDIVISION) {
+		tempo_tracker_seed(&tempoTracker, 60.0 * sample_rate / loadedState.tempo_bpm, loadedState.subdivision);
+		warmStarted = true;
+	}
+	tempo_agents_init(&tempoAgents, sample_rate);
+
+	if (music_tracker_init(&musicTracker, sample_rate)) {
+		fprintf(stderr, "cannot start music beat tracker\n");
 		exit (1);
 	}
 
-	if (jack_connect (client, ports[0], jack_port_name (input_audio_port))) {
-		fprintf (stderr, "cannot connect input ports\n");
+	// power of two delay line, longer than the longest lookahead
+	jack_nframes_t delayLength = 1;
+	while (delayLength <= ms_to_frames(LOOKAHEAD_MAX_MS))
+		delayLength *= 2;
+
+	monitorDelay = calloc(delayLength, sizeof(float));
+	monitorDelayMask = delayLength - 1;
+
+	if (monitorDelay == NULL) {
+		fprintf(stderr, "cannot allocate monitor delay line\n");
+		exit (1);
 	}
 
-	free (ports);
-	
-	ports = jack_get_ports (client, NULL, NULL,
-				JackPortIsPhysical|JackPortIsInput);
-	if (ports == NULL) {
-		fprintf(stderr, "no physical playback ports\n");
+	envelopeAttack = 1.0f - expf(-1000.0f / (ENVELOPE_ATTACK_MS * sample_rate));
+	envelopeRelease = 1.0f - expf(-1000.0f / (ENVELOPE_RELEASE_MS * sample_rate));
+
+	if (loopback_init(&loopback, sample_rate)) {
+		fprintf(stderr, "cannot allocate loopback measurement\n");
 		exit (1);
 	}
 
-	if (jack_connect (client, jack_port_name (output_midi_port), ports[0])) {
-		fprintf (stderr, "cannot connect output midi ports\n");
+	if (click_synth_init(&clickSynth, sample_rate)) {
+		fprintf(stderr, "cannot allocate click wavetables\n");
+		exit (1);
 	}
 
-	if (jack_connect (client, jack_port_name (output_audio_port), ports[0])) {
-		fprintf (stderr, "cannot connect output audio ports\n");
+	clock_alignment_init(&clockAlignment, sample_rate, alignmentLog);
+	clock_follower_init(&clockFollower, sample_rate);
+	returnTicks = jack_ringbuffer_create(RETURN_TICKS * sizeof(jack_nframes_t));
+
+	if (returnTicks == NULL) {
+		fprintf(stderr, "cannot allocate returned clock buffer\n");
+		exit (1);
 	}
 
-	free (ports);
+	commandRing = jack_ringbuffer_create(COMMANDS * sizeof(command_t));
+	analysisCommandRing = jack_ringbuffer_create(ANALYSIS_COMMANDS * sizeof(command_t));
+
+	if (commandRing == NULL || analysisCommandRing == NULL) {
+		fprintf(stderr, "cannot allocate command queues\n");
+		exit (1);
+	}
+
+#ifdef HAVE_ALSA
+	if (seqOutput) {
+		seqRing = jack_ringbuffer_create(SEQ_EVENTS * sizeof(seq_event_t));
+
+		if (seqRing == NULL || alsa_seq_open(&alsaSeq, client_name, seqDestination)
+				|| pthread_create(&seqThread, NULL, seqSender, NULL)) {
+			fprintf(stderr, "cannot start ALSA sequencer output\n");
+			exit (1);
+		}
+	}
+#endif
+
+	if (statePath != NULL && warm_start_init(&warmStart, statePath, &loadedState)) {
+		fprintf(stderr, "cannot start saving the state\n");
+		exit (1);
+	}
+
+	schedule_buffer_init(&scheduleBuffer);
+
+	if (snapshot_buffer_init(&analysisStatus, sizeof(analysis_status_t))
+			|| snapshot_buffer_init(&cycleStatus, sizeof(cycle_status_t))) {
+		fprintf(stderr, "cannot allocate status snapshots\n");
+		exit (1);
+	}
+
+	// the UI has something to show before the first block and cycle
+	publishAnalysisStatus(0);
+	publishCycleStatus(0);
+
+	analysisRing = jack_ringbuffer_create(sizeof(float) * ANALYSIS_BUFFER_S * sample_rate);
+
+	if (analysisRing == NULL || pthread_create(&analysisThread, NULL, analysisWorker, NULL)) {
+		fprintf(stderr, "cannot start analysis thread\n");
+		exit (1);
+	}
+
+	traceStep("analysis setup", stepStart);
+
+	/* Tell the JACK server (or other backend) that we are ready to
+	 * roll.  The cycle will start running now. */
+
+	stepStart = msSinceLaunch();
+	if (backend.start(&backend, backendCycle, NULL))
+		exit (1);
+	traceStep("activation", stepStart);
+
+	// the connections are made while the UI starts
+	if (client != NULL && pthread_create(&connectionThread, NULL, connectPorts, NULL)) {
+		fprintf(stderr, "cannot start connecting ports\n");
+		exit (1);
+	}
+
+	// ncurses setup
+	stepStart = msSinceLaunch();
+	initscr(); // ncurses init terminal
+	cbreak; // only input one character at a time
+	noecho(); // disable echoing of typed keyboard input
+	keypad(stdscr, TRUE); // allow capture of special keystrokes, like arrow keys
+	timeout(16); // make getch() only block for 16 ms (to allow realtime output 60 fps)
+	traceStep("ncurses init", stepStart);
+
+	// taps as the UI saw them, for showing the tapped tempo
+	jack_nframes_t lastTapFrame = 0;
+	float tapInterval_ms = 0.0f;
 
+	// parameters are changed through commands and shown as last published
+	#define N_PARAMETERS 8
 	int selectedParameterIndex = 0;
-	static const char *parameterNames[4];
-	static float *parameterValuePointers[3];
-	static const char *parameterNumberStringFormat[3];
+	static const char *parameterNames[N_PARAMETERS];
+	static command_type_t parameterCommands[N_PARAMETERS];
+	static const char *parameterNumberStringFormat[N_PARAMETERS];
+	float parameterValues[N_PARAMETERS];
 
 	parameterNames[0] = "Rising threshold (dB)";
-	parameterValuePointers[0] = &risingThreshold_dB;
+	parameterCommands[0] = COMMAND_RISING_THRESHOLD;
 	parameterNumberStringFormat[0] = " %1.2f dB ";
 
 	parameterNames[1] = "Falling threshold (dB)";
-	parameterValuePointers[1] = &fallingThreshold_dB;
+	parameterCommands[1] = COMMAND_FALLING_THRESHOLD;
 	parameterNumberStringFormat[1] = " %1.2f dB ";
 
 	parameterNames[2] = "Low Minimum Time (milliseconds)";
-	parameterValuePointers[2] = &lowMinTime_ms;
+	parameterCommands[2] = COMMAND_LOW_MIN_TIME;
 	parameterNumberStringFormat[2] = " %1.2f ms ";
 
+	parameterNames[3] = "Matched filter threshold (correlation)";
+	parameterCommands[3] = COMMAND_MATCH_THRESHOLD;
+	parameterNumberStringFormat[3] = " %1.2f ";
+
+	parameterNames[4] = "Preferred beat tempo (BPM)";
+	parameterCommands[4] = COMMAND_PREFERRED_TEMPO;
+	parameterNumberStringFormat[4] = " %1.1f BPM ";
+
+	parameterNames[5] = "Clicks per beat (0 = detect subdivisions)";
+	parameterCommands[5] = COMMAND_SUBDIVISION;
+	parameterNumberStringFormat[5] = " %1.0f ";
+
+	parameterNames[6] = "Onset lookahead (milliseconds, 0 = off)";
+	parameterCommands[6] = COMMAND_LOOKAHEAD;
+	parameterNumberStringFormat[6] = " %1.1f ms ";
+
+	parameterNames[7] = "Clock lead (milliseconds, round trip latency)";
+	parameterCommands[7] = COMMAND_CLOCK_LEAD;
+	parameterNumberStringFormat[7] = " %1.2f ms ";
+
 	/* keep running until stopped by the user */
 	while (TRUE) {
 
@@ -292,30 +2176,141 @@ int main (int argc, char *argv[])
 			break;
 
 			case KEY_DOWN:
-			if (selectedParameterIndex < 2)
+			if (selectedParameterIndex < N_PARAMETERS - 1)
 				selectedParameterIndex++;
 			break;
 
+			// toggle between threshold and matched filter detection
+			case 'm':
+			case 'M':
+			sendCommand(COMMAND_MATCHED_FILTER, backend.frame_time(&backend));
+			break;
+
+			// toggle adaptive thresholds (manual threshold edits are overridden while on)
+			case 'a':
+			case 'A':
+			sendCommand(COMMAND_ADAPTIVE_THRESHOLDS, backend.frame_time(&backend));
+			break;
+
+			// record and analyze a few seconds of input to pick the thresholds again
+			case 'c':
+			case 'C':
+			sendCommand(COMMAND_CALIBRATE, backend.frame_time(&backend));
+			break;
+
+			// toggle extrapolating tempo ramps
+			case 'r':
+			case 'R':
+			sendCommand(COMMAND_RAMP_TRACKING, backend.frame_time(&backend));
+			break;
+
+			// toggle following music instead of clicks
+			case 'e':
+			case 'E':
+			sendCommand(COMMAND_MUSIC_ENGINE, backend.frame_time(&backend));
+			break;
+
+			// toggle dropping onsets off the best tempo hypothesis
+			case 'h':
+			case 'H':
+			sendCommand(COMMAND_HYPOTHESES, backend.frame_time(&backend));
+			break;
+
+			// measure the round trip latency through a loopback for the clock lead
+			case 'l':
+			case 'L':
+			sendCommand(COMMAND_LOOPBACK, backend.frame_time(&backend));
+			break;
+
+			// cycle what the audio output plays
+			case 'o':
+			case 'O':
+			sendCommand(COMMAND_MONITOR_MODE, backend.frame_time(&backend));
+			break;
+
+			// toggle playing clicks from the returned MIDI clock
+			case 'v':
+			case 'V':
+			sendCommand(COMMAND_REVERSE, backend.frame_time(&backend));
+			break;
+
+			// tap along with the beat
+			case ' ':
+			case 't':
+			case 'T':
+			{
+				jack_nframes_t now = backend.frame_time(&backend);
+				tapInterval_ms = 1000.0f * (now - lastTapFrame) / sample_rate;
+				lastTapFrame = now;
+				sendCommand(COMMAND_TAP, now);
+			}
+			break;
+
+			// move the clock a little earlier or later
+			case ']':
+			sendCommand(COMMAND_NUDGE_FORWARD, backend.frame_time(&backend));
+			break;
+
+			case '[':
+			sendCommand(COMMAND_NUDGE_BACK, backend.frame_time(&backend));
+			break;
+
+			// forget the tempo and lock again from scratch
+			case 'x':
+			case 'X':
+			sendCommand(COMMAND_RESET_TRACKER, backend.frame_time(&backend));
+			break;
+
+			// toggle holding the current tempo
+			case 'f':
+			case 'F':
+			sendCommand(COMMAND_FREEZE_TEMPO, backend.frame_time(&backend));
+			break;
+
+			// realign the slaves to the bar at the next downbeat
+			case 'd':
+			case 'D':
+			sendCommand(COMMAND_RESYNC, backend.frame_time(&backend));
+			break;
+
+			// stop the slaves, or start them at the next downbeat
+			case 's':
+			case 'S':
+			sendCommand(COMMAND_START_STOP, backend.frame_time(&backend));
+			break;
+
+			// send the slaves the song position again
+			case 'p':
+			case 'P':
+			sendCommand(COMMAND_SONG_POSITION, backend.frame_time(&backend));
+			break;
+
+			// toggle starting slaves automatically on the first downbeat
+			case 'b':
+			case 'B':
+			sendCommand(COMMAND_AUTO_START, backend.frame_time(&backend));
+			break;
+
 			// adjust selected parameter
 
 			case KEY_RIGHT:
 			case '=':
-			*parameterValuePointers[selectedParameterIndex] += 1.0f;
+			adjustParameter(parameterCommands[selectedParameterIndex], 1.0f);
 			break;
 
 			case KEY_SRIGHT:
 			case '+':
-			*parameterValuePointers[selectedParameterIndex] += 0.1f;
+			adjustParameter(parameterCommands[selectedParameterIndex], 0.1f);
 			break;
 
 			case KEY_LEFT:
 			case '-':
-			*parameterValuePointers[selectedParameterIndex] -= 1.0f;
+			adjustParameter(parameterCommands[selectedParameterIndex], -1.0f);
 			break;
 
 			case KEY_SLEFT:			
 			case '_':
-			*parameterValuePointers[selectedParameterIndex] -= 0.1f;
+			adjustParameter(parameterCommands[selectedParameterIndex], -0.1f);
 			break;
 
 			// catch escape codes
@@ -326,30 +2321,60 @@ int main (int argc, char *argv[])
 		  }
 		}
 
-		if (risingThreshold_dB > 0.0f)
-			risingThreshold_dB = 0.0f;
+		if (atomic_load(&connectionFailed))
+			goto exit;
+
+
+		// the tick went out some frames before it is noticed here
+		static bool firstTickTraced = false;
+		if (!firstTickTraced && atomic_load(&firstTickSent)) {
+			double ago_ms = 1000.0 * (int32_t) (backend.frame_time(&backend) - firstTickFrame) / sample_rate;
+			traceSpan("first clock tick", 0.0, msSinceLaunch() - ago_ms);
+			firstTickTraced = true;
+		}
+
+		const analysis_status_t *as = snapshot_acquire(&analysisStatus);
+		const cycle_status_t *cs = snapshot_acquire(&cycleStatus);
+
+		// the monitor output latency changes with the lookahead and the monitor mode
+		static jack_nframes_t reportedLatency = 0;
+		if (atomic_load(&monitorLatency_frames) != reportedLatency) {
+			reportedLatency = atomic_load(&monitorLatency_frames);
+			if (client != NULL)
+				jack_recompute_total_latencies(client);
+		}
 
-		if (fallingThreshold_dB < -100.0f)
-			fallingThreshold_dB = -100.0f;
+		if (statePath != NULL) {
+			warm_state_t state = warmStart.queued;
 
-		if (fallingThreshold_dB > risingThreshold_dB)
-			fallingThreshold_dB = risingThreshold_dB;
+			// a tracker still locking keeps the tempo saved before
+			if (as->tempo_bpm > 0.0) {
+				state.tempo_bpm = as->tempo_bpm;
+				state.subdivision = as->subdivision;
+			}
+			state.risingThreshold_dB = as->risingThreshold_dB;
+			state.fallingThreshold_dB = as->fallingThreshold_dB;
+			state.lowMinTime_ms = as->lowMinTime_ms;
+			state.clockLead_ms = cs->clockLead_ms;
 
-		if (lowMinTime_ms < 0.0f)
-			lowMinTime_ms = 0.0f;
-		
-		lowMinTime_frames = ms_to_frames(lowMinTime_ms);
+			warm_start_save(&warmStart, &state);
+		}
 
-		// calculate linear from 10 ^ (dB/10)
-		risingThreshold = linear_from_dB(risingThreshold_dB);
-		fallingThreshold = linear_from_dB(fallingThreshold_dB);
+		parameterValues[0] = as->risingThreshold_dB;
+		parameterValues[1] = as->fallingThreshold_dB;
+		parameterValues[2] = as->lowMinTime_ms;
+		parameterValues[3] = as->matchThreshold;
+		parameterValues[4] = as->preferredTempo_bpm;
+		parameterValues[5] = as->subdivisionSetting;
+		parameterValues[6] = cs->lookahead_ms;
+		parameterValues[7] = cs->clockLead_ms;
 
 		erase(); // clear screen
 
 		getmaxyx(stdscr, maxRows, maxCols);
 		int barCols = maxCols > 24 ? maxCols - 24 : 0;
 
-		int col = 24 + ((float) 100.0f + risingThreshold_dB) / 100.0f * barCols;
+		int col = 24 + ((float) 100.0f + as->risingThreshold_dB) / 100.0f * barCols;
 			mvprintw(0, col, "R");
 /*
 		mvprintw( 0, 0, "input amplitude:  %1.4f ", maxAmplitudeInput);
@@ -371,28 +2396,170 @@ int main (int argc, char *argv[])
 */
 		mvprintw( 3, 0, "Parameters:");
 
-		for (int i=0; i<3; i++) {
+		int statusRow = 4 + N_PARAMETERS;
+
+		for (int i=0; i<N_PARAMETERS; i++) {
 			if (selectedParameterIndex == i)
 				attron(A_REVERSE);
 
-			mvprintw( i+4, 0, parameterNumberStringFormat[i], *parameterValuePointers[i]);
+			mvprintw( i+4, 0, parameterNumberStringFormat[i], parameterValues[i]);
 			attroff(A_REVERSE);
 
 			printw( parameterNames[i] );
 		}
 
-		mvprintw( 9, 0, "Usage: UP/DOWN to select a parameter, and LEFT/RIGHT to modify the selected parameter's value. Exit with Q.");
+		mvprintw( statusRow, 0, "Usage: UP/DOWN to select a parameter, and LEFT/RIGHT to modify the selected parameter's value. M toggles matched filter, A toggles adaptive thresholds, C recalibrates, B toggles downbeat start, R toggles ramp tracking, H toggles hypothesis filtering, E toggles the music engine, O cycles the monitor output, V toggles clicks from the returned clock, L measures the loopback latency, SPACE or T taps the beat, [ and ] nudge the clock back and forward, X resets the tracker, F freezes the tempo, S starts or stops the slaves, D realigns them to the bar, P resends the song position. Exit with Q.");
 	
-		mvprintw( 10, 0, "Detected Beat = %d", detectedBeat);
-		mvprintw( 11, 0, "falling = %f, rising = %f", fallingThreshold, risingThreshold);
+		mvprintw( statusRow + 1, 0, "Detected Beat = %d", as->detectedBeat);
+		mvprintw( statusRow + 2, 0, "falling = %f, rising = %f", as->fallingThreshold, as->risingThreshold);
+
+		double diffBeatStart = frame_delta(as->currBeatStart, as->lastBeatStart);
+		mvprintw( statusRow + 3, 0, "diffBeatStart = %.2f frames or %f seconds.", diffBeatStart, diffBeatStart / ((float)sample_rate));
+		mvprintw( statusRow + 4, 0, "currBeatStart = %.2f", as->currBeatStart);
+		mvprintw( statusRow + 5, 0, "lastBeatStart = %.2f", as->lastBeatStart);
+		mvprintw( statusRow + 6, 0, "lowMinTime_frames = %d", as->lowMinTime_frames);
+		mvprintw( statusRow + 7, 0, "earliestNextBeatStart = %d", as->earliestNextBeatStart);
+		mvprintw( statusRow + 8, 0, "nDetectedBeats = %d", as->nDetectedBeats);
+
+		if (!as->matchedFilterMode)
+			mvprintw( statusRow + 9, 0, "Detection: threshold");
+		else if (!as->templateReady)
+			mvprintw( statusRow + 9, 0, "Detection: matched filter, learning template (%d/%d clicks)", as->nLearned, TEMPLATE_CLICKS);
+		else
+			mvprintw( statusRow + 9, 0, "Detection: matched filter, last match score %1.2f", as->lastMatchScore);
+
+		if (as->adaptiveThresholdMode)
+			mvprintw( statusRow + 10, 0, "Adaptive thresholds: noise floor %1.1f dB, click level %1.1f dB",
+					as->noiseFloor_dB, as->clickPeak_dB);
+		else
+			mvprintw( statusRow + 10, 0, "Adaptive thresholds: off");
+
+		switch (atomic_load(&calibration.state)) {
+			case CALIBRATION_RECORDING:
+			mvprintw( statusRow + 11, 0, "Calibration: recording %1.1f of %1.1f seconds",
+					(float) as->calibrationFilled / sample_rate, CALIBRATION_SECONDS);
+			break;
+
+			case CALIBRATION_RECORDED:
+			case CALIBRATION_ANALYZING:
+			case CALIBRATION_DONE:
+			mvprintw( statusRow + 11, 0, "Calibration: analyzing");
+			break;
+
+			case CALIBRATION_APPLIED:
+			mvprintw( statusRow + 11, 0, "Calibration: %d clicks, noise floor %1.1f dB, click level %1.1f dB, low minimum time %1.1f ms",
+					calibration.nClicks, calibration.noiseFloor_dB, calibration.clickPeak_dB, calibration.lowMinTime_ms);
+			break;
+
+			case CALIBRATION_FAILED:
+			mvprintw( statusRow + 11, 0, "Calibration: no clear clicks found, keeping previous thresholds (C to retry)");
+			break;
+		}
+
+		if (as->barPosition >= 0)
+			mvprintw( statusRow + 12, 0, "Meter: %d beats per bar (confidence %1.2f), beat %d of bar",
+					as->beatsPerBar, as->meterConfidence, as->barPosition + 1);
+		else
+			mvprintw( statusRow + 12, 0, "Meter: unknown (accent separation %1.1f)", as->accentSeparation);
+
+		mvprintw( statusRow + 13, 0, "Transport: %s, song position %ld sixteenths, start on downbeat %s",
+				cs->transportRunning ? "running" : cs->startRequested ? "starting on the next downbeat" : cs->transportHeld ? "stopped by operator" : "stopped",
+				cs->songPositionTicks / 6, cs->autoStart ? "on" : "off");
+
+		if (as->tempo_bpm > 0.0) {
+			mvprintw( statusRow + 14, 0, "Tempo: %1.1f BPM, %d clicks per beat, ramp %+1.2f BPM per beat (tracking %s)", as->tempo_bpm,
+					as->subdivision, as->ramp_bpm_per_beat, as->rampTracking ? "on" : "off");
+
+			if (as->tempoFrozen)
+				printw(", frozen at %1.1f BPM", as->frozen_bpm);
+		}
+
+		if (as->bestAgent >= 0)
+			mvprintw( statusRow + 15, 0, "Hypotheses: %d, best %1.1f clicks per minute (score %1.1f), %ld onsets dropped (filtering %s)",
+					as->nAgents, as->bestAgent_bpm, as->bestAgentScore, as->rejectedOnsets, as->hypothesisMode ? "on" : "off");
+
+		if (as->musicMode)
+			mvprintw( statusRow + 16, 0, "Music engine: on, tempo %1.1f BPM, %ld beats, %ld blocks dropped",
+					as->musicTempo_bpm, as->musicBeats, atomic_load(&musicTracker.overruns));
+		else
+			mvprintw( statusRow + 16, 0, "Music engine: off");
+
+		mvprintw( statusRow + 17, 0, "Analysis: %ld blocks dropped, lookahead %u frames",
+				atomic_load(&analysisOverruns), cs->lookahead_frames);
+		mvprintw( statusRow + 18, 0, "Monitor output: %s", monitorModeNames[cs->monitorMode]);
+
+		switch (atomic_load(&loopback.state)) {
+			case LOOPBACK_IDLE:
+			mvprintw( statusRow + 19, 0, "Loopback: not measured (connect the audio output to the input and press L)");
+			break;
 
-		jack_nframes_t diffBeatStart = currBeatStart - lastBeatStart;
-		mvprintw( 12, 0, "diffBeatStart = %d frames or %f seconds.", diffBeatStart, ((float) diffBeatStart) / ((float)sample_rate));
-		mvprintw( 13, 0, "currBeatStart = %d", currBeatStart);
-		mvprintw( 14, 0, "lastBeatStart = %d", lastBeatStart);
-		mvprintw( 15, 0, "lowMinTime_frames = %d", lowMinTime_frames);
-		mvprintw( 16, 0, "earliestNextBeatStart = %d", earliestNextBeatStart);
-		mvprintw( 17, 0, "nDetectedBeats = %d", nDetectedBeats);
+			case LOOPBACK_RUNNING:
+			mvprintw( statusRow + 19, 0, "Loopback: playing %d test chirps", LOOPBACK_TRIALS);
+			break;
+
+			case LOOPBACK_RECORDED:
+			case LOOPBACK_ANALYZING:
+			case LOOPBACK_DONE:
+			mvprintw( statusRow + 19, 0, "Loopback: analyzing");
+			break;
+
+			case LOOPBACK_APPLIED:
+			mvprintw( statusRow + 19, 0, "Loopback: round trip %1.2f frames (%1.3f ms), spread %1.2f frames over %d of %d chirps",
+					loopback.latency_frames, 1000.0f * loopback.latency_frames / sample_rate,
+					loopback.spread_frames, loopback.nTrials, LOOPBACK_TRIALS);
+			break;
+
+			case LOOPBACK_FAILED:
+			mvprintw( statusRow + 19, 0, "Loopback: only %d of %d test chirps came back, keeping the clock lead (L to retry)",
+					loopback.nTrials, LOOPBACK_TRIALS);
+			break;
+		}
+
+		if (!as->returnReceiving)
+			mvprintw( statusRow + 20, 0, "Returned clock: none received");
+		else if (as->nOffsets == 0)
+			mvprintw( statusRow + 20, 0, "Returned clock: receiving, waiting for beats");
+		else
+			mvprintw( statusRow + 20, 0, "Returned clock: phase %+1.2f ms, jitter %1.2f ms, drift %+1.2f ms per minute over %d beats",
+					as->phase_ms, as->jitter_ms, as->drift_ms_per_min, as->nOffsets);
+
+		if (!cs->reverseMode)
+			mvprintw( statusRow + 21, 0, "Reverse mode: off");
+		else if (!cs->followerLocked)
+			mvprintw( statusRow + 21, 0, "Reverse mode: on, waiting for MIDI clock on the return port");
+		else
+			mvprintw( statusRow + 21, 0, "Reverse mode: on, clicking at %1.2f BPM, transport %s",
+					cs->follower_bpm, cs->followerRunning ? "running" : "stopped");
+
+		if (tapInterval_ms > 0.0f && tapInterval_ms < 2000.0f)
+			mvprintw( statusRow + 22, 0, "Tap: %1.1f BPM, clock nudged %+1.1f ms", 60000.0f / tapInterval_ms, cs->clockNudge_ms);
+		else
+			mvprintw( statusRow + 22, 0, "Tap: none, clock nudged %+1.1f ms", cs->clockNudge_ms);
+
+		if (statePath == NULL)
+			mvprintw( statusRow + 23, 0, "State: not kept (use --state)");
+		else if (atomic_load(&warmStart.failed))
+			mvprintw( statusRow + 23, 0, "State: cannot write %s", statePath);
+		else if (stateLoaded)
+			mvprintw( statusRow + 23, 0, "State: kept in %s, started warm at %1.1f BPM", statePath, loadedState.tempo_bpm);
+		else
+			mvprintw( statusRow + 23, 0, "State: kept in %s, started cold", statePath);
+
+		if (seqOutput)
+			mvprintw( statusRow + 24, 0, "MIDI out: ALSA sequencer%s%s, %ld events dropped",
+				seqDestination != NULL ? " to " : "", seqDestination != NULL ? seqDestination : "",
+				atomic_load(&seqOverruns));
+		else if (client != NULL)
+			mvprintw( statusRow + 24, 0, "MIDI out: JACK port");
+		else
+			mvprintw( statusRow + 24, 0, "MIDI out: none with the %s backend (use --alsa-seq)", backend.name);
+
+		int missed = atomic_load(&missedConnections);
+		if (missed)
+			mvprintw( statusRow + 25, 0, "Ports: cannot connect%s%s%s",
+				missed & MISSED_INPUT ? " input" : "",
+				missed & MISSED_MIDI_OUTPUT ? " MIDI output" : "",
+				missed & MISSED_AUDIO_OUTPUT ? " audio output" : "");
 	}
 
 	/* this is never reached but if the program
@@ -401,6 +2568,30 @@ int main (int argc, char *argv[])
 	*/
 exit:
 	endwin();
-	jack_client_close (client);
-	exit (0);
+
+	// the connections may still be under way when the operator quits
+	if (client != NULL)
+		pthread_join(connectionThread, NULL);
+
+	if (atomic_load(&connectionFailed))
+		fprintf(stderr, "%s\n", connectionError);
+
+	if (startupTrace)
+		printStartupTrace();
+
+	// the last changes don't wait for the interval
+	if (statePath != NULL)
+		warm_start_free(&warmStart);
+
+	if (client != NULL)
+		jack_client_close (client);
+	else
+		audio_backend_close(&backend);
+
+#ifdef HAVE_ALSA
+	if (seqOutput)
+		alsa_seq_close(&alsaSeq);
+#endif
+
+	exit (atomic_load(&connectionFailed) ? 1 : 0);
 }
@@ -0,0 +1,463 @@
+/** @file metronome-corpus.c
+ *
+ * @brief Generates a corpus of metronome recordings with ground truth, for
+ * measuring the detector modes for accuracy and speed on the same material.
+ *
+ * Each item is a click train with its settings drawn at random: click
+ * timbre, tempo (steady or ramped), clicks per beat, meter and accents,
+ * reverb, background noise or music at a set signal to noise ratio, and
+ * dropouts where the clicks stop for a while.  The same seed gives the same
+ * corpus.  Written to the output directory:
+ *
+ *     item-NNN.wav     16 bit mono
+ *     item-NNN.beats   a line per beat: time in seconds, position in the bar (1 = downbeat)
+ *     item-NNN.onsets  a line per click that sounds, subdivisions included
+ *     manifest.tsv     the settings of every item
+ *
+ * Beats in a dropout are in the .beats file but not in .onsets.  The signal
+ * to noise ratio compares the clicks (with their reverb) with the
+ * background over the whole item.
+ *
+ * usage: metronome-corpus output-dir [--count n] [--seconds s] [--seed n]
+ *        [--rate hz] [--background music.wav]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "wav.h"
+
+#define CLICK_LENGTH_S 0.15f
+#define DROPOUT_RAMP_S 0.005f // fade in and out of dropouts, so they don't click
+#define MAX_CLICKS_PER_S 20 // room for 4 clicks per beat at 300 BPM
+#define COMBS 4
+#define ALLPASSES 2
+#define REVERB_WET 0.35f
+
+typedef enum {
+	TIMBRE_BEEP, // sine beep of electronic metronomes
+	TIMBRE_WOODBLOCK,
+	TIMBRE_NOISE, // the tick of a mechanical metronome
+	TIMBRE_COWBELL,
+	N_TIMBRES
+} timbre_t;
+
+static const char *timbreNames[N_TIMBRES] = { "beep", "woodblock", "noise", "cowbell" };
+
+typedef enum {
+	BACKGROUND_NONE,
+	BACKGROUND_NOISE, // pink
+	BACKGROUND_MUSIC, // synthesized chords and bass, or the --background file
+	N_BACKGROUNDS
+} background_t;
+
+static const char *backgroundNames[N_BACKGROUNDS] = { "none", "noise", "music" };
+
+typedef struct {
+	timbre_t timbre;
+	float startTempo_bpm, endTempo_bpm; // tempo ramps linearly in time
+	int subdivision; // clicks per beat
+	int beatsPerBar;
+	float accent_dB; // downbeats over the other beats
+	float subdivision_dB; // subdivisions against the beats
+	float reverb_s; // RT60, 0 for dry
+	background_t background;
+	float snr_dB;
+	float dropoutsPerMinute;
+	float dropout_s; // longest dropout
+} item_t;
+
+float sampleRate = 48000.0f;
+float *backgroundFile = NULL; // --background, mono, looped
+long backgroundFrames = 0;
+
+// xorshift64*, so a seed gives the same corpus everywhere
+uint64_t randomState;
+
+static double uniform (double low, double high)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return low + (high - low) * ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double logUniform (double low, double high)
+{
+	return exp(uniform(log(low), log(high)));
+}
+
+static bool chance (double probability)
+{
+	return uniform(0.0, 1.0) < probability;
+}
+
+static void drawItem (item_t *item)
+{
+	static const int meters[] = { 2, 3, 4, 4, 4, 5, 6, 7 };
+
+	item->timbre = uniform(0, N_TIMBRES);
+	item->startTempo_bpm = logUniform(40.0, 240.0);
+	item->endTempo_bpm = chance(0.3) ? item->startTempo_bpm * logUniform(0.8, 1.25) : item->startTempo_bpm;
+	item->subdivision = chance(0.5) ? 1 : uniform(2, 5);
+	item->beatsPerBar = meters[(int) uniform(0, sizeof(meters) / sizeof(meters[0]))];
+	item->accent_dB = chance(0.25) ? 0.0f : uniform(2.0, 12.0);
+	item->subdivision_dB = uniform(-12.0, 0.0);
+	item->reverb_s = chance(0.4) ? 0.0f : uniform(0.2, 2.0);
+	item->background = chance(0.25) ? BACKGROUND_NONE : chance(1.0 / 3.0) ? BACKGROUND_NOISE : BACKGROUND_MUSIC;
+	item->snr_dB = uniform(-5.0, 30.0);
+	item->dropoutsPerMinute = chance(0.3) ? uniform(1.0, 4.0) : 0.0f;
+	item->dropout_s = item->dropoutsPerMinute > 0.0f ? uniform(0.5, 4.0) : 0.0f;
+}
+
+// a click t seconds after its onset; accented ones are brighter, as on most metronomes
+static float clickSample (timbre_t timbre, bool accent, float t, uint32_t *noise)
+{
+	float pitch = accent ? 1.5f : 1.0f;
+
+	switch (timbre) {
+		case TIMBRE_BEEP:
+		return sinf(2.0f * M_PI * 1000.0f * pitch * t) * expf(-t / 0.01f);
+
+		case TIMBRE_WOODBLOCK:
+		return (1.0f - expf(-t / 0.0005f)) * (0.7f * sinf(2.0f * M_PI * 800.0f * pitch * t) * expf(-t / 0.015f)
+				+ 0.3f * sinf(2.0f * M_PI * 1850.0f * pitch * t) * expf(-t / 0.008f));
+
+		case TIMBRE_NOISE:
+		*noise = *noise * 1664525u + 1013904223u;
+		return ((int32_t) *noise / 2147483648.0f) * expf(-t / (accent ? 0.003f : 0.002f));
+
+		default:
+		return (0.6f * sinf(2.0f * M_PI * 540.0f * pitch * t) + 0.4f * sinf(2.0f * M_PI * 800.0f * pitch * t))
+				* expf(-t / 0.06f);
+	}
+}
+
+// add a click starting at a fractional frame, so the annotation is exact
+static void addClick (float *out, long nframes, double onset, timbre_t timbre, bool accent, float gain)
+{
+	long first = ceil(onset), length = CLICK_LENGTH_S * sampleRate;
+	uint32_t noise = (uint32_t) (onset * 7919.0);
+
+	for (long i = first; i < first + length && i < nframes; i++)
+		out[i] += gain * clickSample(timbre, accent, (i - onset) / sampleRate, &noise);
+}
+
+/*
+ * Schroeder reverb: parallel combs into allpasses in series, the comb
+ * feedback set for the RT60.  Mixed into the clicks in place.
+ */
+static void addReverb (float *x, long nframes, float rt60_s)
+{
+	static const float combDelays_s[COMBS] = { 0.0297f, 0.0371f, 0.0411f, 0.0437f };
+	static const float allpassDelays_s[ALLPASSES] = { 0.005f, 0.0017f };
+	float *wet = calloc(nframes, sizeof(float));
+	float *line = NULL;
+
+	if (wet == NULL) {
+		fprintf(stderr, "cannot allocate the reverb\n");
+		exit (1);
+	}
+
+	for (int c = 0; c < COMBS; c++) {
+		long delay = combDelays_s[c] * sampleRate;
+		float feedback = powf(10.0f, -3.0f * combDelays_s[c] / rt60_s);
+
+		line = calloc(delay, sizeof(float));
+		if (line == NULL) {
+			fprintf(stderr, "cannot allocate the reverb\n");
+			exit (1);
+		}
+
+		for (long i = 0, k = 0; i < nframes; i++, k = (k + 1) % delay) {
+			float y = line[k];
+			line[k] = x[i] + feedback * y;
+			wet[i] += y / COMBS;
+		}
+		free(line);
+	}
+
+	for (int a = 0; a < ALLPASSES; a++) {
+		long delay = allpassDelays_s[a] * sampleRate;
+		const float g = 0.7f;
+
+		line = calloc(delay, sizeof(float));
+		if (line == NULL) {
+			fprintf(stderr, "cannot allocate the reverb\n");
+			exit (1);
+		}
+
+		for (long i = 0, k = 0; i < nframes; i++, k = (k + 1) % delay) {
+			float delayed = line[k];
+			float v = wet[i] + g * delayed;
+			line[k] = v;
+			wet[i] = delayed - g * v;
+		}
+		free(line);
+	}
+
+	for (long i = 0; i < nframes; i++)
+		x[i] += REVERB_WET * wet[i];
+
+	free(wet);
+}
+
+// pink noise, Paul Kellet's filter on white noise
+static void pinkNoise (float *out, long nframes)
+{
+	float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+
+	for (long i = 0; i < nframes; i++) {
+		float white = uniform(-1.0, 1.0);
+		b0 = 0.99765f * b0 + white * 0.0990460f;
+		b1 = 0.96300f * b1 + white * 0.2965164f;
+		b2 = 0.57000f * b2 + white * 1.0526913f;
+		out[i] = b0 + b1 + b2 + white * 0.1848f;
+	}
+}
+
+/*
+ * Music: a chord of three notes and a bass note, changing every couple of
+ * seconds, out of time with the clicks like a band playing over a count-in.
+ */
+static void synthesizeMusic (float *out, long nframes)
+{
+	long chordFrames = uniform(1.5, 3.0) * sampleRate;
+	float frequencies[4] = { 0 };
+
+	for (long i = 0; i < nframes; i++) {
+		if (i % chordFrames == 0) {
+			int root = uniform(0, 12);
+			frequencies[0] = 110.0f * powf(2.0f, root / 12.0f) / 2.0f; // bass
+			frequencies[1] = 220.0f * powf(2.0f, root / 12.0f);
+			frequencies[2] = frequencies[1] * powf(2.0f, (chance(0.5) ? 4 : 3) / 12.0f);
+			frequencies[3] = frequencies[1] * powf(2.0f, 7 / 12.0f);
+		}
+
+		float t = (float) i / sampleRate, envelope = 1.0f - expf(-(float) (i % chordFrames) / (0.05f * sampleRate));
+		float x = 0.0f;
+
+		// a few harmonics each, for something like strings or organ
+		for (int n = 0; n < 4; n++)
+			for (int h = 1; h <= 3; h++)
+				x += sinf(2.0f * M_PI * frequencies[n] * h * t) / h;
+
+		out[i] = envelope * x;
+	}
+}
+
+static double rms (const float *x, long nframes)
+{
+	double sum = 0.0;
+
+	for (long i = 0; i < nframes; i++)
+		sum += (double) x[i] * x[i];
+	return sqrt(sum / nframes);
+}
+
+// dropouts as a gain per frame, 1 where the clicks sound; returns the gain array
+static float *dropoutGain (const item_t *item, long nframes)
+{
+	float *gain = malloc(nframes * sizeof(float));
+	long ramp = DROPOUT_RAMP_S * sampleRate;
+
+	if (gain == NULL) {
+		fprintf(stderr, "cannot allocate dropouts\n");
+		exit (1);
+	}
+
+	for (long i = 0; i < nframes; i++)
+		gain[i] = 1.0f;
+
+	int n = item->dropoutsPerMinute * nframes / (60.0f * sampleRate) + 0.5f;
+	for (int d = 0; d < n; d++) {
+		long start = uniform(0.1, 1.0) * nframes, length = uniform(0.25, 1.0) * item->dropout_s * sampleRate;
+
+		for (long i = start; i < start + length && i < nframes; i++) {
+			long fromEdge = i - start < start + length - i ? i - start : start + length - i;
+			float g = fromEdge < ramp ? 1.0f - (float) fromEdge / ramp : 0.0f;
+			if (g < gain[i])
+				gain[i] = g;
+		}
+	}
+
+	return gain;
+}
+
+static void writeItem (const char *directory, int index, const item_t *item, float seconds, FILE *manifest)
+{
+	long nframes = seconds * sampleRate;
+	float *clicks = calloc(nframes, sizeof(float)), *background = calloc(nframes, sizeof(float));
+	float *gain = dropoutGain(item, nframes);
+	char path[4096];
+	FILE *beats, *onsets;
+
+	if (clicks == NULL || background == NULL) {
+		fprintf(stderr, "cannot allocate item %d\n", index);
+		exit (1);
+	}
+
+	snprintf(path, sizeof(path), "%s/item-%03d.beats", directory, index);
+	beats = fopen(path, "w");
+	snprintf(path, sizeof(path), "%s/item-%03d.onsets", directory, index);
+	onsets = fopen(path, "w");
+
+	if (beats == NULL || onsets == NULL) {
+		perror(path);
+		exit (1);
+	}
+
+	// click k falls where the integral of the tempo reaches k clicks; step through it a frame at a time
+	double clicksPerFrameStart = item->startTempo_bpm * item->subdivision / (60.0 * sampleRate);
+	double clicksPerFrameEnd = item->endTempo_bpm * item->subdivision / (60.0 * sampleRate);
+	double phase = 0.0;
+	long click = 0;
+
+	for (long i = 0; i < nframes; i++) {
+		double rate = clicksPerFrameStart + (clicksPerFrameEnd - clicksPerFrameStart) * i / nframes;
+
+		while (phase >= click) {
+			// the fraction of this frame at which the phase crossed the click
+			double onset = i - (phase - click) / rate;
+			bool onBeat = click % item->subdivision == 0;
+			long beat = click / item->subdivision;
+			int position = beat % item->beatsPerBar + 1;
+			bool downbeat = onBeat && position == 1;
+			bool sounds = gain[i] > 0.5f;
+
+			float level_dB = (onBeat ? 0.0f : item->subdivision_dB) - (downbeat ? 0.0f : item->accent_dB);
+			addClick(clicks, nframes, onset, item->timbre, downbeat && item->accent_dB > 0.0f,
+					0.5f * powf(10.0f, 0.05f * level_dB));
+
+			if (onBeat)
+				fprintf(beats, "%.6f %d\n", onset / sampleRate, position);
+			if (sounds)
+				fprintf(onsets, "%.6f\n", onset / sampleRate);
+			click++;
+		}
+
+		phase += rate;
+	}
+
+	fclose(beats);
+	fclose(onsets);
+
+	if (item->reverb_s > 0.0f)
+		addReverb(clicks, nframes, item->reverb_s);
+
+	for (long i = 0; i < nframes; i++)
+		clicks[i] *= gain[i];
+
+	// the background, scaled to the signal to noise ratio
+	if (item->background == BACKGROUND_NOISE)
+		pinkNoise(background, nframes);
+	else if (item->background == BACKGROUND_MUSIC && backgroundFile != NULL) {
+		long offset = uniform(0, backgroundFrames);
+		for (long i = 0; i < nframes; i++)
+			background[i] = backgroundFile[(offset + i) % backgroundFrames];
+	}
+	else if (item->background == BACKGROUND_MUSIC)
+		synthesizeMusic(background, nframes);
+
+	double backgroundLevel = rms(background, nframes);
+	if (backgroundLevel > 0.0) {
+		float scale = rms(clicks, nframes) / backgroundLevel * powf(10.0f, -0.05f * item->snr_dB);
+		for (long i = 0; i < nframes; i++)
+			clicks[i] += scale * background[i];
+	}
+
+	// keep the loudest peak just under full scale
+	float peak = 0.0f;
+	for (long i = 0; i < nframes; i++)
+		peak = fabsf(clicks[i]) > peak ? fabsf(clicks[i]) : peak;
+	if (peak > 0.99f)
+		for (long i = 0; i < nframes; i++)
+			clicks[i] *= 0.99f / peak;
+
+	snprintf(path, sizeof(path), "%s/item-%03d.wav", directory, index);
+	if (wav_write_mono(path, clicks, nframes, sampleRate))
+		exit (1);
+
+	fprintf(manifest, "item-%03d\t%s\t%.2f\t%.2f\t%d\t%d\t%.1f\t%.1f\t%.2f\t%s\t%.1f\t%.1f\t%.1f\n", index,
+			timbreNames[item->timbre], item->startTempo_bpm, item->endTempo_bpm, item->subdivision,
+			item->beatsPerBar, item->accent_dB, item->subdivision_dB, item->reverb_s,
+			item->background == BACKGROUND_MUSIC && backgroundFile != NULL ? "file" : backgroundNames[item->background],
+			item->background == BACKGROUND_NONE ? INFINITY : item->snr_dB, item->dropoutsPerMinute, item->dropout_s);
+
+	free(clicks);
+	free(background);
+	free(gain);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *directory = NULL, *backgroundPath = NULL;
+	int count = 20;
+	float seconds = 60.0f;
+	unsigned long long seed = 1;
+	char path[4096];
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--count") == 0 && a + 1 < argc)
+			count = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc)
+			seconds = atof(argv[++a]);
+		else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc)
+			seed = strtoull(argv[++a], NULL, 0);
+		else if (strcmp(argv[a], "--rate") == 0 && a + 1 < argc)
+			sampleRate = atof(argv[++a]);
+		else if (strcmp(argv[a], "--background") == 0 && a + 1 < argc)
+			backgroundPath = argv[++a];
+		else if (directory == NULL && argv[a][0] != '-')
+			directory = argv[a];
+		else
+			directory = NULL, a = argc;
+	}
+
+	if (directory == NULL || count < 1 || seconds <= 0.0f || sampleRate < 8000.0f) {
+		fprintf(stderr, "usage: %s output-dir [--count n] [--seconds s] [--seed n] [--rate hz] [--background music.wav]\n", argv[0]);
+		exit (1);
+	}
+
+	if (backgroundPath != NULL) {
+		float fileRate;
+		if (wav_read_mono(backgroundPath, &backgroundFile, &backgroundFrames, &fileRate))
+			exit (1);
+		if (fileRate != sampleRate)
+			fprintf(stderr, "%s is at %.0f Hz, used as if at %.0f Hz\n", backgroundPath, fileRate, sampleRate);
+	}
+
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+		perror(directory);
+		exit (1);
+	}
+
+	snprintf(path, sizeof(path), "%s/manifest.tsv", directory);
+	FILE *manifest = fopen(path, "w");
+	if (manifest == NULL) {
+		perror(path);
+		exit (1);
+	}
+
+	fprintf(manifest, "item\ttimbre\tstart_bpm\tend_bpm\tsubdivision\tbeats_per_bar\taccent_dB\tsubdivision_dB"
+			"\treverb_s\tbackground\tsnr_dB\tdropouts_per_minute\tdropout_s\n");
+
+	// zero would stay zero
+	randomState = seed ? seed : 0x9E3779B97F4A7C15ULL;
+
+	for (int k = 0; k < count; k++) {
+		item_t item;
+		drawItem(&item);
+		writeItem(directory, k, &item, seconds, manifest);
+	}
+
+	fclose(manifest);
+	free(backgroundFile);
+	return 0;
+}
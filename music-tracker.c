@@ -0,0 +1,439 @@
+/** @file music-tracker.c
+ *
+ * @brief Beat tracking of full musical audio (drums, a band feed) for when
+ * there is no metronome click to follow.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "music-tracker.h"
+
+#define COMPRESSION 100.0f // log(1 + COMPRESSION |X|) magnitude compression
+#define LOWEST_BAND_HZ 30.0f
+#define HIGHEST_BAND_HZ 16000.0f
+#define NORMALIZE_S 1.0f // time constant of the onset strength normalization
+#define TEMPO_INTERVAL 16 // hops between tempo estimates
+#define MIN_TEMPO_HISTORY_S 2.0f // onset strength needed for a first tempo estimate
+
+typedef struct {
+	jack_nframes_t startFrame;
+	jack_nframes_t nframes;
+} block_header_t;
+
+static long hopsOf (const music_tracker_t *mt, double seconds)
+{
+	return lrint(seconds * mt->sampleRate / MUSIC_HOP);
+}
+
+static void resetAnalysis (music_tracker_t *mt, jack_nframes_t startFrame)
+{
+	memset(mt->frame, 0, MUSIC_FFT_SIZE * sizeof(float));
+	memset(mt->previousLevel, 0, sizeof(mt->previousLevel));
+	mt->filled = 0;
+	mt->hop = 0;
+
+	// an onset shows most in the hop after the one it arrives in, when it
+	// has moved into the body of the window
+	mt->hopFrame0 = (double) startFrame - MUSIC_HOP / 2;
+	mt->fluxMean = 0.0f;
+	mt->fluxVariance = 1.0f;
+	mt->penaltyPeriod = 0;
+	mt->lastBeatHop = -1;
+	mt->period_hops = 0.0f;
+}
+
+/*
+ * Tempo from the autocorrelation of the onset strength over the history,
+ * weighted by a log-Gaussian tempo preference, with parabolic interpolation
+ * around the peak.
+ */
+static void estimateTempo (music_tracker_t *mt, float *scratch)
+{
+	long n = mt->hop + 1 < mt->historyLength ? mt->hop + 1 : mt->historyLength;
+	long minLag = hopsOf(mt, MUSIC_MIN_PERIOD_S);
+	long maxLag = hopsOf(mt, MUSIC_MAX_PERIOD_S);
+	float preferredLag = 60.0f / mt->preferredTempo_bpm * mt->sampleRate / MUSIC_HOP;
+	float best = 0.0f, before = 0.0f, after = 0.0f;
+	long bestLag = 0;
+	long i, lag;
+
+	if (maxLag > n / 2)
+		maxLag = n / 2;
+
+	// oldest first, so the correlation runs over contiguous memory
+	for (i = 0; i < n; i++)
+		scratch[i] = mt->strength[(mt->hop - n + 1 + i) % mt->historyLength];
+
+	float previous = 0.0f, current = 0.0f;
+
+	for (lag = minLag - 1; lag <= maxLag + 1; lag++) {
+		float sum = 0.0f;
+		for (i = lag; i < n; i++)
+			sum += scratch[i] * scratch[i - lag];
+
+		float octaves = log2f(lag / preferredLag) / mt->preferenceWidth_oct;
+		float score = sum / (n - lag) * expf(-0.5f * octaves * octaves);
+
+		if (lag > minLag && lag <= maxLag + 1 && current > best && current >= previous && current >= score) {
+			best = current;
+			bestLag = lag - 1;
+			before = previous;
+			after = score;
+		}
+
+		previous = current;
+		current = score;
+	}
+
+	if (bestLag == 0)
+		return;
+
+	float curvature = before - 2.0f * best + after;
+	float offset = curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+
+	mt->period_hops = bestLag + offset;
+}
+
+/*
+ * Extend the cumulative score by the newest hop.  Following Ellis, a hop
+ * scores its onset strength plus the best cumulative score of a
+ * predecessor half a period to two periods back, penalized by the squared
+ * log of how far the interval is from the period.
+ */
+static void extendCumulative (music_tracker_t *mt, float strength)
+{
+	long t = mt->hop;
+	int period = lrintf(mt->period_hops);
+	double best = 0.0;
+	bool found = false;
+	long d;
+
+	if (period > 0 && period != mt->penaltyPeriod) {
+		for (d = period / 2; d <= 2 * period; d++) {
+			double ratio = log((double) d / mt->period_hops);
+			mt->penalty[d] = -mt->tightness * ratio * ratio;
+		}
+		mt->penaltyPeriod = period;
+	}
+
+	if (period > 0) {
+		for (d = period / 2; d <= 2 * period && d <= t && d < mt->historyLength; d++) {
+			double score = mt->cumulative[(t - d) % mt->historyLength] + mt->penalty[d];
+			if (!found || score > best) {
+				best = score;
+				found = true;
+			}
+		}
+	}
+
+	mt->cumulative[t % mt->historyLength] = strength + best;
+}
+
+/*
+ * The best beat candidate is the top cumulative score within the last
+ * period.  It is reported once the newest hop is confirmDelay_s past it,
+ * so onsets right after it have had a chance to take over.
+ */
+static void reportBeat (music_tracker_t *mt)
+{
+	long t = mt->hop;
+	long period = lrintf(mt->period_hops);
+	long p, candidate = -1;
+
+	if (period <= 0 || t < period)
+		return;
+
+	for (p = t - period + 1; p <= t; p++)
+		if (candidate < 0 || mt->cumulative[p % mt->historyLength] > mt->cumulative[candidate % mt->historyLength])
+			candidate = p;
+
+	if (t - candidate < hopsOf(mt, mt->confirmDelay_s))
+		return;
+
+	if (mt->lastBeatHop >= 0 && candidate - mt->lastBeatHop < mt->period_hops / 2)
+		return;
+
+	// locate the onset strength peak between hops
+	float before = mt->strength[(candidate - 1) % mt->historyLength];
+	float at = mt->strength[candidate % mt->historyLength];
+	float after = mt->strength[(candidate + 1) % mt->historyLength];
+	float curvature = before - 2.0f * at + after;
+	float offset = curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+
+	if (offset < -0.5f)
+		offset = -0.5f;
+	if (offset > 0.5f)
+		offset = 0.5f;
+
+	music_beat_t beat;
+	beat.frame = mt->hopFrame0 + (candidate + offset) * MUSIC_HOP;
+	beat.strength = at;
+	beat.period = mt->period_hops * MUSIC_HOP;
+
+	if (jack_ringbuffer_write_space(mt->beats) >= sizeof(beat))
+		jack_ringbuffer_write(mt->beats, (const char *) &beat, sizeof(beat));
+
+	mt->lastBeatHop = candidate;
+	mt->nBeats++;
+}
+
+int music_flux_init (music_flux_t *mf, float sampleRate)
+{
+	int k;
+
+	if (fft_init(&mf->fft, MUSIC_FFT_SIZE))
+		return -1;
+
+	for (k = 0; k < MUSIC_FFT_SIZE; k++)
+		mf->window[k] = 0.5f - 0.5f * cosf(2.0f * M_PI * k / MUSIC_FFT_SIZE);
+
+	// log spaced band edges, at least one bin per band
+	float binWidth = sampleRate / MUSIC_FFT_SIZE;
+	float highest = HIGHEST_BAND_HZ < sampleRate / 2 ? HIGHEST_BAND_HZ : sampleRate / 2;
+	int lowest = lrintf(LOWEST_BAND_HZ / binWidth);
+
+	mf->bandEdge[0] = lowest > 1 ? lowest : 1;
+	mf->nBands = 0;
+
+	for (k = 1; k <= MUSIC_BANDS; k++) {
+		int bin = lrintf(LOWEST_BAND_HZ * powf(highest / LOWEST_BAND_HZ, (float) k / MUSIC_BANDS) / binWidth);
+		if (bin > mf->bandEdge[mf->nBands])
+			mf->bandEdge[++mf->nBands] = bin;
+	}
+
+	return 0;
+}
+
+void music_flux_free (music_flux_t *mf)
+{
+	fft_free(&mf->fft);
+}
+
+/*
+ * Half-wave rectified flux of log band levels.  Log spaced bands keep a
+ * kick drum, which only moves a few low bins, from being drowned out by
+ * broadband hits.
+ */
+float music_flux (const music_flux_t *mf, const float *frame, float *previousLevel, float *re, float *im)
+{
+	float flux = 0.0f;
+	int k, b;
+
+	for (k = 0; k < MUSIC_FFT_SIZE; k++) {
+		re[k] = frame[k] * mf->window[k];
+		im[k] = 0.0f;
+	}
+
+	fft_forward(&mf->fft, re, im);
+
+	for (b = 0; b < mf->nBands; b++) {
+		float energy = 0.0f;
+		for (k = mf->bandEdge[b]; k < mf->bandEdge[b + 1]; k++)
+			energy += re[k] * re[k] + im[k] * im[k];
+
+		float level = log1pf(COMPRESSION * sqrtf(energy));
+		if (level > previousLevel[b])
+			flux += level - previousLevel[b];
+		previousLevel[b] = level;
+	}
+
+	return flux;
+}
+
+// onset strength of the frame just completed
+static void analyzeHop (music_tracker_t *mt, float *scratch)
+{
+	float flux = music_flux(&mt->flux, mt->frame, mt->previousLevel, mt->re, mt->im);
+
+	// zero mean and unit variance over about NORMALIZE_S
+	float rate = MUSIC_HOP / (NORMALIZE_S * mt->sampleRate);
+	float deviation = flux - mt->fluxMean;
+	mt->fluxMean += rate * deviation;
+	mt->fluxVariance += rate * (deviation * deviation - mt->fluxVariance);
+
+	float strength = deviation / sqrtf(mt->fluxVariance + 1e-9f);
+	mt->strength[mt->hop % mt->historyLength] = strength;
+
+	if (mt->hop % TEMPO_INTERVAL == 0 && mt->hop >= hopsOf(mt, MIN_TEMPO_HISTORY_S))
+		estimateTempo(mt, scratch);
+
+	extendCumulative(mt, strength);
+	reportBeat(mt);
+	mt->hop++;
+
+	memmove(mt->frame, mt->frame + MUSIC_HOP, (MUSIC_FFT_SIZE - MUSIC_HOP) * sizeof(float));
+	mt->filled = 0;
+}
+
+// consume one block from the audio ring, false if none is complete yet
+static bool readBlock (music_tracker_t *mt, float *scratch)
+{
+	block_header_t header;
+
+	if (jack_ringbuffer_read_space(mt->audio) < sizeof(header))
+		return false;
+
+	jack_ringbuffer_peek(mt->audio, (char *) &header, sizeof(header));
+
+	if (jack_ringbuffer_read_space(mt->audio) < sizeof(header) + header.nframes * sizeof(float))
+		return false;
+
+	jack_ringbuffer_read_advance(mt->audio, sizeof(header));
+
+	// a gap (dropped blocks, or the engine switched back on) starts over
+	if (header.startFrame != mt->expectedFrame)
+		resetAnalysis(mt, header.startFrame);
+	mt->expectedFrame = header.startFrame + header.nframes;
+
+	jack_nframes_t remaining = header.nframes;
+
+	while (remaining > 0) {
+		jack_nframes_t n = MUSIC_HOP - mt->filled;
+		if (n > remaining)
+			n = remaining;
+
+		jack_ringbuffer_read(mt->audio, (char *) (mt->frame + MUSIC_FFT_SIZE - MUSIC_HOP + mt->filled), n * sizeof(float));
+		mt->filled += n;
+		remaining -= n;
+
+		if (mt->filled == MUSIC_HOP)
+			analyzeHop(mt, scratch);
+	}
+
+	return true;
+}
+
+static void *workerThread (void *arg)
+{
+	music_tracker_t *mt = arg;
+
+	pthread_mutex_lock(&mt->lock);
+
+	while (atomic_load(&mt->running)) {
+		while (readBlock(mt, mt->scratch))
+			;
+		pthread_cond_wait(&mt->dataReady, &mt->lock);
+	}
+
+	pthread_mutex_unlock(&mt->lock);
+	return NULL;
+}
+
+int music_tracker_init (music_tracker_t *mt, float sampleRate)
+{
+	memset(mt, 0, sizeof(*mt));
+	mt->sampleRate = sampleRate;
+	mt->preferredTempo_bpm = 120.0f;
+	mt->preferenceWidth_oct = 1.0f;
+	mt->tightness = 100.0f;
+	mt->confirmDelay_s = 0.05f;
+	mt->historyLength = hopsOf(mt, MUSIC_HISTORY_S);
+
+	if (music_flux_init(&mt->flux, sampleRate))
+		return -1;
+
+	mt->frame = malloc(MUSIC_FFT_SIZE * sizeof(float));
+	mt->re = malloc(MUSIC_FFT_SIZE * sizeof(float));
+	mt->im = malloc(MUSIC_FFT_SIZE * sizeof(float));
+	mt->strength = calloc(mt->historyLength, sizeof(float));
+	mt->cumulative = calloc(mt->historyLength, sizeof(double));
+	mt->penalty = calloc(2 * hopsOf(mt, MUSIC_MAX_PERIOD_S) + 4, sizeof(double));
+	mt->scratch = malloc(mt->historyLength * sizeof(float));
+	mt->audio = jack_ringbuffer_create(sizeof(float) * MUSIC_BUFFER_S * sampleRate);
+	mt->beats = jack_ringbuffer_create(64 * sizeof(music_beat_t));
+
+	if (!mt->frame || !mt->re || !mt->im || !mt->strength
+			|| !mt->cumulative || !mt->penalty || !mt->scratch || !mt->audio || !mt->beats) {
+		music_tracker_free(mt);
+		return -1;
+	}
+
+	resetAnalysis(mt, 0);
+
+	pthread_mutex_init(&mt->lock, NULL);
+	pthread_cond_init(&mt->dataReady, NULL);
+	atomic_store(&mt->running, true);
+
+	if (pthread_create(&mt->thread, NULL, workerThread, mt)) {
+		atomic_store(&mt->running, false);
+		music_tracker_free(mt);
+		return -1;
+	}
+
+	return 0;
+}
+
+void music_tracker_free (music_tracker_t *mt)
+{
+	if (atomic_load(&mt->running)) {
+		pthread_mutex_lock(&mt->lock);
+		atomic_store(&mt->running, false);
+		pthread_cond_signal(&mt->dataReady);
+		pthread_mutex_unlock(&mt->lock);
+		pthread_join(mt->thread, NULL);
+	}
+
+	music_flux_free(&mt->flux);
+	free(mt->frame);
+	free(mt->re);
+	free(mt->im);
+	free(mt->strength);
+	free(mt->cumulative);
+	free(mt->penalty);
+	free(mt->scratch);
+	if (mt->audio)
+		jack_ringbuffer_free(mt->audio);
+	if (mt->beats)
+		jack_ringbuffer_free(mt->beats);
+	mt->audio = NULL;
+	mt->beats = NULL;
+}
+
+void music_tracker_write (music_tracker_t *mt, const float *in, jack_nframes_t nframes, jack_nframes_t startFrame)
+{
+	block_header_t header = { startFrame, nframes };
+
+	if (jack_ringbuffer_write_space(mt->audio) < sizeof(header) + nframes * sizeof(float)) {
+		atomic_fetch_add(&mt->overruns, 1);
+		return;
+	}
+
+	jack_ringbuffer_write(mt->audio, (const char *) &header, sizeof(header));
+	jack_ringbuffer_write(mt->audio, (const char *) in, nframes * sizeof(float));
+
+	// wake the worker unless it is busy, in which case it will find the block anyway
+	if (pthread_mutex_trylock(&mt->lock) == 0) {
+		pthread_cond_signal(&mt->dataReady);
+		pthread_mutex_unlock(&mt->lock);
+	}
+}
+
+void music_tracker_drain (music_tracker_t *mt)
+{
+	pthread_mutex_lock(&mt->lock);
+	while (readBlock(mt, mt->scratch))
+		;
+	pthread_mutex_unlock(&mt->lock);
+}
+
+int music_tracker_read (music_tracker_t *mt, music_beat_t *beats, int maxBeats)
+{
+	int n = 0;
+
+	while (n < maxBeats && jack_ringbuffer_read_space(mt->beats) >= sizeof(music_beat_t))
+		jack_ringbuffer_read(mt->beats, (char *) &beats[n++], sizeof(music_beat_t));
+
+	return n;
+}
+
+float music_tracker_tempo (const music_tracker_t *mt)
+{
+	float period_hops = mt->period_hops;
+
+	if (period_hops <= 0.0f)
+		return 0.0f;
+
+	return 60.0f * mt->sampleRate / (period_hops * MUSIC_HOP);
+}
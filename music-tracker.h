@@ -0,0 +1,125 @@
+/** @file music-tracker.h
+ *
+ * @brief Beat tracking of full musical audio (drums, a band feed) for when
+ * there is no metronome click to follow.
+ *
+ * A worker thread computes a log spectral flux onset strength envelope, the
+ * tempo from its autocorrelation weighted by a tempo preference, and beats
+ * by dynamic programming over the envelope in the manner of Ellis (2007),
+ * run online: every hop extends the cumulative score, and the best beat
+ * candidate within the last beat period is reported once it is a little
+ * behind the newest hop.
+ *
+ * The analysis thread only copies its input into a lock-free ring buffer
+ * (music_tracker_write()) and collects reported beats from another one
+ * (music_tracker_read()), so the spectral analysis never holds up click
+ * detection.  Beats arrive some tens of milliseconds after they happen; the
+ * clock generator predicts ahead of them like it does for clicks.  While
+ * JACK freewheels, the analysis thread waits for the worker instead
+ * (music_tracker_drain()), so beats are found at the same point of the input
+ * every run.
+ */
+
+#ifndef MUSIC_TRACKER_H
+#define MUSIC_TRACKER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "fft.h"
+
+#define MUSIC_FFT_SIZE 1024
+#define MUSIC_HOP 256 // frames between onset strength values
+#define MUSIC_BANDS 40 // log spaced bands the flux is summed over
+#define MUSIC_HISTORY_S 6.0 // onset strength kept for the tempo estimate
+#define MUSIC_BUFFER_S 1.0 // audio buffered between the analysis thread and the worker
+#define MUSIC_MIN_PERIOD_S 0.25 // 240 BPM
+#define MUSIC_MAX_PERIOD_S 1.5 // 40 BPM
+
+// log band spectral flux, shared with the offline analysis
+typedef struct {
+	fft_t fft;
+	float window[MUSIC_FFT_SIZE];
+	int bandEdge[MUSIC_BANDS + 1]; // first bin of each band
+	int nBands;
+} music_flux_t;
+
+typedef struct {
+	double frame; // where the beat was heard
+	float strength; // normalized onset strength at the beat
+	float period; // beat period in frames at the time
+} music_beat_t;
+
+typedef struct {
+	float sampleRate;
+
+	jack_ringbuffer_t *audio; // analysis thread to worker: block headers followed by samples
+	jack_ringbuffer_t *beats; // worker to analysis thread: music_beat_t
+	atomic_long overruns; // blocks dropped because the worker fell behind
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t dataReady;
+	atomic_bool running;
+
+	// worker state
+	music_flux_t flux;
+	float *frame; // latest MUSIC_FFT_SIZE input samples
+	float *re, *im;
+	float previousLevel[MUSIC_BANDS]; // log band levels of the previous hop
+	int filled; // samples in frame since the last hop
+	jack_nframes_t expectedFrame; // frame the next block should start at
+
+	int historyLength; // hops of onset strength kept
+	float *strength; // normalized onset strength, indexed by hop modulo historyLength
+	double *cumulative; // dynamic programming score, same indexing
+	long hop; // hops analyzed since the last reset
+	double hopFrame0; // frame of hop 0
+	float fluxMean, fluxVariance;
+
+	float *penalty; // transition cost by interval in hops, for the current period
+	float *scratch; // historyLength values for the tempo estimate
+	int penaltyPeriod; // period the table was computed for
+	long lastBeatHop; // -1 if no beat reported yet
+
+	// results, written by the worker and read by the analysis thread for display
+	_Atomic float period_hops; // 0 until a tempo is found
+	atomic_long nBeats;
+
+	// tunables; the preferred tempo may change while the worker runs
+	_Atomic float preferredTempo_bpm; // center of the tempo preference
+	float preferenceWidth_oct; // standard deviation of the preference in octaves
+	float tightness; // how strongly beat intervals are held to the period
+	float confirmDelay_s; // how far behind the newest hop a beat is reported
+} music_tracker_t;
+
+int music_flux_init (music_flux_t *mf, float sampleRate);
+void music_flux_free (music_flux_t *mf);
+
+/*
+ * Onset strength of one MUSIC_FFT_SIZE frame: the rise in log band levels
+ * since previousLevel, which is updated.  re and im are MUSIC_FFT_SIZE
+ * scratch buffers, so one music_flux_t can serve several threads.
+ */
+float music_flux (const music_flux_t *mf, const float *frame, float *previousLevel, float *re, float *im);
+
+// allocates everything and starts the worker thread; call before jack_activate()
+int music_tracker_init (music_tracker_t *mt, float sampleRate);
+void music_tracker_free (music_tracker_t *mt);
+
+// analysis thread: queue input for the worker, dropped whole if there is no room
+void music_tracker_write (music_tracker_t *mt, const float *in, jack_nframes_t nframes, jack_nframes_t startFrame);
+
+// analysis thread: analyze everything queued before returning, for when JACK freewheels and the worker would fall behind
+void music_tracker_drain (music_tracker_t *mt);
+
+// analysis thread: collect beats reported since the last call
+int music_tracker_read (music_tracker_t *mt, music_beat_t *beats, int maxBeats);
+
+// tempo in BPM, 0 while unknown
+float music_tracker_tempo (const music_tracker_t *mt);
+
+#endif
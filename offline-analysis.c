@@ -0,0 +1,471 @@
+/** @file offline-analysis.c
+ *
+ * @brief Globally optimal beat alignment of a recording, exported as a
+ * tempo map.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "offline-analysis.h"
+#include "music-tracker.h"
+#include "wav.h"
+
+#define MAX_THREADS 16
+#define NORMALIZE_S 1.0 // half width of the onset strength normalization window
+#define TEMPO_INTERVAL 16 // hops between local tempo estimates
+#define PREFERENCE_WIDTH_OCT 1.0f
+#define TIGHTNESS 100.0
+#define TICKS_PER_BEAT 480
+
+typedef struct {
+	const float *samples;
+	long nframes;
+	float sampleRate;
+	float preferredTempo_bpm;
+	const music_flux_t *flux;
+
+	long nHops;
+	float *strength; // normalized onset strength per hop
+	float *period; // local beat period per hop, in hops
+	long nEstimates;
+	float *estimate; // period estimated every TEMPO_INTERVAL hops
+} analysis_t;
+
+typedef struct {
+	analysis_t *analysis;
+	long first, last; // range of work items for one thread
+} job_t;
+
+static long hopsOf (const analysis_t *a, double seconds)
+{
+	return lrint(seconds * a->sampleRate / MUSIC_HOP);
+}
+
+// run work over nItems split evenly across threads, inline if threads are unavailable
+static void parallel (analysis_t *a, long nItems, void *(*work)(void *))
+{
+	job_t jobs[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	bool started[MAX_THREADS];
+	long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if (nThreads < 1)
+		nThreads = 1;
+	if (nThreads > MAX_THREADS)
+		nThreads = MAX_THREADS;
+	if (nThreads > nItems)
+		nThreads = nItems > 0 ? nItems : 1;
+
+	for (i = 0; i < nThreads; i++) {
+		jobs[i].analysis = a;
+		jobs[i].first = nItems * i / nThreads;
+		jobs[i].last = nItems * (i + 1) / nThreads;
+		started[i] = i > 0 && pthread_create(&threads[i], NULL, work, &jobs[i]) == 0;
+	}
+
+	for (i = 0; i < nThreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			work(&jobs[i]);
+	}
+}
+
+/*
+ * Onset strength for a slice of hops.  Each hop only depends on its own
+ * frame and the one before, so slices are independent once the band levels
+ * of the frame before the slice are known.
+ */
+static void *fluxSlice (void *arg)
+{
+	job_t *job = arg;
+	analysis_t *a = job->analysis;
+	float frame[MUSIC_FFT_SIZE], re[MUSIC_FFT_SIZE], im[MUSIC_FFT_SIZE];
+	float previousLevel[MUSIC_BANDS] = { 0 };
+	long t;
+
+	for (t = job->first - 1; t < job->last; t++) {
+		// hop t ends at frame (t + 1) * MUSIC_HOP, zero padded outside the file
+		long start = (t + 1) * MUSIC_HOP - MUSIC_FFT_SIZE;
+		for (int k = 0; k < MUSIC_FFT_SIZE; k++) {
+			long i = start + k;
+			frame[k] = i >= 0 && i < a->nframes ? a->samples[i] : 0.0f;
+		}
+
+		float flux = music_flux(a->flux, frame, previousLevel, re, im);
+		if (t >= job->first)
+			a->strength[t] = flux;
+	}
+
+	return NULL;
+}
+
+/*
+ * Local tempo for a slice of estimate points, from the autocorrelation of
+ * the onset strength in a window centered on each, weighted by the tempo
+ * preference like the online tracker does.
+ */
+static void *tempoSlice (void *arg)
+{
+	job_t *job = arg;
+	analysis_t *a = job->analysis;
+	long half = hopsOf(a, MUSIC_HISTORY_S) / 2;
+	long minLag = hopsOf(a, MUSIC_MIN_PERIOD_S);
+	long maxLag = hopsOf(a, MUSIC_MAX_PERIOD_S);
+	float preferredLag = 60.0f / a->preferredTempo_bpm * a->sampleRate / MUSIC_HOP;
+
+	for (long e = job->first; e < job->last; e++) {
+		long center = e * TEMPO_INTERVAL;
+		long start = center - half > 0 ? center - half : 0;
+		long end = center + half < a->nHops ? center + half : a->nHops;
+		const float *x = a->strength + start;
+		long n = end - start;
+		float best = 0.0f, previous = 0.0f, current = 0.0f, before = 0.0f, after = 0.0f;
+		long bestLag = 0;
+
+		for (long lag = minLag - 1; lag <= maxLag + 1 && lag < n / 2; lag++) {
+			float sum = 0.0f;
+			for (long i = lag; i < n; i++)
+				sum += x[i] * x[i - lag];
+
+			float octaves = log2f(lag / preferredLag) / PREFERENCE_WIDTH_OCT;
+			float score = sum / (n - lag) * expf(-0.5f * octaves * octaves);
+
+			if (lag > minLag && current > best && current >= previous && current >= score) {
+				best = current;
+				bestLag = lag - 1;
+				before = previous;
+				after = score;
+			}
+
+			previous = current;
+			current = score;
+		}
+
+		float curvature = before - 2.0f * best + after;
+		float offset = curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+
+		a->estimate[e] = bestLag > 0 ? bestLag + offset : 0.0f;
+	}
+
+	return NULL;
+}
+
+// zero mean and unit variance over a centered window, from running sums
+static int normalize (analysis_t *a)
+{
+	long half = hopsOf(a, NORMALIZE_S);
+	double *sum = malloc((a->nHops + 1) * sizeof(double));
+	double *sumSquares = malloc((a->nHops + 1) * sizeof(double));
+	long t;
+
+	if (sum == NULL || sumSquares == NULL) {
+		free(sum);
+		free(sumSquares);
+		return -1;
+	}
+
+	sum[0] = sumSquares[0] = 0.0;
+	for (t = 0; t < a->nHops; t++) {
+		sum[t + 1] = sum[t] + a->strength[t];
+		sumSquares[t + 1] = sumSquares[t] + (double) a->strength[t] * a->strength[t];
+	}
+
+	for (t = 0; t < a->nHops; t++) {
+		long start = t - half > 0 ? t - half : 0;
+		long end = t + half + 1 < a->nHops ? t + half + 1 : a->nHops;
+		double mean = (sum[end] - sum[start]) / (end - start);
+		double variance = (sumSquares[end] - sumSquares[start]) / (end - start) - mean * mean;
+		a->strength[t] = (a->strength[t] - mean) / sqrt(variance > 1e-9 ? variance : 1e-9);
+	}
+
+	free(sum);
+	free(sumSquares);
+	return 0;
+}
+
+static int compareFloats (const void *x, const void *y)
+{
+	float a = *(const float *) x, b = *(const float *) y;
+	return (a > b) - (a < b);
+}
+
+/*
+ * Period per hop: the median of the estimates around it (which keeps a
+ * single window that locked onto double or half tempo from flipping the
+ * grid), held between estimate points.
+ */
+static void localPeriods (analysis_t *a)
+{
+	for (long t = 0; t < a->nHops; t++) {
+		float window[5];
+		int n = 0;
+		long e = t / TEMPO_INTERVAL;
+
+		for (long k = e - 2; k <= e + 2; k++)
+			if (k >= 0 && k < a->nEstimates && a->estimate[k] > 0.0f)
+				window[n++] = a->estimate[k];
+
+		if (n > 0) {
+			qsort(window, n, sizeof(float), compareFloats);
+			a->period[t] = window[n / 2];
+		}
+		else
+			a->period[t] = t > 0 ? a->period[t - 1] : 0.0f;
+	}
+}
+
+/*
+ * Viterbi style alignment: cumulative score with backlinks over the whole
+ * envelope, then the backtrace from the best hop within the last period.
+ * Returns the number of beats written to beats (in frames, ascending).
+ */
+static long alignBeats (const analysis_t *a, double *beats)
+{
+	double *cumulative = malloc(a->nHops * sizeof(double));
+	long *backlink = malloc(a->nHops * sizeof(long));
+	long *path = malloc(a->nHops * sizeof(long));
+	long t, d, nPath = 0, nBeats = 0;
+
+	if (cumulative == NULL || backlink == NULL || path == NULL) {
+		free(cumulative);
+		free(backlink);
+		free(path);
+		return -1;
+	}
+
+	for (t = 0; t < a->nHops; t++) {
+		float period = a->period[t];
+		double best = 0.0;
+
+		backlink[t] = -1;
+
+		if (period > 0.0f) {
+			for (d = lrintf(period / 2); d <= lrintf(2 * period) && d <= t; d++) {
+				double ratio = log(d / period);
+				double score = cumulative[t - d] - TIGHTNESS * ratio * ratio;
+				if (backlink[t] < 0 || score > best) {
+					best = score;
+					backlink[t] = t - d;
+				}
+			}
+		}
+
+		cumulative[t] = a->strength[t] + best;
+	}
+
+	// the last beat is the best hop within the final period
+	long last = a->nHops - 1;
+	long period = lrintf(a->period[last]);
+	for (t = a->nHops - period > 0 ? a->nHops - period : 0; t < a->nHops; t++)
+		if (cumulative[t] > cumulative[last])
+			last = t;
+
+	// the backtrace runs backwards
+	for (t = last; t >= 0; t = backlink[t])
+		path[nPath++] = t;
+
+	/* The grid continues through silence at no cost, so as in Ellis's
+	 * implementation, beats before the music starts and after it ends are
+	 * trimmed: those weaker than half the RMS onset strength at the beats. */
+	double sumSquares = 0.0;
+	for (t = 0; t < nPath; t++)
+		sumSquares += a->strength[path[t]] * a->strength[path[t]];
+	float threshold = 0.5f * sqrt(sumSquares / nPath);
+
+	long first = nPath - 1, end = 0;
+	while (first > 0 && a->strength[path[first]] < threshold)
+		first--;
+	while (end < first && a->strength[path[end]] < threshold)
+		end++;
+
+	for (long i = first; i >= end; i--) {
+		t = path[i];
+
+		// locate the onset strength peak between hops
+		float before = t > 0 ? a->strength[t - 1] : a->strength[t];
+		float after = t + 1 < a->nHops ? a->strength[t + 1] : a->strength[t];
+		float curvature = before - 2.0f * a->strength[t] + after;
+		float offset = curvature < 0.0f ? 0.5f * (before - after) / curvature : 0.0f;
+
+		if (offset < -0.5f)
+			offset = -0.5f;
+		if (offset > 0.5f)
+			offset = 0.5f;
+
+		// same placement as the online tracker: onsets peak a hop late
+		double frame = (t + offset) * MUSIC_HOP - MUSIC_HOP / 2;
+		if (frame >= 0.0)
+			beats[nBeats++] = frame;
+	}
+
+	free(cumulative);
+	free(backlink);
+	free(path);
+	return nBeats;
+}
+
+static void putVariableLength (FILE *file, unsigned long value)
+{
+	unsigned char bytes[5];
+	int n = 0;
+
+	do {
+		bytes[n++] = value & 0x7F;
+		value >>= 7;
+	} while (value > 0);
+
+	while (n > 1)
+		fputc(bytes[--n] | 0x80, file);
+	fputc(bytes[0], file);
+}
+
+static void putTempo (FILE *file, unsigned long delta, double seconds)
+{
+	unsigned long microseconds = lrint(seconds * 1e6);
+
+	putVariableLength(file, delta);
+	fputc(0xFF, file);
+	fputc(0x51, file);
+	fputc(3, file);
+	fputc((microseconds >> 16) & 0xFF, file);
+	fputc((microseconds >> 8) & 0xFF, file);
+	fputc(microseconds & 0xFF, file);
+}
+
+/*
+ * Type 0 Standard MIDI File with a tempo change at every beat, so beat k
+ * falls on quarter note k.  The audio before the first beat becomes a
+ * partial lead-in bar at the first interval's tempo.
+ */
+static int writeTempoMap (const char *path, const double *beats, long nBeats, float sampleRate)
+{
+	FILE *file = fopen(path, "wb");
+	long k;
+
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	static const unsigned char header[] = {
+		'M', 'T', 'h', 'd', 0, 0, 0, 6,
+		0, 0, // format 0
+		0, 1, // one track
+		TICKS_PER_BEAT >> 8, TICKS_PER_BEAT & 0xFF,
+		'M', 'T', 'r', 'k', 0, 0, 0, 0 // length patched below
+	};
+	fwrite(header, 1, sizeof(header), file);
+	long trackStart = ftell(file);
+
+	double firstInterval = (beats[1] - beats[0]) / sampleRate;
+	unsigned long leadIn = lrint(beats[0] / sampleRate / firstInterval * TICKS_PER_BEAT);
+
+	putTempo(file, 0, firstInterval);
+	for (k = 0; k < nBeats - 1; k++)
+		putTempo(file, k == 0 ? leadIn : TICKS_PER_BEAT, (beats[k + 1] - beats[k]) / sampleRate);
+
+	// end of track
+	putVariableLength(file, TICKS_PER_BEAT);
+	fputc(0xFF, file);
+	fputc(0x2F, file);
+	fputc(0, file);
+
+	long length = ftell(file) - trackStart;
+	unsigned char lengthBytes[4] = { length >> 24, length >> 16, length >> 8, length };
+	fseek(file, trackStart - 4, SEEK_SET);
+	fwrite(lengthBytes, 1, 4, file);
+
+	if (fclose(file)) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int offline_analyze (const char *inputPath, const char *outputPath, float preferredTempo_bpm)
+{
+	analysis_t a;
+	music_flux_t flux;
+	float *samples;
+	double *beats = NULL;
+	long nframes;
+	int status = 1;
+
+	memset(&a, 0, sizeof(a));
+
+	if (wav_read_mono(inputPath, &samples, &nframes, &a.sampleRate))
+		return 1;
+
+	if (music_flux_init(&flux, a.sampleRate)) {
+		fprintf(stderr, "cannot allocate spectral analysis\n");
+		free(samples);
+		return 1;
+	}
+
+	a.samples = samples;
+	a.nframes = nframes;
+	a.flux = &flux;
+	a.preferredTempo_bpm = preferredTempo_bpm;
+	a.nHops = nframes / MUSIC_HOP + 1;
+	a.nEstimates = (a.nHops + TEMPO_INTERVAL - 1) / TEMPO_INTERVAL;
+	a.strength = malloc(a.nHops * sizeof(float));
+	a.period = malloc(a.nHops * sizeof(float));
+	a.estimate = malloc(a.nEstimates * sizeof(float));
+	beats = malloc(a.nHops * sizeof(double));
+
+	if (a.strength == NULL || a.period == NULL || a.estimate == NULL || beats == NULL) {
+		fprintf(stderr, "out of memory\n");
+		goto done;
+	}
+
+	if (a.nHops < 2 * hopsOf(&a, MUSIC_MAX_PERIOD_S)) {
+		fprintf(stderr, "%s: too short to find a tempo\n", inputPath);
+		goto done;
+	}
+
+	parallel(&a, a.nHops, fluxSlice);
+
+	if (normalize(&a)) {
+		fprintf(stderr, "out of memory\n");
+		goto done;
+	}
+
+	parallel(&a, a.nEstimates, tempoSlice);
+	localPeriods(&a);
+
+	long nBeats = alignBeats(&a, beats);
+	if (nBeats < 0) {
+		fprintf(stderr, "out of memory\n");
+		goto done;
+	}
+	if (nBeats < 2) {
+		fprintf(stderr, "%s: no beats found\n", inputPath);
+		goto done;
+	}
+
+	if (writeTempoMap(outputPath, beats, nBeats, a.sampleRate))
+		goto done;
+
+	double seconds = (beats[nBeats - 1] - beats[0]) / a.sampleRate;
+	printf("%s: %ld beats, first at %.3f s, average %.2f BPM, tempo map written to %s\n",
+			inputPath, nBeats, beats[0] / a.sampleRate, 60.0 * (nBeats - 1) / seconds, outputPath);
+	status = 0;
+
+done:
+	music_flux_free(&flux);
+	free(samples);
+	free(a.strength);
+	free(a.period);
+	free(a.estimate);
+	free(beats);
+	return status;
+}
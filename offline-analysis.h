@@ -0,0 +1,27 @@
+/** @file offline-analysis.h
+ *
+ * @brief Globally optimal beat alignment of a recording, exported as a
+ * tempo map.
+ *
+ * Without the causality of the live engines, the whole onset strength
+ * envelope is available before any beat is placed.  It is computed in
+ * parallel over slices of the file, normalized over a centered window, and
+ * the local tempo is estimated in overlapping windows.  Dynamic programming
+ * over the whole envelope (Ellis 2007) with a backtrace from the best final
+ * beat then gives the beat sequence that maximizes onset strength at the
+ * beats while keeping intervals close to the local period, which is
+ * cleaner than what the online tracker, committing beats as it goes, can
+ * produce.
+ */
+
+#ifndef OFFLINE_ANALYSIS_H
+#define OFFLINE_ANALYSIS_H
+
+/*
+ * Analyze a WAV file and write its beats as a Standard MIDI File tempo map,
+ * one quarter note per beat.  A summary goes to stdout.  Returns the exit
+ * status for main().
+ */
+int offline_analyze (const char *inputPath, const char *outputPath, float preferredTempo_bpm);
+
+#endif
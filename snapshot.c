@@ -0,0 +1,45 @@
+/** @file snapshot.c
+ *
+ * @brief Copies of a thread's state for another thread to look at, handed
+ * over without either side waiting.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+int snapshot_buffer_init (snapshot_buffer_t *sb, size_t size)
+{
+	sb->slot[0] = calloc(1, size);
+	sb->slot[1] = calloc(1, size);
+
+	if (sb->slot[0] == NULL || sb->slot[1] == NULL)
+		return -1;
+
+	sb->size = size;
+	atomic_store(&sb->pending, 0);
+	sb->front = 0;
+	sb->back = 0; // the first publish moves to slot 1
+	return 0;
+}
+
+void snapshot_publish (snapshot_buffer_t *sb, const void *snapshot)
+{
+	int expected = 1;
+
+	// retract a snapshot still pending and reuse its slot, otherwise the other slot is free
+	if (!atomic_compare_exchange_strong(&sb->pending, &expected, 0))
+		sb->back ^= 1;
+
+	memcpy(sb->slot[sb->back], snapshot, sb->size);
+	atomic_store(&sb->pending, 1);
+}
+
+const void *snapshot_acquire (snapshot_buffer_t *sb)
+{
+	if (atomic_exchange(&sb->pending, 0))
+		sb->front ^= 1;
+
+	return sb->slot[sb->front];
+}
@@ -0,0 +1,37 @@
+/** @file snapshot.h
+ *
+ * @brief Copies of a thread's state for another thread to look at, handed
+ * over without either side waiting.
+ *
+ * The same double buffer as the clock schedule's (see clock-schedule.h),
+ * for any fixed size struct: the owner fills the back slot and flags it,
+ * the reader swaps slots when it finds the flag set and reads the front
+ * slot until its next acquire.  There is one reader, and one writer at a
+ * time.  The UI takes what it shows from these rather than from state the
+ * analysis thread and process() are changing under it.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct {
+	void *slot[2];
+	size_t size;
+	atomic_int pending; // the back slot holds a snapshot not picked up yet
+	int front; // slot read by the reader
+	int back; // slot written by the owner
+} snapshot_buffer_t;
+
+// both slots zeroed; returns 0 on success, -1 if allocation fails
+int snapshot_buffer_init (snapshot_buffer_t *sb, size_t size);
+
+// owner: make a copy of size bytes current, the reader picks it up at its next acquire
+void snapshot_publish (snapshot_buffer_t *sb, const void *snapshot);
+
+// reader: the latest snapshot, valid until the next call
+const void *snapshot_acquire (snapshot_buffer_t *sb);
+
+#endif
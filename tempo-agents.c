@@ -0,0 +1,236 @@
+/** @file tempo-agents.c
+ *
+ * @brief Beam of competing tempo/phase hypotheses for noisy or ambiguous
+ * onset streams.
+ */
+
+#include <math.h>
+
+#include "tempo-agents.h"
+#include "frames.h"
+
+#define TEMPO_AGENT_MIN_PERIOD_S 0.08 // same as the tempo tracker's shortest interval
+#define SIMILAR_PERIOD 0.03f // relative period difference of duplicate agents
+#define FORK_SHARE 0.5f // part of the parent's score a fork starts with
+#define DEAD_SCORE -2.0f // agents below this are dropped
+
+void tempo_agents_init (tempo_agents_t *ta, float sampleRate)
+{
+	ta->sampleRate = sampleRate;
+	ta->innerWindow = 0.05f;
+	ta->outerWindow = 0.2f;
+	ta->phaseGain = 0.5f;
+	ta->periodGain = 0.25f;
+	ta->missPenalty = 0.5f;
+	ta->decay = 0.95f;
+	ta->switchMargin = 1.0f;
+	ta->minScore = 3.0f;
+	tempo_agents_reset(ta);
+}
+
+void tempo_agents_reset (tempo_agents_t *ta)
+{
+	ta->nAgents = 0;
+	ta->nextId = 0;
+	ta->nOnsets = 0;
+	ta->latestOnset = 0.0;
+	ta->peakLevel = 0.0f;
+	ta->best = -1;
+	ta->bestId = -1;
+	ta->accepted = 0;
+	ta->rejected = 0;
+}
+
+static void removeAgent (tempo_agents_t *ta, int slot)
+{
+	int last = --ta->nAgents;
+
+	ta->period[slot] = ta->period[last];
+	ta->next[slot] = ta->next[last];
+	ta->score[slot] = ta->score[last];
+	ta->hit[slot] = ta->hit[last];
+	ta->id[slot] = ta->id[last];
+}
+
+// true if the two hypotheses predict the same grid
+static bool similar (const tempo_agents_t *ta, int slot, float period, float next)
+{
+	float window = ta->innerWindow * period;
+
+	return fabsf(ta->period[slot] - period) < SIMILAR_PERIOD * period
+			&& fabsf(remainderf(ta->next[slot] - next, period)) < window;
+}
+
+/*
+ * Add a hypothesis unless an equivalent one exists.  When the beam is full
+ * the newcomer replaces the weakest agent, if it is weaker than the
+ * newcomer's starting score.
+ */
+static void spawnAgent (tempo_agents_t *ta, float period, float next, float score, float hit)
+{
+	int slot, i;
+
+	if (period < TEMPO_AGENT_MIN_PERIOD_S * ta->sampleRate || period > TEMPO_AGENT_MAX_PERIOD_S * ta->sampleRate)
+		return;
+
+	for (i = 0; i < ta->nAgents; i++)
+		if (similar(ta, i, period, next))
+			return;
+
+	if (ta->nAgents < TEMPO_AGENTS)
+		slot = ta->nAgents++;
+	else {
+		slot = 0;
+		for (i = 1; i < ta->nAgents; i++)
+			if (ta->score[i] < ta->score[slot])
+				slot = i;
+		if (ta->score[slot] >= score || ta->id[slot] == ta->bestId)
+			return;
+	}
+
+	ta->period[slot] = period;
+	ta->next[slot] = next;
+	ta->score[slot] = score;
+	ta->hit[slot] = hit;
+	ta->id[slot] = ta->nextId++;
+}
+
+/*
+ * Score every agent against an onset rel frames after the previous one.
+ * Agents keep predicting through missed clicks: the onset is matched to the
+ * nearest predicted step at or after next[], and the steps before it count
+ * as misses.  Written without branches over the structure of arrays so it
+ * vectorizes.
+ */
+static void scoreAgents (tempo_agents_t *ta, float rel, float salience)
+{
+	const float minPeriod = TEMPO_AGENT_MIN_PERIOD_S * ta->sampleRate;
+	const float maxPeriod = TEMPO_AGENT_MAX_PERIOD_S * ta->sampleRate;
+	const float innerWindow = ta->innerWindow;
+	const float phaseGain = ta->phaseGain;
+	const float periodGain = ta->periodGain;
+	const float missPenalty = ta->missPenalty;
+	const float decay = ta->decay;
+	float *restrict period = ta->period;
+	float *restrict next = ta->next;
+	float *restrict score = ta->score;
+	float *restrict hit = ta->hit;
+	const int n = ta->nAgents;
+
+	for (int i = 0; i < n; i++) {
+		float p = period[i];
+		float ahead = rel - next[i];
+
+		// nearest predicted step, truncation is enough since k < 0 never hits
+		float k = (float) (int) (ahead / p + 0.5f);
+		k = k > 0.0f ? k : 0.0f;
+
+		float error = ahead - k * p;
+		float closeness = 1.0f - fabsf(error) / (innerWindow * p);
+		float isHit = closeness > 0.0f ? 1.0f : 0.0f;
+
+		// predicted steps that went by without an onset
+		float passed = k + (error > 0.0f ? 1.0f - isHit : 0.0f);
+
+		float newPeriod = p + isHit * periodGain * error / (k + 1.0f);
+		newPeriod = newPeriod < minPeriod ? minPeriod : newPeriod;
+		newPeriod = newPeriod > maxPeriod ? maxPeriod : newPeriod;
+
+		float onHit = k * p + phaseGain * error - ahead + newPeriod;
+		float onMiss = passed * p - ahead;
+
+		next[i] = isHit > 0.0f ? onHit : onMiss;
+		period[i] = newPeriod;
+		score[i] = score[i] * decay + isHit * closeness * salience - passed * missPenalty;
+		hit[i] = isHit;
+	}
+}
+
+static void chooseBest (tempo_agents_t *ta)
+{
+	int i, best = -1, current = -1;
+
+	for (i = 0; i < ta->nAgents; i++) {
+		if (best < 0 || ta->score[i] > ta->score[best])
+			best = i;
+		if (ta->id[i] == ta->bestId)
+			current = i;
+	}
+
+	if (current >= 0 && ta->score[best] < ta->score[current] + ta->switchMargin)
+		best = current;
+
+	ta->best = best;
+	ta->bestId = best >= 0 ? ta->id[best] : -1;
+}
+
+bool tempo_agents_onset (tempo_agents_t *ta, double onsetFrame, float peak)
+{
+	int i, j, lag;
+	int nScored = ta->nAgents;
+	float rel = frame_delta(onsetFrame, ta->latestOnset);
+
+	ta->peakLevel = peak > ta->peakLevel ? peak : 0.99f * ta->peakLevel;
+	float salience = 0.5f + 0.5f * (ta->peakLevel > 0.0f ? peak / ta->peakLevel : 1.0f);
+
+	scoreAgents(ta, rel, salience);
+
+	// near misses fork a copy that takes the onset as its phase
+	for (i = 0; i < nScored; i++) {
+		float p = ta->period[i];
+		float distance = fabsf(remainderf(ta->next[i], p));
+		if (ta->hit[i] == 0.0f && ta->score[i] > 0.0f && distance < ta->outerWindow * p)
+			spawnAgent(ta, p, p, FORK_SHARE * ta->score[i], 1.0f);
+	}
+
+	// intervals to recent onsets seed new hypotheses
+	for (lag = 0; lag < ta->nOnsets; lag++)
+		spawnAgent(ta, frame_delta(onsetFrame, ta->recentOnsets[lag]), frame_delta(onsetFrame, ta->recentOnsets[lag]), 0.0f, 1.0f);
+
+	for (lag = TEMPO_AGENT_LAGS - 1; lag > 0; lag--)
+		ta->recentOnsets[lag] = ta->recentOnsets[lag - 1];
+	ta->recentOnsets[0] = onsetFrame;
+	if (ta->nOnsets < TEMPO_AGENT_LAGS)
+		ta->nOnsets++;
+	ta->latestOnset = onsetFrame;
+
+	// drop dead agents, and the weaker of any two that have converged
+	bool drop[TEMPO_AGENTS];
+
+	for (i = 0; i < ta->nAgents; i++)
+		drop[i] = ta->score[i] < DEAD_SCORE;
+
+	for (i = 0; i < ta->nAgents; i++) {
+		for (j = i + 1; j < ta->nAgents && !drop[i]; j++) {
+			if (!drop[j] && similar(ta, j, ta->period[i], ta->next[i])) {
+				if (ta->score[i] < ta->score[j])
+					drop[i] = true;
+				else
+					drop[j] = true;
+			}
+		}
+	}
+
+	for (i = ta->nAgents - 1; i >= 0; i--)
+		if (drop[i] && ta->id[i] != ta->bestId)
+			removeAgent(ta, i);
+
+	chooseBest(ta);
+
+	bool accept = ta->best < 0 || ta->score[ta->best] < ta->minScore || ta->hit[ta->best] > 0.0f;
+
+	if (accept)
+		ta->accepted++;
+	else
+		ta->rejected++;
+
+	return accept;
+}
+
+float tempo_agents_best_bpm (const tempo_agents_t *ta)
+{
+	if (ta->best < 0)
+		return 0.0f;
+
+	return 60.0f * ta->sampleRate / ta->period[ta->best];
+}
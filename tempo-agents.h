@@ -0,0 +1,76 @@
+/** @file tempo-agents.h
+ *
+ * @brief Beam of competing tempo/phase hypotheses for noisy or ambiguous
+ * onset streams.
+ *
+ * Every agent predicts the next step of an onset grid (a period and a
+ * phase).  Onsets close to an agent's prediction raise its score and pull
+ * its period and phase; predicted steps with no onset lower it.  Onsets
+ * that nearly fit an agent fork a copy on the onset's phase, and intervals
+ * to recent onsets seed new agents, so the beam recovers from tempo jumps
+ * and wrong initial guesses.  The best scoring agent decides which onsets
+ * belong to the click, and the rest are dropped before they reach the
+ * tempo tracker.
+ *
+ * Agents live in fixed arrays of TEMPO_AGENTS entries laid out as a
+ * structure of arrays, so the per onset update is one branch free loop the
+ * compiler vectorizes.  Nothing is allocated after tempo_agents_init().
+ */
+
+#ifndef TEMPO_AGENTS_H
+#define TEMPO_AGENTS_H
+
+#include <stdbool.h>
+
+#define TEMPO_AGENTS 32 // beam width, a multiple of the SIMD width
+#define TEMPO_AGENT_LAGS 4 // intervals to this many previous onsets seed agents
+#define TEMPO_AGENT_MAX_PERIOD_S 2.0 // longest step considered
+
+typedef struct {
+	float sampleRate;
+
+	// per agent state, structure of arrays for the vectorized update
+	_Alignas(32) float period[TEMPO_AGENTS]; // frames per step
+	_Alignas(32) float next[TEMPO_AGENTS]; // next predicted step, frames after the latest onset
+	_Alignas(32) float score[TEMPO_AGENTS];
+	_Alignas(32) float hit[TEMPO_AGENTS]; // 1 if the latest onset was on the agent's grid
+	long id[TEMPO_AGENTS]; // stays with the agent when slots are compacted
+	int nAgents;
+	long nextId;
+
+	double latestOnset; // frame the next[] predictions are relative to
+	double recentOnsets[TEMPO_AGENT_LAGS];
+	int nOnsets;
+	float peakLevel; // decaying maximum of the onset peaks, for salience
+
+	// results, updated by tempo_agents_onset()
+	int best; // slot of the agent driving the clock, -1 if none
+	long bestId;
+	long accepted, rejected; // onset counts since the last reset
+
+	// tunables
+	float innerWindow; // distance from a prediction, in periods, that counts as a hit
+	float outerWindow; // distance that forks an agent onto the onset's phase
+	float phaseGain; // fraction of a hit's error taken into the phase
+	float periodGain; // fraction of a hit's error per step taken into the period
+	float missPenalty; // score lost per predicted step with no onset
+	float decay; // score kept per onset
+	float switchMargin; // score lead another agent needs to take over
+	float minScore; // best score needed before onsets are filtered
+} tempo_agents_t;
+
+void tempo_agents_init (tempo_agents_t *ta, float sampleRate);
+void tempo_agents_reset (tempo_agents_t *ta);
+
+/*
+ * Score all agents against an onset and update the beam.  Returns true if
+ * the best agent takes the onset as a step of its grid, or if no agent is
+ * confident enough yet to judge.  Called from process(); work is bounded by
+ * TEMPO_AGENTS.
+ */
+bool tempo_agents_onset (tempo_agents_t *ta, double onsetFrame, float peak);
+
+// tempo of the best agent in steps per minute, 0 if there is none
+float tempo_agents_best_bpm (const tempo_agents_t *ta);
+
+#endif
@@ -0,0 +1,427 @@
+/** @file tempo-tracker.c
+ *
+ * @brief Finds the pulse (quarter note) among metronome subdivisions.
+ */
+
+#include <math.h>
+
+#include "tempo-tracker.h"
+#include "frames.h"
+
+#define MAX_WEIGHT 1e6f
+#define DECAY 0.9f // histogram weight kept per onset
+
+void tempo_tracker_init (tempo_tracker_t *tt, float sampleRate)
+{
+	tt->sampleRate = sampleRate;
+	tt->preferredTempo_bpm = 120.0f;
+	tt->preferenceWidth_oct = 0.5f;
+	tt->subdivisionPenalty = 0.25f;
+	tt->strengthScale_dB = 3.0f;
+	tt->forcedSubdivision = 0;
+	tt->rampTracking = true;
+	tt->maxJump = 0.1f;
+	tt->maxRampChange = 0.002f;
+	tempo_tracker_reset(tt);
+}
+
+void tempo_tracker_reset (tempo_tracker_t *tt)
+{
+	int i;
+
+	for (i = 0; i < TEMPO_HISTOGRAM_BINS; i++)
+		tt->histogram[i] = 0.0f;
+
+	for (i = 0; i < TEMPO_STRENGTH_HISTORY; i++)
+		tt->slotGrid[i] = -1;
+
+	tt->weight = 1.0f;
+	tt->nOnsets = 0;
+	tt->grid = 0;
+	tt->gridSteps = 0;
+	tt->onsetPeriod = 0.0;
+	tt->periodSlope = 0.0;
+	tt->nFit = 0;
+	tt->ramp.linear = 0.0;
+	tt->ramp.quadratic = 0.0;
+	tt->ramp.cubic = 0.0;
+	tt->subdivision = 1;
+	tt->pulsePhase = 0;
+	tt->pulsePeriod = 0.0;
+}
+
+static float binOfPeriod (const tempo_tracker_t *tt, double period)
+{
+	return TEMPO_BINS_PER_OCTAVE * log2(period / (TEMPO_MIN_PERIOD_S * tt->sampleRate));
+}
+
+static double periodOfBin (const tempo_tracker_t *tt, float bin)
+{
+	return TEMPO_MIN_PERIOD_S * tt->sampleRate * exp2(bin / TEMPO_BINS_PER_OCTAVE);
+}
+
+static void addInterval (tempo_tracker_t *tt, double interval)
+{
+	float bin = binOfPeriod(tt, interval);
+	int lower = floorf(bin);
+	float fraction = bin - lower;
+
+	if (lower < 0 || lower + 1 >= TEMPO_HISTOGRAM_BINS)
+		return;
+
+	tt->histogram[lower] += (1.0f - fraction) * tt->weight;
+	tt->histogram[lower + 1] += fraction * tt->weight;
+}
+
+/* Scaling every bin down now and then is the same as decaying every bin at
+ * every onset, at a fraction of the cost.
+ */
+static void advanceWeight (tempo_tracker_t *tt)
+{
+	int i;
+
+	tt->weight /= DECAY;
+	if (tt->weight < MAX_WEIGHT)
+		return;
+
+	for (i = 0; i < TEMPO_HISTOGRAM_BINS; i++)
+		tt->histogram[i] /= tt->weight;
+	tt->weight = 1.0f;
+}
+
+// onset rate: the interval whose multiples (missed or skipped clicks) are best supported
+static double combPeak (const tempo_tracker_t *tt)
+{
+	int bin, m, best = -1;
+	float bestScore = 0.0f;
+
+	for (bin = 0; bin < TEMPO_HISTOGRAM_BINS; bin++) {
+		float score = 0.0f;
+		for (m = 1; m <= TEMPO_LAGS; m++) {
+			int multiple = bin + lrintf(TEMPO_BINS_PER_OCTAVE * log2f(m));
+			if (multiple < TEMPO_HISTOGRAM_BINS)
+				score += tt->histogram[multiple] / m;
+		}
+		if (score > bestScore) {
+			bestScore = score;
+			best = bin;
+		}
+	}
+
+	return best < 0 ? 0.0 : periodOfBin(tt, best);
+}
+
+/* Strength contrast for a subdivision s: mean level of the loudest phase
+ * minus the next loudest, over the recent onsets.  Comparing against the
+ * runner-up rather than the average keeps s = 4 from claiming the evidence
+ * of an s = 2 pattern.
+ */
+static float strengthContrast (const tempo_tracker_t *tt, int s, int *loudestPhase)
+{
+	float sum[TEMPO_MAX_SUBDIVISION] = { 0 };
+	int count[TEMPO_MAX_SUBDIVISION] = { 0 };
+	int i, phase;
+
+	*loudestPhase = 0;
+	if (s == 1)
+		return 0.0f;
+
+	for (i = 0; i < TEMPO_STRENGTH_HISTORY; i++) {
+		if (tt->slotGrid[i] < 0)
+			continue;
+		phase = tt->slotGrid[i] % s;
+		sum[phase] += tt->strength_dB[i];
+		count[phase]++;
+	}
+
+	float loudest = -INFINITY, runnerUp = -INFINITY;
+
+	for (phase = 0; phase < s; phase++) {
+		if (count[phase] == 0)
+			return 0.0f;
+
+		float mean = sum[phase] / count[phase];
+		if (mean > loudest) {
+			runnerUp = loudest;
+			loudest = mean;
+			*loudestPhase = phase;
+		}
+		else if (mean > runnerUp) {
+			runnerUp = mean;
+		}
+	}
+
+	return loudest - runnerUp;
+}
+
+static void chooseSubdivision (tempo_tracker_t *tt)
+{
+	int s, phase, bestPhase = 0;
+	float bestScore = -INFINITY, currentScore = -INFINITY;
+	int best = 1;
+
+	if (tt->forcedSubdivision > 0) {
+		tt->subdivision = tt->forcedSubdivision;
+		strengthContrast(tt, tt->subdivision, &tt->pulsePhase);
+		return;
+	}
+
+	for (s = 1; s <= TEMPO_MAX_SUBDIVISION; s++) {
+		double pulse_bpm = 60.0 * tt->sampleRate / (s * tt->onsetPeriod);
+		float distance = log2f(pulse_bpm / tt->preferredTempo_bpm) / tt->preferenceWidth_oct;
+		float contrast = strengthContrast(tt, s, &phase);
+
+		// log score: tempo preference, strength evidence, bias toward plain clicks
+		float score = -0.5f * distance * distance + contrast / tt->strengthScale_dB;
+		if (s > 1)
+			score += logf(tt->subdivisionPenalty);
+
+		if (s == tt->subdivision)
+			currentScore = score;
+		if (score > bestScore) {
+			bestScore = score;
+			best = s;
+			bestPhase = phase;
+		}
+	}
+
+	// hysteresis: only switch when clearly better
+	if (best != tt->subdivision && bestScore - currentScore < logf(1.5f)) {
+		best = tt->subdivision;
+		strengthContrast(tt, best, &bestPhase);
+	}
+
+	tt->subdivision = best;
+	tt->pulsePhase = bestPhase;
+}
+
+// squared error of steps = a t + b t^2 + c t^3 over the fit points, t in seconds
+static double fitError (const tempo_tracker_t *tt, double a, double b, double c)
+{
+	double error = 0.0;
+	int i;
+
+	for (i = 1; i < tt->nFit; i++) {
+		double x = frame_delta(tt->fitFrame[i], tt->fitFrame[0]) / tt->sampleRate;
+		double e = tt->fitGrid[i] - tt->fitGrid[0] - ((c * x + b) * x + a) * x;
+		error += e * e;
+	}
+
+	return error;
+}
+
+/* Least squares fit of steps = linear t + quadratic t^2 through the latest
+ * onset, where t is frames from it (so older onsets have t < 0).  Grid
+ * position quadratic in time is tempo changing linearly in time, which is
+ * how sequencers and click tracks ramp.  Forcing the fit through the newest
+ * onset keeps the clock anchored on the onset that was actually heard.
+ *
+ * A ramp by a constant ratio per second (exponential in time) bends away
+ * from the quadratic, so with enough onsets a cubic term is fitted too, and
+ * kept if it cuts the fit error by TEMPO_CUBIC_GAIN: jitter alone seldom
+ * does, so steady and linearly ramping clicks keep the quadratic.  The sums
+ * are in seconds, frames to the sixth power would swamp the precision.
+ */
+static void fitRamp (tempo_tracker_t *tt)
+{
+	double s[7] = { 0.0 }, sy[4] = { 0.0 }; // sums of t^k and t^k steps
+	int i, k;
+
+	for (i = 1; i < tt->nFit; i++) {
+		double x = frame_delta(tt->fitFrame[i], tt->fitFrame[0]) / tt->sampleRate;
+		double y = tt->fitGrid[i] - tt->fitGrid[0];
+		double power = 1.0;
+
+		for (k = 0; k < 7; k++) {
+			s[k] += power;
+			if (k < 4)
+				sy[k] += power * y;
+			power *= x;
+		}
+	}
+
+	double determinant = s[2] * s[4] - s[3] * s[3];
+
+	if (tt->rampTracking && tt->nFit >= 4 && fabs(determinant) > 1e-12) {
+		double a = (sy[1] * s[4] - sy[2] * s[3]) / determinant;
+		double b = (s[2] * sy[2] - s[3] * sy[1]) / determinant;
+		double c = 0.0;
+
+		// the cubic's normal equations, by Cramer's rule
+		double d3 = s[2] * (s[4] * s[6] - s[5] * s[5]) - s[3] * (s[3] * s[6] - s[4] * s[5])
+				+ s[4] * (s[3] * s[5] - s[4] * s[4]);
+
+		if (tt->nFit >= TEMPO_CUBIC_POINTS && fabs(d3) > 1e-12) {
+			double a3 = (sy[1] * (s[4] * s[6] - s[5] * s[5]) - s[3] * (sy[2] * s[6] - s[5] * sy[3])
+					+ s[4] * (sy[2] * s[5] - s[4] * sy[3])) / d3;
+			double b3 = (s[2] * (sy[2] * s[6] - s[5] * sy[3]) - sy[1] * (s[3] * s[6] - s[4] * s[5])
+					+ s[4] * (s[3] * sy[3] - sy[2] * s[4])) / d3;
+			double c3 = (s[2] * (s[4] * sy[3] - sy[2] * s[5]) - s[3] * (s[3] * sy[3] - sy[2] * s[4])
+					+ sy[1] * (s[3] * s[5] - s[4] * s[4])) / d3;
+
+			if (fitError(tt, a, b, 0.0) > TEMPO_CUBIC_GAIN * fitError(tt, a3, b3, c3) + 1e-12) {
+				a = a3;
+				b = b3;
+				c = c3;
+			}
+		}
+
+		tt->ramp.linear = a / tt->sampleRate;
+		tt->ramp.quadratic = b / (tt->sampleRate * tt->sampleRate);
+		tt->ramp.cubic = c / (tt->sampleRate * tt->sampleRate * tt->sampleRate);
+
+		// a fit that stops the clock within the next two steps is noise, not a ramp
+		if (tt->ramp.linear > 0.0 && tt->ramp.linear * tt->ramp.linear + 8.0 * tt->ramp.quadratic > 0.0)
+			return;
+	}
+
+	// the last interval, spread over the steps it covers
+	tt->ramp.linear = (tt->fitGrid[0] - tt->fitGrid[1]) / frame_delta(tt->fitFrame[0], tt->fitFrame[1]);
+	tt->ramp.quadratic = 0.0;
+	tt->ramp.cubic = 0.0;
+}
+
+static void addFitPoint (tempo_tracker_t *tt, long grid, double onsetFrame)
+{
+	int i;
+
+	for (i = TEMPO_FIT_POINTS - 1; i > 0; i--) {
+		tt->fitGrid[i] = tt->fitGrid[i - 1];
+		tt->fitFrame[i] = tt->fitFrame[i - 1];
+	}
+	tt->fitGrid[0] = grid;
+	tt->fitFrame[0] = onsetFrame;
+	if (tt->nFit < TEMPO_FIT_POINTS)
+		tt->nFit++;
+}
+
+// solve steps = linear t + quadratic t^2 for t, then refine for the cubic term by Newton's method
+static double solveOffset (const tempo_ramp_t *ramp, double steps)
+{
+	double discriminant = ramp->linear * ramp->linear + 4.0 * ramp->quadratic * steps;
+	double t = 2.0 * steps / (ramp->linear + sqrt(discriminant));
+
+	for (int i = 0; i < 3 && ramp->cubic != 0.0; i++) {
+		double rate = ramp->linear + 2.0 * ramp->quadratic * t + 3.0 * ramp->cubic * t * t;
+		if (rate <= 0.0)
+			break;
+		t -= (((ramp->cubic * t + ramp->quadratic) * t + ramp->linear) * t - steps) / rate;
+	}
+
+	return t;
+}
+
+double tempo_ramp_offset (const tempo_ramp_t *ramp, double steps)
+{
+	// a ramp that comes to a stop within two steps either way has no solution there, keep the tempo of the anchor
+	if (ramp->linear * ramp->linear - 8.0 * fabs(ramp->quadratic) <= 0.0)
+		return steps / ramp->linear;
+
+	// don't follow the ramp more than two steps ahead or back, keep the tempo reached there
+	if (steps > 2.0) {
+		double two = solveOffset(ramp, 2.0);
+		return two + (steps - 2.0) * (two - solveOffset(ramp, 1.0));
+	}
+
+	if (steps < -2.0) {
+		double two = solveOffset(ramp, -2.0);
+		return two + (steps + 2.0) * (solveOffset(ramp, -1.0) - two);
+	}
+
+	return solveOffset(ramp, steps);
+}
+
+double tempo_tracker_offset (const tempo_tracker_t *tt, double steps)
+{
+	return tempo_ramp_offset(&tt->ramp, steps);
+}
+
+bool tempo_tracker_predicts (const tempo_tracker_t *tt, double onsetFrame, double window)
+{
+	if (tt->nOnsets == 0 || tt->onsetPeriod <= 0.0)
+		return false;
+
+	double interval = frame_delta(onsetFrame, tt->recentOnsets[0]);
+	double steps = floor(interval / tt->onsetPeriod + 0.5);
+
+	if (steps < 1.0)
+		steps = 1.0;
+	return fabs(interval - tempo_tracker_offset(tt, steps)) < window * tt->onsetPeriod;
+}
+
+void tempo_tracker_seed (tempo_tracker_t *tt, double pulsePeriod, int subdivision)
+{
+	int lag;
+
+	tempo_tracker_reset(tt);
+
+	tt->subdivision = subdivision;
+	tt->pulsePeriod = pulsePeriod;
+	tt->onsetPeriod = pulsePeriod / subdivision;
+	tt->ramp.linear = 1.0 / tt->onsetPeriod;
+
+	// the intervals a steady run of onsets at that rate leaves in the histogram
+	for (lag = 1; lag <= TEMPO_LAGS; lag++)
+		addInterval(tt, lag * tt->onsetPeriod);
+	advanceWeight(tt);
+}
+
+bool tempo_tracker_onset (tempo_tracker_t *tt, double onsetFrame, float peak)
+{
+	int lag;
+
+	if (tt->nOnsets > 0) {
+		double interval = frame_delta(onsetFrame, tt->recentOnsets[0]);
+
+		for (lag = 0; lag < tt->nOnsets; lag++)
+			addInterval(tt, frame_delta(onsetFrame, tt->recentOnsets[lag]));
+		advanceWeight(tt);
+
+		// grid steps from the current estimate; restart it if the histogram disagrees
+		double histogramPeriod = combPeak(tt);
+		if (tt->onsetPeriod <= 0.0 || (histogramPeriod > 0.0 && fabs(log2(histogramPeriod / tt->onsetPeriod)) > 0.2))
+			tt->onsetPeriod = histogramPeriod > 0.0 ? histogramPeriod : interval;
+
+		tt->gridSteps = lround(interval / tt->onsetPeriod);
+		if (tt->gridSteps < 1)
+			tt->gridSteps = 1;
+
+		/* A tempo jump rather than a ramp restarts the fit from the last
+		 * interval.  A smaller miss means the ramp itself changed (it
+		 * started or stopped), so only the newest onsets are kept. */
+		double error = fabs(interval - tempo_tracker_offset(tt, tt->gridSteps)) * tt->gridSteps / interval;
+		if (tt->nFit < 2 || error > tt->maxJump)
+			tt->nFit = 1;
+		else if (error > tt->maxRampChange && tt->nFit > 3)
+			tt->nFit = 3;
+
+		tt->grid += tt->gridSteps;
+		addFitPoint(tt, tt->grid, onsetFrame);
+		fitRamp(tt);
+
+		tt->onsetPeriod = tempo_tracker_offset(tt, 1.0);
+		tt->periodSlope = tempo_tracker_offset(tt, 2.0) - 2.0 * tt->onsetPeriod;
+	}
+	else {
+		tt->nFit = 0;
+		addFitPoint(tt, tt->grid, onsetFrame);
+	}
+
+	for (lag = TEMPO_LAGS - 1; lag > 0; lag--)
+		tt->recentOnsets[lag] = tt->recentOnsets[lag - 1];
+	tt->recentOnsets[0] = onsetFrame;
+	if (tt->nOnsets < TEMPO_LAGS)
+		tt->nOnsets++;
+
+	int slot = tt->grid % TEMPO_STRENGTH_HISTORY;
+	tt->strength_dB[slot] = 20.0f * log10f(peak > 1e-6f ? peak : 1e-6f);
+	tt->slotGrid[slot] = tt->grid;
+
+	if (tt->onsetPeriod <= 0.0)
+		return true;
+
+	chooseSubdivision(tt);
+	tt->pulsePeriod = tt->subdivision * tt->onsetPeriod;
+
+	return tt->grid % tt->subdivision == tt->pulsePhase;
+}
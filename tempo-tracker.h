@@ -0,0 +1,95 @@
+/** @file tempo-tracker.h
+ *
+ * @brief Finds the pulse (quarter note) among metronome subdivisions.
+ *
+ * Inter-onset intervals to the last few onsets go into a decaying histogram
+ * on a log period axis.  A comb over the histogram gives the onset rate, and
+ * the pulse is picked among 1 to TEMPO_MAX_SUBDIVISION onsets per beat from
+ * a tempo preference and the strength pattern of the onsets (off-beat
+ * subdivisions are usually softer).  Histogram decay is a growing weight
+ * rather than a pass over all bins, so tempo_tracker_onset() costs the same
+ * no matter how long it has been running.
+ *
+ * Onset times are predicted from a quadratic in grid steps fitted through
+ * the latest onset, so accelerando and ritardando are extrapolated instead
+ * of lagging one step behind.  A cubic term is added where it fits the
+ * onsets clearly better, as for a tempo changing by a constant ratio per
+ * second rather than a constant amount.
+ */
+
+#ifndef TEMPO_TRACKER_H
+#define TEMPO_TRACKER_H
+
+#include <stdbool.h>
+
+#define TEMPO_MIN_PERIOD_S 0.08 // shortest inter-onset interval considered
+#define TEMPO_BINS_PER_OCTAVE 40
+#define TEMPO_HISTOGRAM_BINS 200 // 5 octaves
+#define TEMPO_LAGS 4 // intervals to this many previous onsets are counted
+#define TEMPO_MAX_SUBDIVISION 4
+#define TEMPO_STRENGTH_HISTORY 24 // onsets kept for the strength pattern
+#define TEMPO_FIT_POINTS 8 // onsets used for the ramp fit
+#define TEMPO_CUBIC_POINTS 6 // least onsets for a cubic term
+#define TEMPO_CUBIC_GAIN 10.0 // factor it must cut the squared fit error by
+
+// grid steps after the latest onset as a function of frames t since it
+typedef struct {
+	double linear, quadratic, cubic; // steps(t) = linear t + quadratic t^2 + cubic t^3
+} tempo_ramp_t;
+
+typedef struct {
+	float sampleRate;
+
+	float histogram[TEMPO_HISTOGRAM_BINS];
+	float weight; // weight of the next interval, grows to implement decay
+
+	double recentOnsets[TEMPO_LAGS];
+	int nOnsets;
+
+	float strength_dB[TEMPO_STRENGTH_HISTORY];
+	long slotGrid[TEMPO_STRENGTH_HISTORY]; // grid index held by each slot, -1 if empty
+
+	long fitGrid[TEMPO_FIT_POINTS]; // newest first
+	double fitFrame[TEMPO_FIT_POINTS];
+	int nFit;
+	tempo_ramp_t ramp;
+
+	// results, updated by tempo_tracker_onset()
+	long grid; // subdivision grid index of the last onset
+	int gridSteps; // grid steps since the onset before
+	double onsetPeriod; // frames to the next subdivision step, as predicted
+	double periodSlope; // change in onsetPeriod per step, frames
+	int subdivision; // onsets per pulse
+	int pulsePhase; // grid index modulo subdivision that falls on the pulse
+	double pulsePeriod; // frames per pulse, 0 until two onsets are seen
+
+	// tunables
+	float preferredTempo_bpm; // center of the tempo preference
+	float preferenceWidth_oct; // standard deviation of the preference in octaves
+	float subdivisionPenalty; // bias against reading plain clicks as subdivisions
+	float strengthScale_dB; // strength difference that counts as evidence
+	int forcedSubdivision; // 0 to choose automatically
+	bool rampTracking; // extrapolate tempo changes, otherwise repeat the last interval
+	float maxJump; // prediction error, as a fraction of a step, that restarts the fit
+	float maxRampChange; // prediction error that shortens the fit to the newest onsets
+} tempo_tracker_t;
+
+void tempo_tracker_init (tempo_tracker_t *tt, float sampleRate);
+void tempo_tracker_reset (tempo_tracker_t *tt);
+
+// start from a known pulse, as if onsets had been seen at that rate; the next onset is taken for a pulse
+void tempo_tracker_seed (tempo_tracker_t *tt, double pulsePeriod, int subdivision);
+
+// add an onset with its peak amplitude; returns true if it falls on the pulse
+bool tempo_tracker_onset (tempo_tracker_t *tt, double onsetFrame, float peak);
+
+// frames from the latest onset to a (fractional) number of grid steps later
+double tempo_ramp_offset (const tempo_ramp_t *ramp, double steps);
+
+// the same, with the tracker's current prediction
+double tempo_tracker_offset (const tempo_tracker_t *tt, double steps);
+
+// whether an onset falls within window grid steps of a step the tracker predicts after its latest onset
+bool tempo_tracker_predicts (const tempo_tracker_t *tt, double onsetFrame, double window);
+
+#endif
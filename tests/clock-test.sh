@@ -0,0 +1,147 @@
+#!/bin/sh
+#
+# Runs the program under the jack shim of the build through a script and
+# checks the MIDI clock it sent.
+#
+#   clock-test.sh build-dir script
+#
+# The build is configured with -DBUILD_JACK_SHIM=ON.  Besides the shim's
+# commands, the script holds the checks, as comments:
+#
+#   #state name value         a line of the state the run starts from, as a previous run saved it (cold without)
+#   #check from to min max    ticks between from and to seconds, each min to max frames after the one before
+#   #count from to n          n ticks between from and to seconds
+#   #error from to mean max   ms from each click between from and to seconds to the nearest tick, on average and at most
+#   #spread from to max       ms the signed distance from each click to the nearest tick varies over, at most
+#   #played from to mean max  as #error, to the nearest sound the audio output played
+#   #ahead from to min max    ms the nearest played sound starts before each click, on average
+#   #phase from to min max j  ms the alignment log puts the returned clock after the beats, with at most j ms of jitter
+#
+# Times count frames at the script's first rate (48000 if none), xruns
+# included.
+
+set -e
+
+build=$(cd "$1" && pwd)
+script=$2
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+sed -n 's/^#state //p' "$script" > "$work/state"
+[ -s "$work/state" ] || rm "$work/state"
+
+# without a terminal the UI draws to nothing, which is all it needs here;
+# vt100 so it reads the arrow keys the shim types
+TERM=vt100 LD_LIBRARY_PATH="$build/jack-shim" JACK_SHIM_SCRIPT="$script" JACK_SHIM_MIDI_LOG="$work/midi" JACK_SHIM_CLICK_LOG="$work/clicks" JACK_SHIM_PLAYED_LOG="$work/played" \
+	"$build/metronome-audio-to-midi" --state "$work/state" --alignment-log "$work/alignment" < /dev/null > /dev/null
+
+awk '$3 == "f8" { print $1 + $2 }' "$work/midi" > "$work/ticks"
+
+awk -v ticks="$work/ticks" -v clicks="$work/clicks" -v played="$work/played" -v alignment="$work/alignment" '
+	$1 == "rate" && rate == "" { rate = $2 }
+	$1 == "#check" || $1 == "#count" || $1 == "#error" || $1 == "#spread" || $1 == "#played" || $1 == "#ahead" || $1 == "#phase" { checks[n++] = $0 }
+	END {
+		if (rate == "")
+			rate = 48000
+		nTicks = 0
+		while ((getline frame < ticks) > 0)
+			tick[nTicks++] = frame
+		nClicks = 0
+		while ((getline frame < clicks) > 0)
+			click[nClicks++] = frame
+		nSounds = 0
+		while ((getline frame < played) > 0)
+			sound[nSounds++] = frame
+		nAligned = 0
+		while ((getline line < alignment) > 0)
+			if (line !~ /^#/)
+				aligned[nAligned++] = line
+		failed = 0
+		for (c = 0; c < n; c++) {
+			split(checks[c], f)
+			from = f[2] * rate; to = f[3] * rate
+			count = 0; bad = 0
+			if (f[1] == "#error" || f[1] == "#spread" || f[1] == "#played" || f[1] == "#ahead") {
+				# the ticks or the played sounds, whichever the check is against
+				delete mark
+				nMarks = 0
+				if (f[1] == "#played" || f[1] == "#ahead")
+					for (k = 0; k < nSounds; k++)
+						mark[nMarks++] = sound[k]
+				else
+					for (k = 0; k < nTicks; k++)
+						mark[nMarks++] = tick[k]
+				sum = 0; signedSum = 0; worst = 0; low = 1e9; high = -1e9; t = 0
+				for (k = 0; k < nClicks; k++) {
+					if (click[k] < from || click[k] >= to)
+						continue
+					while (t + 1 < nMarks && mark[t + 1] <= click[k])
+						t++
+					signed = nMarks > 0 ? mark[t] - click[k] : 1e9
+					if (t + 1 < nMarks && mark[t + 1] - click[k] < click[k] - mark[t])
+						signed = mark[t + 1] - click[k]
+					signed *= 1000 / rate
+					error = signed < 0 ? -signed : signed
+					count++
+					sum += error
+					signedSum += signed
+					if (error > worst)
+						worst = error
+					if (signed < low)
+						low = signed
+					if (signed > high)
+						high = signed
+				}
+				if ((f[1] == "#error" || f[1] == "#played") && (count == 0 || sum / count > f[4] || worst > f[5])) {
+					printf("failed: %s (%d clicks, %.3f ms on average, %.3f ms at most)\n", checks[c], count, count ? sum / count : 0, worst)
+					failed = 1
+				}
+				if (f[1] == "#spread" && (count == 0 || high - low > f[4])) {
+					printf("failed: %s (%d clicks, ticks %.3f to %.3f ms after them)\n", checks[c], count, low, high)
+					failed = 1
+				}
+				if (f[1] == "#ahead" && (count == 0 || -signedSum / count < f[4] || -signedSum / count > f[5])) {
+					printf("failed: %s (%d clicks, %.4f ms ahead on average)\n", checks[c], count, count ? -signedSum / count : 0)
+					failed = 1
+				}
+				continue
+			}
+			if (f[1] == "#phase") {
+				for (k = 0; k < nAligned; k++) {
+					split(aligned[k], a)
+					if (a[1] < f[2] || a[1] >= f[3])
+						continue
+					count++
+					if (a[3] < f[4] || a[3] > f[5] || a[4] > f[6]) {
+						if (bad++ < 5)
+							printf("beat at %.3f s: phase %.3f ms, jitter %.3f ms\n", a[1], a[3], a[4])
+					}
+				}
+				if (count == 0 || bad > 0) {
+					printf("failed: %s (%d beats)\n", checks[c], count)
+					failed = 1
+				}
+				continue
+			}
+			for (t = 0; t < nTicks; t++) {
+				if (tick[t] < from || tick[t] >= to)
+					continue
+				count++
+				interval = t > 0 ? tick[t] - tick[t - 1] : -1
+				if (f[1] == "#check" && (interval < f[4] || interval > f[5])) {
+					if (bad++ < 5)
+						printf("tick at %.3f s: %d frames after the one before\n", tick[t] / rate, interval)
+				}
+			}
+			if (f[1] == "#check" && (count == 0 || bad > 0) || f[1] == "#count" && count != f[4]) {
+				printf("failed: %s (%d ticks)\n", checks[c], count)
+				failed = 1
+			}
+		}
+		if (n == 0) {
+			print "no checks in the script"
+			failed = 1
+		}
+		exit failed
+	}' "$script"
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Renders an item of the synthetic corpus, runs --offline on it and scores
+# the beats of the tempo map against the item's annotations.
+#
+#   offline-test.sh build-dir seed min-f
+#
+# The item is the first of metronome-corpus --seed seed, 30 seconds long,
+# analyzed with its starting tempo as the preferred tempo.  A beat is found
+# when the tempo map puts one within 70 ms of it; the F-measure of found,
+# missed and extra beats must reach min-f.
+
+set -e
+
+build=$(cd "$1" && pwd)
+seed=$2
+minF=$3
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+"$build/metronome-corpus" "$work" --count 1 --seconds 30 --seed "$seed" > /dev/null
+tempo=$(awk -F '\t' 'NR == 2 { print $3 }' "$work/manifest.tsv")
+
+"$build/metronome-audio-to-midi" --offline "$work/item-000.wav" "$work/map.mid" --preferred-tempo "$tempo"
+
+# the time of every event but the first tempo is a beat, the end of track the last
+od -An -v -tu1 "$work/map.mid" | tr -s ' ' '\n' | sed '/^$/d' > "$work/bytes"
+awk '
+	{ byte[n++] = $1 }
+	END {
+		p = 22; tempo = 0; time = 0; events = 0
+		while (p < n) {
+			delta = 0
+			do { b = byte[p++]; delta = delta * 128 + b % 128 } while (b >= 128)
+			time += delta / 480 * tempo
+			if (events++ > 0)
+				printf "%.6f\n", time
+			type = byte[p + 1]; size = byte[p + 2]
+			if (type == 81)
+				tempo = (byte[p + 3] * 65536 + byte[p + 4] * 256 + byte[p + 5]) / 1e6
+			p += 3 + size
+		}
+	}' "$work/bytes" > "$work/found"
+
+awk -v foundFile="$work/found" -v minF="$minF" -v item="seed $seed, $tempo BPM" '
+	{ beat[nBeats++] = $1 }
+	END {
+		while ((getline t < foundFile) > 0)
+			found[nFound++] = t
+		hits = 0; f = 0
+		for (k = 0; k < nBeats; k++) {
+			while (f < nFound && found[f] < beat[k] - 0.07)
+				f++
+			if (f < nFound && found[f] <= beat[k] + 0.07) {
+				hits++
+				f++
+			}
+		}
+		score = nBeats + nFound > 0 ? 2 * hits / (nBeats + nFound) : 0
+		if (score < minF) {
+			printf "failed: %s: F %.3f, %d of %d beats found, %d extra\n", item, score, hits, nBeats, nFound - hits
+			exit 1
+		}
+	}' "$work/item-000.beats"
@@ -0,0 +1,168 @@
+/** @file warm-start.c
+ *
+ * @brief The tempo, thresholds and latency calibration kept across restarts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "warm-start.h"
+
+int warm_start_load (const char *path, warm_state_t *state)
+{
+	FILE *file = fopen(path, "r");
+	char line[128], name[64];
+	float value;
+
+	if (file == NULL)
+		return -1;
+
+	memset(state, 0, sizeof(*state));
+
+	// names not known are skipped, so older and newer versions can share a file
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%63s %f", name, &value) != 2)
+			continue;
+
+		if (strcmp(name, "tempo_bpm") == 0)
+			state->tempo_bpm = value;
+		else if (strcmp(name, "subdivision") == 0)
+			state->subdivision = value;
+		else if (strcmp(name, "rising_threshold_dB") == 0)
+			state->risingThreshold_dB = value;
+		else if (strcmp(name, "falling_threshold_dB") == 0)
+			state->fallingThreshold_dB = value;
+		else if (strcmp(name, "low_minimum_time_ms") == 0)
+			state->lowMinTime_ms = value;
+		else if (strcmp(name, "clock_lead_ms") == 0)
+			state->clockLead_ms = value;
+	}
+
+	fclose(file);
+
+	// thresholds are the least a state must have
+	return state->risingThreshold_dB < 0.0f && state->fallingThreshold_dB < 0.0f ? 0 : -1;
+}
+
+// write to the temporary file, sync it, then rename it over the state file
+static int writeState (const warm_start_t *ws, const warm_state_t *state)
+{
+	FILE *file = fopen(ws->temporaryPath, "w");
+
+	if (file == NULL)
+		return -1;
+
+	fprintf(file, "tempo_bpm %.3f\n", state->tempo_bpm);
+	fprintf(file, "subdivision %d\n", state->subdivision);
+	fprintf(file, "rising_threshold_dB %.2f\n", state->risingThreshold_dB);
+	fprintf(file, "falling_threshold_dB %.2f\n", state->fallingThreshold_dB);
+	fprintf(file, "low_minimum_time_ms %.2f\n", state->lowMinTime_ms);
+	fprintf(file, "clock_lead_ms %.3f\n", state->clockLead_ms);
+
+	if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+		fclose(file);
+		unlink(ws->temporaryPath);
+		return -1;
+	}
+
+	if (fclose(file) != 0 || rename(ws->temporaryPath, ws->path) != 0) {
+		unlink(ws->temporaryPath);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *writerThread (void *arg)
+{
+	warm_start_t *ws = arg;
+	warm_state_t state;
+
+	pthread_mutex_lock(&ws->lock);
+
+	while (true) {
+		while (!ws->dirty && !ws->stopping)
+			pthread_cond_wait(&ws->changed, &ws->lock);
+
+		if (!ws->dirty)
+			break;
+
+		state = ws->pending;
+		ws->dirty = false;
+
+		pthread_mutex_unlock(&ws->lock);
+		atomic_store(&ws->failed, writeState(ws, &state) != 0);
+		pthread_mutex_lock(&ws->lock);
+
+		// changes in the meantime wait, unless this is the last write
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += WARM_START_INTERVAL_S;
+
+		while (!ws->stopping && pthread_cond_timedwait(&ws->changed, &ws->lock, &until) == 0)
+			;
+	}
+
+	pthread_mutex_unlock(&ws->lock);
+	return NULL;
+}
+
+int warm_start_init (warm_start_t *ws, const char *path, const warm_state_t *initial)
+{
+	ws->path = strdup(path);
+	ws->temporaryPath = malloc(strlen(path) + sizeof(".tmp"));
+
+	if (ws->path == NULL || ws->temporaryPath == NULL) {
+		free(ws->path);
+		free(ws->temporaryPath);
+		return -1;
+	}
+
+	sprintf(ws->temporaryPath, "%s.tmp", path);
+
+	ws->queued = *initial;
+	ws->pending = *initial;
+	ws->dirty = false;
+	ws->stopping = false;
+	atomic_init(&ws->failed, false);
+
+	pthread_mutex_init(&ws->lock, NULL);
+	pthread_cond_init(&ws->changed, NULL);
+
+	if (pthread_create(&ws->thread, NULL, writerThread, ws)) {
+		free(ws->path);
+		free(ws->temporaryPath);
+		return -1;
+	}
+
+	return 0;
+}
+
+void warm_start_save (warm_start_t *ws, const warm_state_t *state)
+{
+	if (memcmp(state, &ws->queued, sizeof(*state)) == 0)
+		return;
+
+	ws->queued = *state;
+
+	pthread_mutex_lock(&ws->lock);
+	ws->pending = *state;
+	ws->dirty = true;
+	pthread_cond_signal(&ws->changed);
+	pthread_mutex_unlock(&ws->lock);
+}
+
+void warm_start_free (warm_start_t *ws)
+{
+	pthread_mutex_lock(&ws->lock);
+	ws->stopping = true;
+	pthread_cond_signal(&ws->changed);
+	pthread_mutex_unlock(&ws->lock);
+	pthread_join(ws->thread, NULL);
+
+	free(ws->path);
+	free(ws->temporaryPath);
+}
@@ -0,0 +1,61 @@
+/** @file warm-start.h
+ *
+ * @brief The tempo, thresholds and latency calibration kept across restarts.
+ *
+ * A restart mid-show shouldn't cost a calibration pass and a handful of
+ * clicks before the clock comes back.  The UI hands the current settings to
+ * a writer thread whenever they change; the writer saves them at most every
+ * WARM_START_INTERVAL_S, to a temporary file that is synced and renamed over
+ * the state file, so a crash or power cut leaves either the old state or the
+ * new one.  At startup the state is read back to seed the tracker.
+ *
+ * The file is plain text, a "name value" pair per line.
+ */
+
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define WARM_START_INTERVAL_S 5 // least time between writes
+
+typedef struct {
+	float tempo_bpm; // 0 if not known
+	int subdivision; // clicks per beat
+	float risingThreshold_dB;
+	float fallingThreshold_dB;
+	float lowMinTime_ms;
+	float clockLead_ms;
+} warm_state_t;
+
+typedef struct {
+	char *path;
+	char *temporaryPath;
+
+	warm_state_t queued; // last state handed over, UI thread only
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	warm_state_t pending; // guarded by lock
+	bool dirty; // pending not written yet
+	bool stopping;
+
+	atomic_bool failed; // the last write failed
+} warm_start_t;
+
+// read a saved state; returns 0, or -1 if there is none (or it can't be read)
+int warm_start_load (const char *path, warm_state_t *state);
+
+// start the writer thread for a state file
+int warm_start_init (warm_start_t *ws, const char *path, const warm_state_t *initial);
+
+// UI thread: have the state written if it changed
+void warm_start_save (warm_start_t *ws, const warm_state_t *state);
+
+// write what is pending and stop the writer
+void warm_start_free (warm_start_t *ws);
+
+#endif
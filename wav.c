@@ -0,0 +1,180 @@
+/** @file wav.c
+ *
+ * @brief Minimal WAV file reading for the offline analysis, and writing
+ * for the test corpus.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wav.h"
+
+#define FORMAT_PCM 1
+#define FORMAT_FLOAT 3
+#define FORMAT_EXTENSIBLE 0xFFFE
+
+static uint32_t le32 (const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t le16 (const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void putLe32 (unsigned char *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static void putLe16 (unsigned char *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+// one sample of the given format as a float in [-1, 1)
+static float decodeSample (const unsigned char *p, int format, int bits)
+{
+	if (format == FORMAT_FLOAT) {
+		float value;
+		uint32_t word = le32(p);
+		memcpy(&value, &word, sizeof(value));
+		return value;
+	}
+
+	switch (bits) {
+	case 8:
+		return (p[0] - 128) / 128.0f;
+	case 16:
+		return (int16_t) le16(p) / 32768.0f;
+	case 24:
+		return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) / 2147483648.0f;
+	default:
+		return (int32_t) le32(p) / 2147483648.0f;
+	}
+}
+
+int wav_read_mono (const char *path, float **samples, long *nframes, float *sampleRate)
+{
+	unsigned char header[12], chunk[8], format[40];
+	int formatTag = 0, channels = 0, bits = 0;
+	unsigned char *data = NULL;
+	uint32_t dataSize = 0;
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (fread(header, 1, sizeof(header), file) != sizeof(header)
+			|| memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	// walk the chunks for the format and the sample data
+	while (data == NULL && fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+		uint32_t size = le32(chunk + 4);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && size <= sizeof(format)) {
+			if (fread(format, 1, size, file) != size)
+				break;
+			formatTag = le16(format);
+			channels = le16(format + 2);
+			*sampleRate = le32(format + 4);
+			bits = le16(format + 14);
+			if (formatTag == FORMAT_EXTENSIBLE && size >= 26)
+				formatTag = le16(format + 24);
+		}
+		else if (memcmp(chunk, "data", 4) == 0 && formatTag != 0) {
+			data = malloc(size);
+			if (data == NULL || fread(data, 1, size, file) != size) {
+				free(data);
+				data = NULL;
+				break;
+			}
+			dataSize = size;
+		}
+		else if (fseek(file, size + (size & 1), SEEK_CUR))
+			break;
+	}
+
+	fclose(file);
+
+	if (data == NULL || channels < 1 || (formatTag != FORMAT_PCM && formatTag != FORMAT_FLOAT)
+			|| (formatTag == FORMAT_FLOAT && bits != 32) || bits % 8 || bits < 8 || bits > 32) {
+		fprintf(stderr, "%s: unsupported or damaged WAV file\n", path);
+		free(data);
+		return -1;
+	}
+
+	int frameSize = channels * bits / 8;
+	*nframes = dataSize / frameSize;
+	*samples = malloc(*nframes * sizeof(float));
+
+	if (*samples == NULL) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		free(data);
+		return -1;
+	}
+
+	for (long i = 0; i < *nframes; i++) {
+		float sum = 0.0f;
+		for (int c = 0; c < channels; c++)
+			sum += decodeSample(data + i * frameSize + c * bits / 8, formatTag, bits);
+		(*samples)[i] = sum / channels;
+	}
+
+	free(data);
+	return 0;
+}
+
+int wav_write_mono (const char *path, const float *samples, long nframes, float sampleRate)
+{
+	unsigned char header[44], sample[2];
+	uint32_t dataSize = nframes * 2;
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	memcpy(header, "RIFF", 4);
+	putLe32(header + 4, 36 + dataSize);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	putLe32(header + 16, 16);
+	putLe16(header + 20, FORMAT_PCM);
+	putLe16(header + 22, 1);
+	putLe32(header + 24, sampleRate);
+	putLe32(header + 28, sampleRate * 2);
+	putLe16(header + 32, 2);
+	putLe16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	putLe32(header + 40, dataSize);
+
+	fwrite(header, 1, sizeof(header), file);
+
+	for (long i = 0; i < nframes; i++) {
+		float x = samples[i] > 1.0f ? 1.0f : samples[i] < -1.0f ? -1.0f : samples[i];
+		putLe16(sample, (int16_t) lrintf(x * 32767.0f));
+		fwrite(sample, 1, sizeof(sample), file);
+	}
+
+	if (fclose(file) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
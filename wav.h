@@ -0,0 +1,24 @@
+/** @file wav.h
+ *
+ * @brief Minimal WAV file reading for the offline analysis, and writing
+ * for the test corpus.
+ *
+ * Reading handles PCM (8, 16, 24 and 32 bit) and 32 bit float, including the
+ * WAVE_FORMAT_EXTENSIBLE variants, which covers what audio editors export.
+ * Writing is 16 bit PCM mono, which everything reads.
+ */
+
+#ifndef WAV_H
+#define WAV_H
+
+/*
+ * Read a whole file, mixed down to mono.  On success *samples is allocated
+ * with malloc() and the caller frees it.  Returns 0, or -1 with a message
+ * on stderr.
+ */
+int wav_read_mono (const char *path, float **samples, long *nframes, float *sampleRate);
+
+// write samples, clipped to [-1, 1]; returns 0, or -1 with a message on stderr
+int wav_write_mono (const char *path, const float *samples, long nframes, float sampleRate);
+
+#endif